@@ -1,53 +1,13 @@
 #include "boolean_search.h"
 #include <cmath>
 
-BooleanSearch::BooleanSearch(const InvertedIndex& index) : index_(index), qpos_(0) {}
-
-std::vector<size_t> BooleanSearch::intersect(const std::vector<size_t>& a, const std::vector<size_t>& b) {
-    std::vector<size_t> result;
-    size_t i = 0, j = 0;
-    while (i < a.size() && j < b.size()) {
-        if (a[i] == b[j]) { result.push_back(a[i]); ++i; ++j; }
-        else if (a[i] < b[j]) ++i;
-        else ++j;
-    }
-    return result;
-}
-
-std::vector<size_t> BooleanSearch::unite(const std::vector<size_t>& a, const std::vector<size_t>& b) {
-    std::vector<size_t> result;
-    size_t i = 0, j = 0;
-    while (i < a.size() && j < b.size()) {
-        if (a[i] == b[j]) { result.push_back(a[i]); ++i; ++j; }
-        else if (a[i] < b[j]) { result.push_back(a[i]); ++i; }
-        else { result.push_back(b[j]); ++j; }
-    }
-    while (i < a.size()) result.push_back(a[i++]);
-    while (j < b.size()) result.push_back(b[j++]);
-    return result;
-}
+static const double BM25_K1 = 1.2;
+static const double BM25_B = 0.75;
 
-std::vector<size_t> BooleanSearch::subtract(const std::vector<size_t>& a, const std::vector<size_t>& b) {
-    std::vector<size_t> result;
-    size_t i = 0, j = 0;
-    while (i < a.size()) {
-        if (j >= b.size() || a[i] < b[j]) { result.push_back(a[i]); ++i; }
-        else if (a[i] == b[j]) { ++i; ++j; }
-        else ++j;
-    }
-    return result;
-}
-
-std::vector<size_t> BooleanSearch::all_doc_ids() {
-    std::vector<size_t> result;
-    size_t n = index_.document_count();
-    result.reserve(n);
-    for (size_t i = 0; i < n; ++i)
-        result.push_back(i);
-    return result;
-}
+BooleanSearch::BooleanSearch(const SegmentSet& segments, const StemCache* stems)
+    : segments_(segments), stems_(stems) {}
 
-std::vector<BooleanSearch::QToken> BooleanSearch::lex(const std::string& q) {
+std::vector<BooleanSearch::QToken> BooleanSearch::lex(QueryContext& ctx, const std::string& q) const {
     std::vector<QToken> result;
     size_t i = 0;
     while (i < q.size()) {
@@ -100,9 +60,10 @@ std::vector<BooleanSearch::QToken> BooleanSearch::lex(const std::string& q) {
             result.push_back({TokType::NOT_OP, ""}); continue;
         }
 
-        auto tokens = tokenizer_.tokenize(word);
+        auto tokens = ctx.tokenizer.tokenize(word);
         for (size_t t = 0; t < tokens.size(); ++t) {
-            std::string stemmed = stemmer_.stem(tokens[t].text);
+            const std::string* cached = stems_ ? stems_->find(tokens[t].text) : nullptr;
+            std::string stemmed = cached ? *cached : ctx.stemmer.stem(tokens[t].text);
             result.push_back({TokType::WORD, stemmed});
         }
     }
@@ -110,155 +71,493 @@ std::vector<BooleanSearch::QToken> BooleanSearch::lex(const std::string& q) {
     return result;
 }
 
-std::vector<size_t> BooleanSearch::term_docs(const std::string& stemmed) {
-    const PostingList* pl = index_.get_posting_list(stemmed);
-    if (!pl) return {};
-    std::vector<size_t> docs;
-    docs.reserve(pl->postings.size());
-    for (size_t i = 0; i < pl->postings.size(); ++i)
-        docs.push_back(pl->postings[i].doc_id);
-    for (size_t i = 1; i < docs.size(); ++i) {
-        size_t key = docs[i];
-        size_t j = i;
-        while (j > 0 && docs[j-1] > key) { docs[j] = docs[j-1]; --j; }
-        docs[j] = key;
-    }
-    return docs;
+size_t BooleanSearch::add_node(QueryContext& ctx, NodeKind kind) const {
+    QNode node;
+    node.kind = kind;
+    node.cost = 0;
+    ctx.nodes.push_back(node);
+    return ctx.nodes.size() - 1;
 }
 
-std::vector<size_t> BooleanSearch::parse_or_expr() {
-    auto result = parse_and_expr();
-    while (qpos_ < qtokens_.size() && qtokens_[qpos_].type == TokType::OR_OP) {
-        ++qpos_;
-        result = unite(result, parse_and_expr());
+size_t BooleanSearch::parse_or_expr(QueryContext& ctx) const {
+    size_t left = parse_and_expr(ctx);
+    if (ctx.pos >= ctx.tokens.size() || ctx.tokens[ctx.pos].type != TokType::OR_OP)
+        return left;
+    size_t node = add_node(ctx, NodeKind::OR);
+    ctx.nodes[node].children.push_back(left);
+    while (ctx.pos < ctx.tokens.size() && ctx.tokens[ctx.pos].type == TokType::OR_OP) {
+        ++ctx.pos;
+        size_t right = parse_and_expr(ctx);
+        ctx.nodes[node].children.push_back(right);
     }
-    return result;
+    return node;
 }
 
-std::vector<size_t> BooleanSearch::parse_and_expr() {
-    auto result = parse_unary();
-    while (qpos_ < qtokens_.size()) {
-        if (qtokens_[qpos_].type == TokType::AND_OP) {
-            ++qpos_;
-            result = intersect(result, parse_unary());
-        } else if (qtokens_[qpos_].type == TokType::WORD ||
-                   qtokens_[qpos_].type == TokType::NOT_OP ||
-                   qtokens_[qpos_].type == TokType::LPAREN) {
-            result = intersect(result, parse_unary());
-        } else {
+size_t BooleanSearch::parse_and_expr(QueryContext& ctx) const {
+    size_t left = parse_unary(ctx);
+    size_t node = SIZE_MAX;
+    while (ctx.pos < ctx.tokens.size()) {
+        if (ctx.tokens[ctx.pos].type == TokType::AND_OP) {
+            ++ctx.pos;
+        } else if (ctx.tokens[ctx.pos].type != TokType::WORD &&
+                   ctx.tokens[ctx.pos].type != TokType::NOT_OP &&
+                   ctx.tokens[ctx.pos].type != TokType::LPAREN) {
             break;
         }
+        if (node == SIZE_MAX) {
+            node = add_node(ctx, NodeKind::AND);
+            ctx.nodes[node].children.push_back(left);
+        }
+        size_t right = parse_unary(ctx);
+        ctx.nodes[node].children.push_back(right);
     }
-    return result;
+    return node == SIZE_MAX ? left : node;
 }
 
-std::vector<size_t> BooleanSearch::parse_unary() {
-    if (qpos_ < qtokens_.size() && qtokens_[qpos_].type == TokType::NOT_OP) {
-        ++qpos_;
-        return subtract(all_doc_ids(), parse_unary());
+size_t BooleanSearch::parse_unary(QueryContext& ctx) const {
+    if (ctx.pos < ctx.tokens.size() && ctx.tokens[ctx.pos].type == TokType::NOT_OP) {
+        ++ctx.pos;
+        size_t child = parse_unary(ctx);
+        size_t node = add_node(ctx, NodeKind::NOT);
+        ctx.nodes[node].children.push_back(child);
+        return node;
     }
-    return parse_primary();
+    return parse_primary(ctx);
 }
 
-std::vector<size_t> BooleanSearch::parse_primary() {
-    if (qpos_ < qtokens_.size() && qtokens_[qpos_].type == TokType::LPAREN) {
-        ++qpos_;
-        auto result = parse_or_expr();
-        if (qpos_ < qtokens_.size() && qtokens_[qpos_].type == TokType::RPAREN)
-            ++qpos_;
-        return result;
+size_t BooleanSearch::parse_primary(QueryContext& ctx) const {
+    if (ctx.pos < ctx.tokens.size() && ctx.tokens[ctx.pos].type == TokType::LPAREN) {
+        ++ctx.pos;
+        size_t node = parse_or_expr(ctx);
+        if (ctx.pos < ctx.tokens.size() && ctx.tokens[ctx.pos].type == TokType::RPAREN)
+            ++ctx.pos;
+        return node;
     }
-    if (qpos_ < qtokens_.size() && qtokens_[qpos_].type == TokType::WORD) {
-        std::string term = qtokens_[qpos_].text;
-        ++qpos_;
-        return term_docs(term);
+    size_t node = add_node(ctx, NodeKind::TERM);
+    if (ctx.pos < ctx.tokens.size() && ctx.tokens[ctx.pos].type == TokType::WORD) {
+        ctx.nodes[node].term = ctx.tokens[ctx.pos].text;
+        ++ctx.pos;
     }
-    return {};
+    return node;
 }
 
-static void merge_sr(std::vector<SearchResult>& a, std::vector<SearchResult>& t,
-                     size_t l, size_t m, size_t r) {
-    size_t i = l, j = m, k = l;
-    while (i < m && j < r) {
-        if (a[i].score >= a[j].score) t[k++] = a[i++];
-        else t[k++] = a[j++];
+// Flattens nested AND/OR nodes, folds double negation and estimates each
+// node's result size. Conjuncts are ordered positive-first by ascending
+// cost, so evaluation starts from the rarest term and negated operands
+// are applied last as ANDNOT.
+void BooleanSearch::plan(QueryContext& ctx, size_t n) const {
+    for (size_t i = 0; i < ctx.nodes[n].children.size(); ++i)
+        plan(ctx, ctx.nodes[n].children[i]);
+
+    QNode& node = ctx.nodes[n];
+    if (node.kind == NodeKind::TERM) {
+        node.cost = document_frequency(node.term);
+        return;
+    }
+    if (node.kind == NodeKind::NOT) {
+        const QNode& child = ctx.nodes[node.children[0]];
+        if (child.kind == NodeKind::NOT) {
+            QNode inner = ctx.nodes[child.children[0]];
+            node = inner;
+            return;
+        }
+        node.cost = ctx.universe > child.cost ? ctx.universe - child.cost : 0;
+        return;
     }
-    while (i < m) t[k++] = a[i++];
-    while (j < r) t[k++] = a[j++];
-    for (size_t x = l; x < r; ++x) a[x] = t[x];
+
+    std::vector<size_t> flat;
+    for (size_t i = 0; i < node.children.size(); ++i) {
+        const QNode& child = ctx.nodes[node.children[i]];
+        if (child.kind == node.kind) {
+            for (size_t j = 0; j < child.children.size(); ++j)
+                flat.push_back(child.children[j]);
+        } else {
+            flat.push_back(node.children[i]);
+        }
+    }
+
+    if (node.kind == NodeKind::OR) {
+        size_t total = 0;
+        for (size_t i = 0; i < flat.size(); ++i)
+            total += ctx.nodes[flat[i]].cost;
+        node.cost = total < ctx.universe ? total : ctx.universe;
+        node.children.swap(flat);
+        return;
+    }
+
+    for (size_t i = 1; i < flat.size(); ++i) {
+        size_t c = flat[i];
+        bool neg = ctx.nodes[c].kind == NodeKind::NOT;
+        size_t j = i;
+        while (j > 0) {
+            const QNode& prev = ctx.nodes[flat[j - 1]];
+            bool prev_neg = prev.kind == NodeKind::NOT;
+            if (prev_neg < neg || (prev_neg == neg && prev.cost <= ctx.nodes[c].cost)) break;
+            flat[j] = flat[j - 1];
+            --j;
+        }
+        flat[j] = c;
+    }
+    node.cost = ctx.universe;
+    for (size_t i = 0; i < flat.size(); ++i) {
+        const QNode& child = ctx.nodes[flat[i]];
+        if (child.kind != NodeKind::NOT && child.cost < node.cost) node.cost = child.cost;
+    }
+    node.children.swap(flat);
+}
+
+size_t BooleanSearch::document_frequency(const std::string& term) const {
+    size_t df = 0;
+    for (size_t s = 0; s < segments_.segments.size(); ++s)
+        df += segments_.segments[s].index->find_postings(term).size();
+    return df;
 }
 
-static void msort_sr(std::vector<SearchResult>& a, std::vector<SearchResult>& t,
-                     size_t l, size_t r) {
-    if (r - l <= 1) return;
-    size_t m = l + (r - l) / 2;
-    msort_sr(a, t, l, m);
-    msort_sr(a, t, m, r);
-    merge_sr(a, t, l, m, r);
+// Dense terms hand out their prebuilt bitmap; the rest are decoded into a
+// sorted array.
+DocSet BooleanSearch::term_docs(const PostingView& pl) const {
+    if (pl.empty()) return DocSet();
+    if (pl.bitmap()) return DocSet::borrow_bitmap(pl.bitmap(), pl.bitmap_words());
+    std::vector<uint32_t> docs;
+    pl.decode_doc_ids(docs);
+    return DocSet::from_ids(std::move(docs));
 }
 
-std::vector<SearchResult> BooleanSearch::search(const std::string& query, size_t max_results) {
-    qtokens_ = lex(query);
-    qpos_ = 0;
+// Evaluates the query on one segment, in its local doc ids.
+DocSet BooleanSearch::evaluate(const QueryContext& ctx, size_t n, const Segment& seg) const {
+    const QNode& node = ctx.nodes[n];
+    size_t universe = seg.document_count();
+    switch (node.kind) {
+    case NodeKind::TERM:
+        return term_docs(seg.index->find_postings(node.term));
+    case NodeKind::NOT: {
+        DocSet result = evaluate(ctx, node.children[0], seg);
+        result.negate();
+        return result;
+    }
+    case NodeKind::AND: {
+        DocSet result = evaluate(ctx, node.children[0], seg);
+        for (size_t i = 1; i < node.children.size(); ++i) {
+            if (!result.negated() && result.empty()) break;
+            result = DocSet::intersect(result, evaluate(ctx, node.children[i], seg), universe);
+        }
+        return result;
+    }
+    case NodeKind::OR: {
+        DocSet result = evaluate(ctx, node.children[0], seg);
+        for (size_t i = 1; i < node.children.size(); ++i) {
+            if (result.negated() && result.empty()) break;
+            result = DocSet::unite(result, evaluate(ctx, node.children[i], seg), universe);
+        }
+        return result;
+    }
+    }
+    return DocSet();
+}
+
+// Top-k candidates ordered worst-first in a binary heap. Equal scores
+// rank by ascending doc id, matching the stable sort this replaced.
+static bool worse(const ScoredDoc& a, const ScoredDoc& b) {
+    return a.score < b.score || (a.score == b.score && a.doc_id > b.doc_id);
+}
+
+static void heap_sift_up(std::vector<ScoredDoc>& h, size_t i) {
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!worse(h[i], h[parent])) break;
+        ScoredDoc t = h[i]; h[i] = h[parent]; h[parent] = t;
+        i = parent;
+    }
+}
 
-    if (qtokens_.empty() || qtokens_[0].type == TokType::END)
-        return {};
+static void heap_sift_down(std::vector<ScoredDoc>& h, size_t i, size_t n) {
+    while (true) {
+        size_t l = 2 * i + 1, r = l + 1, m = i;
+        if (l < n && worse(h[l], h[m])) m = l;
+        if (r < n && worse(h[r], h[m])) m = r;
+        if (m == i) break;
+        ScoredDoc t = h[i]; h[i] = h[m]; h[m] = t;
+        i = m;
+    }
+}
 
-    auto result_docs = parse_or_expr();
+// Lexes, parses and plans the query; returns the AST root, or SIZE_MAX
+// for a query without tokens.
+size_t BooleanSearch::prepare(QueryContext& ctx, const std::string& query) const {
+    ctx.tokens = lex(ctx, query);
+    ctx.universe = segments_.document_count();
+    if (ctx.tokens.empty() || ctx.tokens[0].type == TokType::END)
+        return SIZE_MAX;
+    size_t root = parse_or_expr(ctx);
+    plan(ctx, root);
+    return root;
+}
 
+// Terms that contribute to the score: words not directly preceded by a
+// NOT, or every word if that leaves none.
+std::vector<std::string> BooleanSearch::scored_terms(const QueryContext& ctx) const {
     std::vector<std::string> pos_terms;
     bool prev_not = false;
-    for (size_t i = 0; i < qtokens_.size(); ++i) {
-        if (qtokens_[i].type == TokType::NOT_OP) { prev_not = true; continue; }
-        if (qtokens_[i].type == TokType::WORD) {
-            if (!prev_not) pos_terms.push_back(qtokens_[i].text);
+    for (size_t i = 0; i < ctx.tokens.size(); ++i) {
+        if (ctx.tokens[i].type == TokType::NOT_OP) { prev_not = true; continue; }
+        if (ctx.tokens[i].type == TokType::WORD) {
+            if (!prev_not) pos_terms.push_back(ctx.tokens[i].text);
             prev_not = false;
         } else {
             prev_not = false;
         }
     }
     if (pos_terms.empty()) {
-        for (size_t i = 0; i < qtokens_.size(); ++i)
-            if (qtokens_[i].type == TokType::WORD)
-                pos_terms.push_back(qtokens_[i].text);
+        for (size_t i = 0; i < ctx.tokens.size(); ++i)
+            if (ctx.tokens[i].type == TokType::WORD)
+                pos_terms.push_back(ctx.tokens[i].text);
+    }
+    return pos_terms;
+}
+
+std::string BooleanSearch::canonical_node(const QueryContext& ctx, size_t n) const {
+    const QNode& node = ctx.nodes[n];
+    if (node.kind == NodeKind::TERM) return "\"" + node.term + "\"";
+    if (node.kind == NodeKind::NOT) return "!" + canonical_node(ctx, node.children[0]);
+
+    std::vector<std::string> parts;
+    for (size_t i = 0; i < node.children.size(); ++i) {
+        std::string part = canonical_node(ctx, node.children[i]);
+        size_t j = parts.size();
+        parts.push_back(std::string());
+        while (j > 0 && parts[j - 1] > part) {
+            parts[j].swap(parts[j - 1]);
+            --j;
+        }
+        parts[j].swap(part);
+    }
+    std::string out = node.kind == NodeKind::AND ? "&(" : "|(";
+    for (size_t i = 0; i < parts.size(); ++i) {
+        if (i > 0) out += ',';
+        out += parts[i];
+    }
+    out += ')';
+    return out;
+}
+
+std::string BooleanSearch::canonical_key(const QueryContext& ctx, size_t root, Ranking ranking) const {
+    if (root == SIZE_MAX) return "";
+
+    // Scores are sums over the scored terms, so their order only matters
+    // to floating point rounding; sorting them lets "a b" share "b a".
+    std::string key = canonical_node(ctx, root);
+    std::vector<std::string> pos_terms = scored_terms(ctx);
+    for (size_t i = 1; i < pos_terms.size(); ++i)
+        for (size_t j = i; j > 0 && pos_terms[j - 1] > pos_terms[j]; --j)
+            pos_terms[j].swap(pos_terms[j - 1]);
+    key += '#';
+    for (size_t i = 0; i < pos_terms.size(); ++i) {
+        key += pos_terms[i];
+        key += ' ';
     }
+    key += ranking == Ranking::BM25 ? "#bm25" : "#tfidf";
+    // Doc ids are only meaningful within one segment set.
+    key += '#';
+    key += std::to_string(segments_.generation);
+    return key;
+}
+
+std::string BooleanSearch::canonical_query(const std::string& query, Ranking ranking) const {
+    QueryContext ctx;
+    size_t root = prepare(ctx, query);
+    return canonical_key(ctx, root, ranking);
+}
+
+BooleanSearch::PreparedQuery BooleanSearch::prepare_query(const std::string& query, Ranking ranking) const {
+    PreparedQuery prepared;
+    prepared.root = prepare(prepared.ctx, query);
+    prepared.ranking = ranking;
+    prepared.key = canonical_key(prepared.ctx, prepared.root, ranking);
+    return prepared;
+}
+
+std::vector<SearchResult> BooleanSearch::search(const std::string& query, size_t max_results,
+                                                size_t* total_hits, Ranking ranking) const {
+    std::vector<ScoredDoc> docs = rank(query, max_results, total_hits, ranking);
+    std::vector<SearchResult> results(docs.size());
+    for (size_t i = 0; i < docs.size(); ++i)
+        results[i] = SearchResult(segments_.get_doc_id(docs[i].doc_id), docs[i].score);
+    return results;
+}
+
+std::vector<ScoredDoc> BooleanSearch::rank(const std::string& query, size_t max_results,
+                                           size_t* total_hits, Ranking ranking) const {
+    QueryContext ctx;
+    size_t root = prepare(ctx, query);
+    return rank_planned(ctx, root, max_results, total_hits, ranking);
+}
+
+std::vector<ScoredDoc> BooleanSearch::rank(const PreparedQuery& query, size_t max_results,
+                                           size_t* total_hits) const {
+    return rank_planned(query.ctx, query.root, max_results, total_hits, query.ranking);
+}
 
-    size_t N = index_.document_count();
+std::vector<ScoredDoc> BooleanSearch::rank_planned(const QueryContext& ctx, size_t root, size_t max_results,
+                                                   size_t* total_hits, Ranking ranking) const {
+    if (total_hits) *total_hits = 0;
+    if (root == SIZE_MAX) return {};
 
+    // Matches per segment in local doc ids; deleted documents never match.
+    const std::vector<Segment>& segments = segments_.segments;
+    std::vector<std::vector<uint32_t>> result_docs(segments.size());
+    size_t hits = 0;
+    for (size_t s = 0; s < segments.size(); ++s) {
+        const Segment& seg = segments[s];
+        DocSet docs = evaluate(ctx, root, seg);
+        if (seg.deleted) {
+            DocSet live = DocSet::borrow_bitmap(seg.deleted->data(), seg.deleted->size());
+            live.negate();
+            docs = DocSet::intersect(docs, live, seg.document_count());
+        }
+        docs.to_ids(result_docs[s], seg.document_count());
+        hits += result_docs[s].size();
+    }
+    std::vector<std::string> pos_terms = scored_terms(ctx);
+
+    size_t N = ctx.universe;
+
+    if (total_hits) *total_hits = hits;
+    if (max_results == 0) return {};
+
+    // Result docs come out of evaluation sorted, so every scored term is
+    // read through a forward-only cursor: each posting is decoded at most
+    // once per query.
+    //
+    // BM25 divides tf by tf + k1 * (1 - b + b * len / avgdl); the document
+    // part of that is norm_base + norm_scale * len, read from the segment's
+    // length column once per document.
+    //
+    // idf and avgdl use document counts and frequencies summed over all
+    // segments, deleted documents included until a merge drops them, so
+    // a single segment scores exactly like the index it holds.
+    bool bm25 = ranking == Ranking::BM25;
+    double avgdl = N > 0 ? static_cast<double>(segments_.total_terms()) / N : 0.0;
+    double norm_base = BM25_K1 * (1.0 - BM25_B);
+    double norm_scale = avgdl > 0 ? BM25_K1 * BM25_B / avgdl : 0.0;
+
+    std::vector<std::string> terms;
     std::vector<double> idfs;
-    idfs.reserve(pos_terms.size());
+    std::vector<double> bounds;
     for (size_t i = 0; i < pos_terms.size(); ++i) {
-        const PostingList* pl = index_.get_posting_list(pos_terms[i]);
-        double df = pl ? static_cast<double>(pl->postings.size()) : 0.0;
-        idfs.push_back((df > 0 && N > 0) ? std::log10(static_cast<double>(N) / df) : 0.0);
+        size_t df_count = 0;
+        uint32_t max_frequency = 0;
+        for (size_t s = 0; s < segments.size(); ++s) {
+            PostingView pl = segments[s].index->find_postings(pos_terms[i]);
+            df_count += pl.size();
+            if (pl.max_frequency() > max_frequency) max_frequency = pl.max_frequency();
+        }
+        if (df_count == 0) continue;
+        double max_tf = max_frequency;
+        double df = static_cast<double>(df_count);
+        double idf, bound;
+        if (bm25) {
+            idf = std::log(1.0 + (N - df + 0.5) / (df + 0.5)) * (BM25_K1 + 1.0);
+            bound = idf * max_tf / (max_tf + norm_base);
+        } else {
+            idf = (df > 0 && N > 0) ? std::log10(static_cast<double>(N) / df) : 0.0;
+            bound = max_tf * idf;
+        }
+        terms.push_back(pos_terms[i]);
+        idfs.push_back(idf);
+        bounds.push_back(bound);
+    }
+
+    // MaxScore: terms are probed in decreasing order of their score upper
+    // bound, and once the heap is full a document is dropped as soon as
+    // its partial score plus the bounds of the unprobed terms cannot beat
+    // the current k-th score. Later documents lose ties, so reaching the
+    // threshold is not enough to enter.
+    size_t nterms = terms.size();
+    std::vector<size_t> order(nterms);
+    for (size_t i = 0; i < nterms; ++i) {
+        size_t j = i;
+        while (j > 0 && bounds[order[j - 1]] < bounds[i]) {
+            order[j] = order[j - 1];
+            --j;
+        }
+        order[j] = i;
     }
+    std::vector<double> rest(nterms + 1, 0.0);
+    for (size_t k = nterms; k > 0; --k)
+        rest[k - 1] = rest[k] + bounds[order[k - 1]];
 
-    std::vector<SearchResult> results;
-    results.reserve(result_docs.size());
-
-    for (size_t i = 0; i < result_docs.size(); ++i) {
-        size_t doc_id = result_docs[i];
-        double score = 0.0;
-        for (size_t j = 0; j < pos_terms.size(); ++j) {
-            const PostingList* pl = index_.get_posting_list(pos_terms[j]);
-            if (!pl) continue;
-            for (size_t k = 0; k < pl->postings.size(); ++k) {
-                if (pl->postings[k].doc_id == doc_id) {
-                    score += static_cast<double>(pl->postings[k].frequency) * idfs[j];
+    std::vector<ScoredDoc> heap;
+    heap.reserve(max_results < hits ? max_results : hits);
+    std::vector<double> contrib(nterms);
+    std::vector<PostingCursor> cursors;
+    cursors.reserve(nterms);
+    bool done = false;
+
+    // Segments are visited in doc id order, so one heap ranks them all.
+    for (size_t s = 0; s < segments.size() && !done; ++s) {
+        const Segment& seg = segments[s];
+        const std::vector<uint32_t>& docs = result_docs[s];
+        if (docs.empty()) continue;
+        const std::vector<uint32_t>& lengths = seg.index->doc_lengths();
+        cursors.clear();
+        for (size_t j = 0; j < nterms; ++j)
+            cursors.push_back(PostingCursor(seg.index->find_postings(terms[j])));
+
+        for (size_t i = 0; i < docs.size(); ++i) {
+            uint32_t local = docs[i];
+            bool full = heap.size() == max_results;
+            double threshold = full ? heap[0].score : 0.0;
+            double slack = threshold * 1e-9;
+            if (full && rest[0] + slack <= threshold) {
+                done = true;
+                break;
+            }
+
+            double norm = 0.0;
+            if (bm25) norm = norm_base + norm_scale * (local < lengths.size() ? lengths[local] : 0);
+
+            double partial = 0.0;
+            bool pruned = false;
+            for (size_t k = 0; k < nterms; ++k) {
+                size_t j = order[k];
+                PostingCursor& c = cursors[j];
+                c.advance_to(local);
+                contrib[j] = 0.0;
+                if (c.valid() && c.doc() == local) {
+                    double tf = static_cast<double>(c.frequency());
+                    contrib[j] = bm25 ? idfs[j] * tf / (tf + norm) : tf * idfs[j];
+                }
+                partial += contrib[j];
+                if (full && partial + rest[k + 1] + slack <= threshold) {
+                    pruned = true;
                     break;
                 }
             }
+            if (pruned) continue;
+
+            // Summed in query order so scores match the exhaustive evaluation
+            // bit for bit.
+            ScoredDoc cand;
+            cand.score = 0.0;
+            cand.doc_id = static_cast<uint32_t>(seg.doc_base + local);
+            for (size_t j = 0; j < nterms; ++j)
+                cand.score += contrib[j];
+
+            if (!full) {
+                heap.push_back(cand);
+                heap_sift_up(heap, heap.size() - 1);
+            } else if (worse(heap[0], cand)) {
+                heap[0] = cand;
+                heap_sift_down(heap, 0, heap.size());
+            }
         }
-        results.push_back(SearchResult(index_.get_doc_id(doc_id), score));
     }
 
-    if (results.size() > 1) {
-        std::vector<SearchResult> tmp(results.size());
-        msort_sr(results, tmp, 0, results.size());
+    std::vector<ScoredDoc> ranked(heap.size());
+    for (size_t n = heap.size(); n > 0; --n) {
+        ranked[n - 1] = heap[0];
+        heap[0] = heap[n - 1];
+        heap_sift_down(heap, 0, n - 1);
     }
-
-    if (results.size() > max_results)
-        results.resize(max_results);
-
-    return results;
+    return ranked;
 }
@@ -1,52 +1,124 @@
 #ifndef BOOLEAN_SEARCH_H
 #define BOOLEAN_SEARCH_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include "inverted_index.h"
+#include "segmented_index.h"
+#include "doc_set.h"
 #include "tokenizer.h"
 #include "stemmer.h"
+#include "stem_cache.h"
 
 struct SearchResult {
     std::string doc_id;
     double score;
     
     SearchResult() : score(0.0) {}
-    SearchResult(const std::string& d, double s) : doc_id(d), score(s) {}
+    SearchResult(std::string_view d, double s) : doc_id(d), score(s) {}
 };
 
+struct ScoredDoc {
+    double score;
+    uint32_t doc_id;
+};
+
+enum class Ranking { TFIDF, BM25 };
+
 class BooleanSearch {
 private:
-    const InvertedIndex& index_;
-    Tokenizer tokenizer_;
-    PorterStemmer stemmer_;
+    const SegmentSet& segments_;
+    const StemCache* stems_;
     
-    std::vector<size_t> intersect(const std::vector<size_t>& a, const std::vector<size_t>& b);
-    std::vector<size_t> unite(const std::vector<size_t>& a, const std::vector<size_t>& b);
-    std::vector<size_t> subtract(const std::vector<size_t>& a, const std::vector<size_t>& b);
-    std::vector<size_t> all_doc_ids();
-
     enum class TokType { WORD, AND_OP, OR_OP, NOT_OP, LPAREN, RPAREN, END };
     struct QToken {
         TokType type;
         std::string text;
     };
 
-    std::vector<QToken> lex(const std::string& query);
+    // Query AST. Nodes live in QueryContext::nodes and refer to their
+    // children by index; cost is the estimated number of matching documents.
+    enum class NodeKind { TERM, AND, OR, NOT };
+    struct QNode {
+        NodeKind kind;
+        std::string term;
+        std::vector<size_t> children;
+        size_t cost;
+    };
+
+    // Everything a single query mutates. search() keeps one on its own
+    // stack, so concurrent calls on a shared BooleanSearch are safe; the
+    // segment set itself is immutable.
+    struct QueryContext {
+        Tokenizer tokenizer;
+        PorterStemmer stemmer;
+        std::vector<QToken> tokens;
+        size_t pos;
+        size_t universe;
+        std::vector<QNode> nodes;
 
-    std::vector<QToken> qtokens_;
-    size_t qpos_;
+        QueryContext() : pos(0), universe(0) {}
+    };
+
+    std::vector<QToken> lex(QueryContext& ctx, const std::string& query) const;
+    size_t prepare(QueryContext& ctx, const std::string& query) const;
+    std::vector<std::string> scored_terms(const QueryContext& ctx) const;
+    std::string canonical_node(const QueryContext& ctx, size_t node) const;
+    std::string canonical_key(const QueryContext& ctx, size_t root, Ranking ranking) const;
+    std::vector<ScoredDoc> rank_planned(const QueryContext& ctx, size_t root, size_t max_results,
+                                        size_t* total_hits, Ranking ranking) const;
 
-    std::vector<size_t> parse_or_expr();
-    std::vector<size_t> parse_and_expr();
-    std::vector<size_t> parse_unary();
-    std::vector<size_t> parse_primary();
-    std::vector<size_t> term_docs(const std::string& stemmed);
+    size_t add_node(QueryContext& ctx, NodeKind kind) const;
+    size_t parse_or_expr(QueryContext& ctx) const;
+    size_t parse_and_expr(QueryContext& ctx) const;
+    size_t parse_unary(QueryContext& ctx) const;
+    size_t parse_primary(QueryContext& ctx) const;
+
+    void plan(QueryContext& ctx, size_t node) const;
+    DocSet evaluate(const QueryContext& ctx, size_t node, const Segment& seg) const;
+    DocSet term_docs(const PostingView& pl) const;
+    size_t document_frequency(const std::string& term) const;
 
 public:
-    BooleanSearch(const InvertedIndex& index);
+    // A query lexed, parsed and planned once. key is what canonical_query()
+    // returns for it; rank() runs the stored plan without parsing the query
+    // again. Only the BooleanSearch that prepared it may rank it.
+    class PreparedQuery {
+    public:
+        std::string key;
+
+    private:
+        friend class BooleanSearch;
+        QueryContext ctx;
+        size_t root = SIZE_MAX;
+        Ranking ranking = Ranking::TFIDF;
+    };
+
+    // Queries see exactly the given segments, with collection statistics
+    // summed over them. stems, if given, is consulted before running the
+    // stemmer and must not change while queries run.
+    BooleanSearch(const SegmentSet& segments, const StemCache* stems = nullptr);
     
-    std::vector<SearchResult> search(const std::string& query, size_t max_results = 100);
+    // Returns the max_results best matches; total_hits, if given, receives
+    // the number of documents matching the query.
+    std::vector<SearchResult> search(const std::string& query, size_t max_results = 100,
+                                     size_t* total_hits = nullptr,
+                                     Ranking ranking = Ranking::TFIDF) const;
+    // Same ranking as search(), as global doc ids best first.
+    std::vector<ScoredDoc> rank(const std::string& query, size_t max_results,
+                                size_t* total_hits, Ranking ranking) const;
+    // Key under which two queries are known to produce the same ranking:
+    // the planned AST with commutative operands sorted, the scored terms,
+    // the ranking function and the segment set's generation. Empty for a
+    // query without any terms.
+    std::string canonical_query(const std::string& query, Ranking ranking) const;
+
+    // One parse for both of the above, for callers that look up a cache
+    // by key before ranking.
+    PreparedQuery prepare_query(const std::string& query, Ranking ranking) const;
+    std::vector<ScoredDoc> rank(const PreparedQuery& query, size_t max_results,
+                                size_t* total_hits) const;
 };
 
 #endif
@@ -0,0 +1,73 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <cstddef>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <utility>
+
+template<typename T>
+class BoundedQueue {
+private:
+    std::vector<T> slots_;
+    size_t head_;
+    size_t count_;
+    bool closed_;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+
+public:
+    explicit BoundedQueue(size_t capacity)
+        : slots_(capacity > 0 ? capacity : 1), head_(0), count_(0), closed_(false) {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return count_ < slots_.size() || closed_; });
+        if (closed_) return false;
+        slots_[(head_ + count_) % slots_.size()] = std::move(item);
+        ++count_;
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // Never waits: false if the queue is full or closed, and item is left
+    // untouched.
+    bool try_push(T& item) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closed_ || count_ == slots_.size()) return false;
+        slots_[(head_ + count_) % slots_.size()] = std::move(item);
+        ++count_;
+        not_empty_.notify_one();
+        return true;
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return count_ > 0 || closed_; });
+        if (count_ == 0) return false;
+        item = std::move(slots_[head_]);
+        head_ = (head_ + 1) % slots_.size();
+        --count_;
+        not_full_.notify_one();
+        return true;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return count_;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+};
+
+#endif
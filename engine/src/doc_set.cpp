@@ -0,0 +1,174 @@
+#include "doc_set.h"
+#include "set_ops.h"
+
+DocSet::DocSet() : borrowed_(nullptr), borrowed_size_(0), is_bitmap_(false), negated_(false) {}
+
+DocSet DocSet::from_ids(std::vector<uint32_t>&& ids) {
+    DocSet s;
+    s.ids_.swap(ids);
+    return s;
+}
+
+DocSet DocSet::borrow_bitmap(const uint64_t* words, size_t word_count) {
+    DocSet s;
+    s.borrowed_ = words;
+    s.borrowed_size_ = word_count;
+    s.is_bitmap_ = true;
+    return s;
+}
+
+bool DocSet::empty() const {
+    if (!is_bitmap_) return ids_.empty();
+    const uint64_t* w = bits();
+    for (size_t i = 0; i < word_count(); ++i)
+        if (w[i]) return false;
+    return true;
+}
+
+size_t DocSet::count() const {
+    if (!is_bitmap_) return ids_.size();
+    size_t n = 0;
+    const uint64_t* w = bits();
+    for (size_t i = 0; i < word_count(); ++i)
+        n += __builtin_popcountll(w[i]);
+    return n;
+}
+
+void DocSet::to_bitmap(size_t universe) {
+    if (is_bitmap_) return;
+    size_t words = (universe + 63) / 64;
+    if (!ids_.empty() && ids_.back() >= universe) words = ids_.back() / 64 + 1;
+    words_.assign(words, 0);
+    for (size_t i = 0; i < ids_.size(); ++i)
+        words_[ids_[i] >> 6] |= uint64_t(1) << (ids_[i] & 63);
+    std::vector<uint32_t>().swap(ids_);
+    is_bitmap_ = true;
+}
+
+void DocSet::maybe_to_bitmap(size_t universe) {
+    if (!is_bitmap_ && ids_.size() * BITMAP_DENSITY > universe)
+        to_bitmap(universe);
+}
+
+DocSet DocSet::and_positive(const DocSet& a, const DocSet& b) {
+    DocSet r;
+    if (!a.is_bitmap_ && !b.is_bitmap_) {
+        intersect_into(a.ids_.data(), a.ids_.size(), b.ids_.data(), b.ids_.size(), r.ids_);
+    } else if (!a.is_bitmap_ || !b.is_bitmap_) {
+        const DocSet& arr = a.is_bitmap_ ? b : a;
+        const DocSet& bmp = a.is_bitmap_ ? a : b;
+        r.ids_.reserve(arr.ids_.size());
+        for (size_t i = 0; i < arr.ids_.size(); ++i)
+            if (bmp.test(arr.ids_[i])) r.ids_.push_back(arr.ids_[i]);
+    } else {
+        size_t n = a.word_count() < b.word_count() ? a.word_count() : b.word_count();
+        const uint64_t* wa = a.bits();
+        const uint64_t* wb = b.bits();
+        r.words_.resize(n);
+        for (size_t i = 0; i < n; ++i)
+            r.words_[i] = wa[i] & wb[i];
+        r.is_bitmap_ = true;
+    }
+    return r;
+}
+
+DocSet DocSet::or_positive(const DocSet& a, const DocSet& b, size_t universe) {
+    DocSet r;
+    if (!a.is_bitmap_ && !b.is_bitmap_) {
+        unite_into(a.ids_.data(), a.ids_.size(), b.ids_.data(), b.ids_.size(), r.ids_);
+        r.maybe_to_bitmap(universe);
+    } else if (!a.is_bitmap_ || !b.is_bitmap_) {
+        const DocSet& arr = a.is_bitmap_ ? b : a;
+        const DocSet& bmp = a.is_bitmap_ ? a : b;
+        size_t n = bmp.word_count();
+        if (!arr.ids_.empty() && arr.ids_.back() / 64 + 1 > n) n = arr.ids_.back() / 64 + 1;
+        r.words_.assign(bmp.bits(), bmp.bits() + bmp.word_count());
+        r.words_.resize(n, 0);
+        for (size_t i = 0; i < arr.ids_.size(); ++i)
+            r.words_[arr.ids_[i] >> 6] |= uint64_t(1) << (arr.ids_[i] & 63);
+        r.is_bitmap_ = true;
+    } else {
+        const DocSet& longer = a.word_count() >= b.word_count() ? a : b;
+        const DocSet& shorter = a.word_count() >= b.word_count() ? b : a;
+        r.words_.assign(longer.bits(), longer.bits() + longer.word_count());
+        const uint64_t* ws = shorter.bits();
+        for (size_t i = 0; i < shorter.word_count(); ++i)
+            r.words_[i] |= ws[i];
+        r.is_bitmap_ = true;
+    }
+    return r;
+}
+
+DocSet DocSet::andnot_positive(const DocSet& a, const DocSet& b) {
+    DocSet r;
+    if (!a.is_bitmap_ && !b.is_bitmap_) {
+        subtract_into(a.ids_.data(), a.ids_.size(), b.ids_.data(), b.ids_.size(), r.ids_);
+    } else if (!a.is_bitmap_) {
+        r.ids_.reserve(a.ids_.size());
+        for (size_t i = 0; i < a.ids_.size(); ++i)
+            if (!b.test(a.ids_[i])) r.ids_.push_back(a.ids_[i]);
+    } else {
+        r.words_.assign(a.bits(), a.bits() + a.word_count());
+        r.is_bitmap_ = true;
+        if (!b.is_bitmap_) {
+            for (size_t i = 0; i < b.ids_.size(); ++i) {
+                size_t w = b.ids_[i] >> 6;
+                if (w < r.words_.size()) r.words_[w] &= ~(uint64_t(1) << (b.ids_[i] & 63));
+            }
+        } else {
+            size_t n = r.words_.size() < b.word_count() ? r.words_.size() : b.word_count();
+            const uint64_t* wb = b.bits();
+            for (size_t i = 0; i < n; ++i)
+                r.words_[i] &= ~wb[i];
+        }
+    }
+    return r;
+}
+
+DocSet DocSet::intersect(const DocSet& a, const DocSet& b, size_t universe) {
+    if (!a.negated_ && !b.negated_) return and_positive(a, b);
+    if (!a.negated_) return andnot_positive(a, b);
+    if (!b.negated_) return andnot_positive(b, a);
+    DocSet r = or_positive(a, b, universe);
+    r.negated_ = true;
+    return r;
+}
+
+DocSet DocSet::unite(const DocSet& a, const DocSet& b, size_t universe) {
+    if (!a.negated_ && !b.negated_) return or_positive(a, b, universe);
+    DocSet r;
+    if (a.negated_ && b.negated_) r = and_positive(a, b);
+    else if (a.negated_) r = andnot_positive(a, b);
+    else r = andnot_positive(b, a);
+    r.negated_ = true;
+    return r;
+}
+
+void DocSet::to_ids(std::vector<uint32_t>& out, size_t universe) const {
+    out.clear();
+    if (!is_bitmap_ && !negated_) {
+        out = ids_;
+        return;
+    }
+    if (!is_bitmap_) {
+        out.reserve(universe > ids_.size() ? universe - ids_.size() : 0);
+        size_t j = 0;
+        for (size_t id = 0; id < universe; ++id) {
+            if (j < ids_.size() && ids_[j] == id) { ++j; continue; }
+            out.push_back(id);
+        }
+        return;
+    }
+    const uint64_t* w = bits();
+    size_t n = (universe + 63) / 64;
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t word = i < word_count() ? w[i] : 0;
+        if (negated_) word = ~word;
+        while (word) {
+            size_t id = i * 64 + __builtin_ctzll(word);
+            if (id >= universe) break;
+            out.push_back(id);
+            word &= word - 1;
+        }
+    }
+}
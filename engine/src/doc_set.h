@@ -0,0 +1,57 @@
+#ifndef DOC_SET_H
+#define DOC_SET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Intermediate result of a boolean query: either a sorted doc id array or
+// a bitmap over the doc id space, possibly negated. NOT only flips the
+// flag, and AND/OR/ANDNOT pick a kernel per representation, so a
+// complement is materialized only if it survives to the final result.
+// A bitmap can borrow its words from the index (dense posting lists).
+class DocSet {
+private:
+    std::vector<uint32_t> ids_;
+    std::vector<uint64_t> words_;
+    const uint64_t* borrowed_;
+    size_t borrowed_size_;
+    bool is_bitmap_;
+    bool negated_;
+
+    const uint64_t* bits() const { return borrowed_ ? borrowed_ : words_.data(); }
+    size_t word_count() const { return borrowed_ ? borrowed_size_ : words_.size(); }
+    bool test(uint32_t id) const {
+        size_t w = id >> 6;
+        return w < word_count() && (bits()[w] >> (id & 63)) & 1;
+    }
+
+    void to_bitmap(size_t universe);
+    void maybe_to_bitmap(size_t universe);
+
+    static DocSet and_positive(const DocSet& a, const DocSet& b);
+    static DocSet or_positive(const DocSet& a, const DocSet& b, size_t universe);
+    static DocSet andnot_positive(const DocSet& a, const DocSet& b);
+
+public:
+    // Arrays denser than 1/BITMAP_DENSITY of the corpus switch to bitmaps.
+    static const size_t BITMAP_DENSITY = 32;
+
+    DocSet();
+    static DocSet from_ids(std::vector<uint32_t>&& ids);
+    static DocSet borrow_bitmap(const uint64_t* words, size_t word_count);
+
+    bool negated() const { return negated_; }
+    bool is_bitmap() const { return is_bitmap_; }
+    bool empty() const;
+    size_t count() const;
+
+    void negate() { negated_ = !negated_; }
+
+    static DocSet intersect(const DocSet& a, const DocSet& b, size_t universe);
+    static DocSet unite(const DocSet& a, const DocSet& b, size_t universe);
+
+    void to_ids(std::vector<uint32_t>& out, size_t universe) const;
+};
+
+#endif
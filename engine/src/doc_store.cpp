@@ -0,0 +1,282 @@
+#include "doc_store.h"
+#include "text_codec.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+DocumentStore::DocumentStore(size_t cache_blocks)
+    : base_offsets_(nullptr), base_count_(0), base_blocks_(nullptr), base_block_count_(0),
+      base_data_(nullptr), base_data_size_(0), fd_(-1), end_(0), offsets_(1, 0), open_begin_(0),
+      spool_failed_(false), cache_blocks_(cache_blocks ? cache_blocks : 1), tick_(0) {}
+
+DocumentStore::~DocumentStore() {
+    if (fd_ >= 0) ::close(fd_);
+}
+
+bool DocumentStore::open(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) return false;
+    // The spool only lives as long as the process.
+    ::unlink(path.c_str());
+    end_ = 0;
+    offsets_.assign(1, 0);
+    blocks_.clear();
+    open_.clear();
+    open_begin_ = 0;
+    spool_failed_ = false;
+    cache_.clear();
+    return true;
+}
+
+void DocumentStore::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ >= 0 && ::ftruncate(fd_, 0) != 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    end_ = 0;
+    offsets_.assign(1, 0);
+    blocks_.clear();
+    open_.clear();
+    open_begin_ = 0;
+    spool_failed_ = false;
+    base_offsets_ = nullptr;
+    base_count_ = 0;
+    base_blocks_ = nullptr;
+    base_block_count_ = 0;
+    base_data_ = nullptr;
+    base_data_size_ = 0;
+    cache_.clear();
+}
+
+void DocumentStore::seal() {
+    if (open_.empty()) return;
+    std::string packed(text_compress_bound(open_.size()), '\0');
+    size_t n = text_compress(open_.data(), open_.size(), &packed[0]);
+    size_t written = 0;
+    while (fd_ >= 0 && written < n) {
+        ssize_t w = ::pwrite(fd_, packed.data() + written, n - written, end_ + written);
+        if (w <= 0) break;
+        written += w;
+    }
+    // The block is still recorded, so later texts keep their offsets.
+    if (written < n) spool_failed_ = true;
+    Block block;
+    block.text_begin = open_begin_;
+    block.data_offset = end_;
+    block.data_size = static_cast<uint32_t>(n);
+    block.raw_size = static_cast<uint32_t>(open_.size());
+    blocks_.push_back(block);
+    end_ += n;
+    open_begin_ += open_.size();
+    open_.clear();
+}
+
+size_t DocumentStore::append(const std::string& text) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!open_.empty() && open_.size() + text.size() > BLOCK_SIZE) seal();
+    open_ += text;
+    offsets_.push_back(offsets_.back() + text.size());
+    return base_count_ + offsets_.size() - 2;
+}
+
+std::shared_ptr<const std::string> DocumentStore::load_block(size_t id, const Block& block) const {
+    std::string packed;
+    const char* data;
+    if (id < base_block_count_) {
+        if (block.data_offset > base_data_size_ || block.data_size > base_data_size_ - block.data_offset)
+            return nullptr;
+        data = base_data_ + block.data_offset;
+    } else {
+        packed.resize(block.data_size);
+        size_t done = 0;
+        while (done < packed.size()) {
+            ssize_t n = ::pread(fd_, &packed[done], packed.size() - done, block.data_offset + done);
+            if (n <= 0) return nullptr;
+            done += n;
+        }
+        data = packed.data();
+    }
+    std::shared_ptr<std::string> text(new std::string(block.raw_size, '\0'));
+    if (!text_decompress(data, block.data_size, &(*text)[0], block.raw_size)) return nullptr;
+    return text;
+}
+
+std::string DocumentStore::get(size_t index) const {
+    uint64_t begin, end;
+    Block block;
+    size_t id;
+    std::shared_ptr<const std::string> text;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const Block* blocks;
+        size_t count;
+        if (index < base_count_) {
+            begin = base_offsets_[index];
+            end = base_offsets_[index + 1];
+            blocks = base_blocks_;
+            count = base_block_count_;
+            id = 0;
+        } else {
+            size_t local = index - base_count_;
+            if (local + 1 >= offsets_.size()) return "";
+            begin = offsets_[local];
+            end = offsets_[local + 1];
+            if (begin >= open_begin_) return open_.substr(begin - open_begin_, end - begin);
+            blocks = blocks_.data();
+            count = blocks_.size();
+            id = base_block_count_;
+        }
+        if (begin == end || count == 0) return "";
+        // Last block starting at or before the text.
+        size_t lo = 1, hi = count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (blocks[mid].text_begin <= begin) lo = mid + 1;
+            else hi = mid;
+        }
+        block = blocks[lo - 1];
+        id += lo - 1;
+        for (size_t i = 0; i < cache_.size(); ++i) {
+            if (cache_[i].id == id) {
+                cache_[i].last_use = ++tick_;
+                text = cache_[i].text;
+                break;
+            }
+        }
+    }
+
+    // Decompressed outside the lock; two readers missing on the same
+    // block both decode it and the second insert is dropped.
+    if (!text) {
+        text = load_block(id, block);
+        if (!text) return "";
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t victim = cache_.size();
+        bool present = false;
+        for (size_t i = 0; i < cache_.size(); ++i) {
+            if (cache_[i].id == id) present = true;
+            if (victim == cache_.size() || cache_[i].last_use < cache_[victim].last_use) victim = i;
+        }
+        if (!present) {
+            CachedBlock entry;
+            entry.id = id;
+            entry.last_use = ++tick_;
+            entry.text = text;
+            if (cache_.size() < cache_blocks_) cache_.push_back(entry);
+            else cache_[victim] = entry;
+        }
+    }
+
+    uint64_t from = begin - block.text_begin;
+    if (from > text->size() || end - begin > text->size() - from) return "";
+    return text->substr(from, end - begin);
+}
+
+size_t DocumentStore::text_size(size_t index) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index < base_count_) return base_offsets_[index + 1] - base_offsets_[index];
+    index -= base_count_;
+    if (index + 1 >= offsets_.size()) return 0;
+    return offsets_[index + 1] - offsets_[index];
+}
+
+size_t DocumentStore::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return base_count_ + offsets_.size() - 1;
+}
+
+bool DocumentStore::good() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !spool_failed_;
+}
+
+bool DocumentStore::write_image(ImageWriter& out, size_t count) const {
+    // The appended part is copied under the lock and the spool is read
+    // after releasing it, so get() and append() are not held up for the
+    // length of a dump. Sealed spool data never changes, and the base
+    // image is only replaced by attach_image() and clear(), which must not
+    // run concurrently with a dump.
+    std::vector<uint64_t> offsets;
+    std::vector<Block> blocks;
+    std::string open;
+    uint64_t open_begin, end;
+    int fd;
+    bool spool_failed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        offsets = offsets_;
+        blocks = blocks_;
+        open = open_;
+        open_begin = open_begin_;
+        end = end_;
+        fd = fd_;
+        spool_failed = spool_failed_;
+    }
+    if (spool_failed || count < base_count_ || count - base_count_ + 1 > offsets.size()) return false;
+    offsets.resize(count - base_count_ + 1);
+    uint64_t base_text = base_count_ > 0 ? base_offsets_[base_count_] : 0;
+
+    out.begin("TXTOFFS0");
+    for (size_t i = 0; i < base_count_; ++i)
+        out.write_u64(base_offsets_[i]);
+    for (size_t i = 0; i < offsets.size(); ++i)
+        out.write_u64(base_text + offsets[i]);
+
+    std::string packed;
+    Block open_block = Block();
+    if (!open.empty()) {
+        packed.resize(text_compress_bound(open.size()));
+        packed.resize(text_compress(open.data(), open.size(), &packed[0]));
+        open_block.text_begin = base_text + open_begin;
+        open_block.data_offset = base_data_size_ + end;
+        open_block.data_size = static_cast<uint32_t>(packed.size());
+        open_block.raw_size = static_cast<uint32_t>(open.size());
+    }
+
+    out.begin("TXTBLOCK");
+    if (base_block_count_ > 0) out.write(base_blocks_, base_block_count_ * sizeof(Block));
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        Block b = blocks[i];
+        b.text_begin += base_text;
+        b.data_offset += base_data_size_;
+        out.write(&b, sizeof(b));
+    }
+    if (!open.empty()) out.write(&open_block, sizeof(open_block));
+
+    out.begin("TXTDATA0");
+    if (base_data_size_ > 0) out.write(base_data_, base_data_size_);
+    std::string chunk(1 << 20, '\0');
+    for (uint64_t pos = 0; pos < end; ) {
+        size_t want = end - pos < chunk.size() ? end - pos : chunk.size();
+        ssize_t n = fd >= 0 ? ::pread(fd, &chunk[0], want, pos) : -1;
+        if (n <= 0) return false;
+        out.write(chunk.data(), n);
+        pos += n;
+    }
+    out.write(packed.data(), packed.size());
+    return true;
+}
+
+bool DocumentStore::attach_image(const MappedImage& image) {
+    clear();
+    size_t offset_count = 0, block_count = 0, data_size = 0;
+    const uint64_t* offsets = image.array<uint64_t>("TXTOFFS0", offset_count);
+    const Block* blocks = image.array<Block>("TXTBLOCK", block_count);
+    const char* data = image.section("TXTDATA0", data_size);
+    if (!offsets || offset_count == 0 || !blocks || !data) return false;
+    if (block_count > 0) {
+        const Block& last = blocks[block_count - 1];
+        if (last.data_offset > data_size || last.data_size > data_size - last.data_offset) return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    base_offsets_ = offsets;
+    base_count_ = offset_count - 1;
+    base_blocks_ = blocks;
+    base_block_count_ = block_count;
+    base_data_ = data;
+    base_data_size_ = data_size;
+    return true;
+}
@@ -0,0 +1,94 @@
+#ifndef DOC_STORE_H
+#define DOC_STORE_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "index_image.h"
+
+// Document texts by record index, LZ4-compressed in blocks of about
+// BLOCK_SIZE bytes; a text never spans two blocks. Appended texts collect
+// in an open block in memory and sealed blocks go to a spool file that is
+// read back with pread. An attached image supplies the first records from
+// its mapping, and appends continue after them.
+//
+// get() decompresses a text's whole block into a small LRU cache, so
+// resident memory depends on the cache size rather than on the corpus,
+// and neighbouring documents come for free. Safe to call from several
+// threads, also while another one appends.
+class DocumentStore {
+public:
+    static const size_t BLOCK_SIZE = 65536;
+
+private:
+    // text_begin is the block's first byte in the store's text stream,
+    // data_offset its position in the spool or the image's data section.
+    struct Block {
+        uint64_t text_begin;
+        uint64_t data_offset;
+        uint32_t data_size;
+        uint32_t raw_size;
+    };
+
+    struct CachedBlock {
+        size_t id;
+        uint64_t last_use;
+        std::shared_ptr<const std::string> text;
+    };
+
+    // Attached image.
+    const uint64_t* base_offsets_;
+    size_t base_count_;
+    const Block* base_blocks_;
+    size_t base_block_count_;
+    const char* base_data_;
+    size_t base_data_size_;
+
+    // Spool: texts appended in this process, offsets relative to them.
+    int fd_;
+    uint64_t end_;
+    std::vector<uint64_t> offsets_;
+    std::vector<Block> blocks_;
+    std::string open_;
+    uint64_t open_begin_;
+    // Set when a sealed block could not be written to the spool.
+    bool spool_failed_;
+
+    size_t cache_blocks_;
+    mutable std::vector<CachedBlock> cache_;
+    mutable uint64_t tick_;
+    mutable std::mutex mutex_;
+
+    void seal();
+    std::shared_ptr<const std::string> load_block(size_t id, const Block& block) const;
+
+public:
+    explicit DocumentStore(size_t cache_blocks = 16);
+    ~DocumentStore();
+
+    DocumentStore(const DocumentStore&) = delete;
+    DocumentStore& operator=(const DocumentStore&) = delete;
+
+    bool open(const std::string& path);
+    void clear();
+
+    // Texts of a block that could not be written to the spool read back
+    // empty; good() turns false and stays so until open() or clear().
+    size_t append(const std::string& text);
+    std::string get(size_t index) const;
+    size_t text_size(size_t index) const;
+    size_t size() const;
+    bool good() const;
+
+    // Sections TXTOFFS0 (text offsets), TXTBLOCK (block table) and
+    // TXTDATA0 (compressed blocks); sealed blocks are copied as they are.
+    // Only the first count texts are listed, so texts appended while the
+    // caller collected its records can be left out. False if the spool is
+    // incomplete or cannot be read back.
+    bool write_image(ImageWriter& out, size_t count) const;
+    bool attach_image(const MappedImage& image);
+};
+
+#endif
@@ -0,0 +1,192 @@
+#include "index_image.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const size_t HEADER_SIZE = 32;
+
+bool ImageWriter::open(const std::string& path, const char* magic) {
+    out_.open(path, std::ios::binary | std::ios::trunc);
+    if (!out_.good()) return false;
+    sections_.clear();
+    pos_ = 0;
+    char header[HEADER_SIZE] = {};
+    std::memcpy(header, magic, 8);
+    write(header, HEADER_SIZE);
+    return out_.good();
+}
+
+void ImageWriter::write(const void* data, size_t size) {
+    out_.write(static_cast<const char*>(data), size);
+    pos_ += size;
+}
+
+void ImageWriter::pad_to(uint64_t alignment) {
+    static const char zeros[IMAGE_ALIGN] = {};
+    uint64_t rem = pos_ % alignment;
+    if (rem) write(zeros, alignment - rem);
+}
+
+void ImageWriter::begin(const char* tag) {
+    if (!sections_.empty()) sections_.back().size = pos_ - sections_.back().offset;
+    pad_to(IMAGE_ALIGN);
+    ImageSection s;
+    std::memcpy(s.tag, tag, 8);
+    s.offset = pos_;
+    s.size = 0;
+    sections_.push_back(s);
+}
+
+void ImageWriter::begin_strings(const char* tag, const std::vector<uint64_t>& offsets,
+                                const std::vector<uint32_t>* order) {
+    begin(tag);
+    write_u64(offsets.size() - 1);
+    write_u64(order ? 1 : 0);
+    write_array(offsets);
+    if (order) {
+        write_array(*order);
+        pad_to(8);
+    }
+}
+
+// Bottom-up merge sort of ids by their strings.
+static void sort_ids(std::vector<uint32_t>& ids, const std::vector<std::string_view>& strings) {
+    std::vector<uint32_t> tmp(ids.size());
+    for (size_t width = 1; width < ids.size(); width *= 2) {
+        for (size_t left = 0; left < ids.size(); left += 2 * width) {
+            size_t mid = left + width < ids.size() ? left + width : ids.size();
+            size_t right = mid + width < ids.size() ? mid + width : ids.size();
+            size_t i = left, j = mid, k = left;
+            while (i < mid && j < right) {
+                if (strings[ids[j]] < strings[ids[i]]) tmp[k++] = ids[j++];
+                else tmp[k++] = ids[i++];
+            }
+            while (i < mid) tmp[k++] = ids[i++];
+            while (j < right) tmp[k++] = ids[j++];
+        }
+        ids.swap(tmp);
+    }
+}
+
+void ImageWriter::write_strings(const char* tag, const std::vector<std::string_view>& strings, bool sorted) {
+    std::vector<uint64_t> offsets(strings.size() + 1, 0);
+    for (size_t i = 0; i < strings.size(); ++i)
+        offsets[i + 1] = offsets[i] + strings[i].size();
+    std::vector<uint32_t> order;
+    if (sorted) {
+        order.resize(strings.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = static_cast<uint32_t>(i);
+        sort_ids(order, strings);
+    }
+    begin_strings(tag, offsets, sorted ? &order : nullptr);
+    for (size_t i = 0; i < strings.size(); ++i)
+        write(strings[i].data(), strings[i].size());
+}
+
+bool ImageWriter::finish() {
+    if (!sections_.empty()) sections_.back().size = pos_ - sections_.back().offset;
+    pad_to(8);
+    uint64_t dir = pos_;
+    write_array(sections_);
+    out_.seekp(8);
+    uint64_t head[2] = {dir, sections_.size()};
+    out_.write(reinterpret_cast<const char*>(head), sizeof(head));
+    out_.close();
+    return !out_.fail();
+}
+
+bool MappedImage::open(const std::string& path, const char* magic) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < HEADER_SIZE) {
+        ::close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void* p = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps the file referenced on its own.
+    ::close(fd);
+    if (p == MAP_FAILED) return false;
+    data_ = static_cast<const char*>(p);
+    size_ = size;
+
+    uint64_t head[2];
+    std::memcpy(head, data_ + 8, sizeof(head));
+    uint64_t dir = head[0], count = head[1];
+    if (std::memcmp(data_, magic, 8) != 0 || dir % 8 != 0 || dir > size ||
+        count > (size - dir) / sizeof(ImageSection)) {
+        close();
+        return false;
+    }
+    sections_ = reinterpret_cast<const ImageSection*>(data_ + dir);
+    count_ = count;
+    for (size_t i = 0; i < count_; ++i) {
+        const ImageSection& s = sections_[i];
+        if (s.offset % IMAGE_ALIGN != 0 || s.offset > dir || s.size > dir - s.offset) {
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void MappedImage::close() {
+    if (data_) ::munmap(const_cast<char*>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+    sections_ = nullptr;
+    count_ = 0;
+}
+
+const char* MappedImage::section(const char* tag, size_t& size) const {
+    for (size_t i = 0; i < count_; ++i) {
+        if (std::memcmp(sections_[i].tag, tag, 8) == 0) {
+            size = sections_[i].size;
+            return data_ + sections_[i].offset;
+        }
+    }
+    size = 0;
+    return nullptr;
+}
+
+bool StringTable::attach(const MappedImage& image, const char* tag) {
+    *this = StringTable();
+    size_t size = 0;
+    const char* p = image.section(tag, size);
+    if (!p || size < 16) return false;
+    const uint64_t* head = reinterpret_cast<const uint64_t*>(p);
+    uint64_t count = head[0];
+    bool sorted = head[1] != 0;
+    if (count > size / 8) return false;
+    size_t order_bytes = sorted ? (count * 4 + 7) / 8 * 8 : 0;
+    size_t fixed = 16 + (count + 1) * 8 + order_bytes;
+    if (fixed > size) return false;
+    const uint64_t* offsets = head + 2;
+    if (offsets[0] != 0 || offsets[count] > size - fixed) return false;
+    for (uint64_t i = 0; i < count; ++i)
+        if (offsets[i + 1] < offsets[i]) return false;
+    const uint32_t* order = sorted ? reinterpret_cast<const uint32_t*>(offsets + count + 1) : nullptr;
+    for (uint64_t i = 0; order && i < count; ++i)
+        if (order[i] >= count) return false;
+    offsets_ = offsets;
+    order_ = order;
+    bytes_ = p + fixed;
+    count_ = count;
+    return true;
+}
+
+uint32_t StringTable::find(std::string_view s) const {
+    if (!order_) return NONE;
+    size_t lo = 0, hi = count_;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (at(order_[mid]) < s) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < count_ && at(order_[lo]) == s ? order_[lo] : NONE;
+}
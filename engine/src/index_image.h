@@ -0,0 +1,111 @@
+#ifndef INDEX_IMAGE_H
+#define INDEX_IMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// An index image is a file of tagged sections meant to be mapped and read
+// in place. Layout: 8-byte magic, the directory offset and section count
+// (u64 each), one reserved u64, then the sections, each starting on an
+// IMAGE_ALIGN boundary, and finally the directory of {tag[8], offset,
+// size} entries. Integers are stored in host byte order.
+const size_t IMAGE_ALIGN = 64;
+
+struct ImageSection {
+    char tag[8];
+    uint64_t offset;
+    uint64_t size;
+};
+
+// Sections are written one after another: begin() closes the previous
+// section and opens the next, finish() closes the last one and writes the
+// directory.
+class ImageWriter {
+private:
+    std::ofstream out_;
+    std::vector<ImageSection> sections_;
+    uint64_t pos_;
+
+    void pad_to(uint64_t alignment);
+
+public:
+    ImageWriter() : pos_(0) {}
+
+    bool open(const std::string& path, const char* magic);
+    void begin(const char* tag);
+    void write(const void* data, size_t size);
+    void write_u64(uint64_t v) { write(&v, 8); }
+    template<typename T>
+    void write_array(const std::vector<T>& v) { if (!v.empty()) write(v.data(), v.size() * sizeof(T)); }
+
+    // String tables: count, a flag for whether ids sorted by string follow
+    // the offsets, count + 1 byte offsets, the sorted ids padded to 8 bytes,
+    // then the bytes. begin_strings() writes everything up to the bytes,
+    // which the caller appends in id order.
+    void begin_strings(const char* tag, const std::vector<uint64_t>& offsets,
+                       const std::vector<uint32_t>* order);
+    void write_strings(const char* tag, const std::vector<std::string_view>& strings, bool sorted);
+
+    bool finish();
+};
+
+// A read-only, shared mapping of an image. Pages come from the page cache,
+// so every process mapping the same file shares one copy.
+class MappedImage {
+private:
+    const char* data_;
+    size_t size_;
+    const ImageSection* sections_;
+    size_t count_;
+
+public:
+    MappedImage() : data_(nullptr), size_(0), sections_(nullptr), count_(0) {}
+    ~MappedImage() { close(); }
+
+    MappedImage(const MappedImage&) = delete;
+    MappedImage& operator=(const MappedImage&) = delete;
+
+    bool open(const std::string& path, const char* magic);
+    void close();
+
+    size_t size() const { return size_; }
+    // nullptr if the image has no such section.
+    const char* section(const char* tag, size_t& size) const;
+
+    template<typename T>
+    const T* array(const char* tag, size_t& count) const {
+        size_t bytes = 0;
+        const char* p = section(tag, bytes);
+        count = bytes / sizeof(T);
+        return reinterpret_cast<const T*>(p);
+    }
+};
+
+// View of a string table section.
+class StringTable {
+private:
+    const uint64_t* offsets_;
+    const uint32_t* order_;
+    const char* bytes_;
+    size_t count_;
+
+public:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    StringTable() : offsets_(nullptr), order_(nullptr), bytes_(nullptr), count_(0) {}
+
+    bool attach(const MappedImage& image, const char* tag);
+
+    size_t size() const { return count_; }
+    std::string_view at(size_t i) const {
+        return std::string_view(bytes_ + offsets_[i], offsets_[i + 1] - offsets_[i]);
+    }
+    // Binary search over the sorted ids; NONE if absent or unsorted.
+    uint32_t find(std::string_view s) const;
+};
+
+#endif
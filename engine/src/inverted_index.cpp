@@ -1,62 +1,532 @@
 #include "inverted_index.h"
+#include <cstring>
 
-void PostingList::add(size_t doc_id) {
-    for (size_t i = 0; i < postings.size(); ++i) {
-        if (postings[i].doc_id == doc_id) {
-            postings[i].frequency++;
-            return;
+void PostingList::seal_tail() {
+    uint32_t values[CODEC_BLOCK];
+    uint32_t prev = blocks_.empty() ? UINT32_MAX : blocks_.back().last_doc;
+
+    PostingBlock block;
+    std::memset(&block, 0, sizeof(block));
+    block.last_doc = tail_.back().doc_id;
+    block.doc_offset = doc_words_.size();
+    block.freq_offset = freq_words_.size();
+
+    for (size_t i = 0; i < CODEC_BLOCK; ++i) {
+        values[i] = tail_[i].doc_id - prev - 1;
+        prev = tail_[i].doc_id;
+    }
+    block.doc_bits = codec_max_bits(values);
+    doc_words_.resize(doc_words_.size() + 4 * block.doc_bits);
+    codec_pack(values, block.doc_bits, doc_words_.data() + block.doc_offset);
+
+    for (size_t i = 0; i < CODEC_BLOCK; ++i)
+        values[i] = tail_[i].frequency - 1;
+    block.freq_bits = codec_max_bits(values);
+    freq_words_.resize(freq_words_.size() + 4 * block.freq_bits);
+    codec_pack(values, block.freq_bits, freq_words_.data() + block.freq_offset);
+
+    blocks_.push_back(block);
+    tail_.clear();
+}
+
+void PostingView::decode_block_docs(size_t b, uint32_t* docs) const {
+    uint32_t gaps[CODEC_BLOCK];
+    codec_unpack(doc_words_ + blocks_[b].doc_offset, blocks_[b].doc_bits, gaps);
+    codec_prefix_sum(gaps, b == 0 ? UINT32_MAX : blocks_[b - 1].last_doc, docs);
+}
+
+void PostingView::decode_block_freqs(size_t b, uint32_t* freqs) const {
+    codec_unpack(freq_words_ + blocks_[b].freq_offset, blocks_[b].freq_bits, freqs);
+    for (size_t i = 0; i < CODEC_BLOCK; ++i)
+        ++freqs[i];
+}
+
+void PostingView::decode_doc_ids(std::vector<uint32_t>& out) const {
+    size_t base = out.size();
+    out.resize(base + size());
+    for (size_t b = 0; b < block_count_; ++b)
+        decode_block_docs(b, out.data() + base + b * CODEC_BLOCK);
+    for (size_t i = 0; i < tail_count_; ++i)
+        out[base + block_count_ * CODEC_BLOCK + i] = tail_[i].doc_id;
+}
+
+PostingView PostingList::view() const {
+    PostingView v;
+    v.blocks_ = blocks_.data();
+    v.doc_words_ = doc_words_.data();
+    v.freq_words_ = freq_words_.data();
+    v.tail_ = tail_.data();
+    v.block_count_ = blocks_.size();
+    v.tail_count_ = tail_.size();
+    if (!bitmap_.empty()) {
+        v.bitmap_ = bitmap_.data();
+        v.bitmap_words_ = bitmap_.size();
+    }
+    v.max_frequency_ = max_frequency_;
+    v.total_frequency_ = total_frequency_;
+    return v;
+}
+
+void PostingList::assign(const PostingView& v) {
+    blocks_.assign(v.blocks_, v.blocks_ + v.block_count_);
+    size_t doc_words = 0, freq_words = 0;
+    if (v.block_count_ > 0) {
+        const PostingBlock& last = v.blocks_[v.block_count_ - 1];
+        doc_words = last.doc_offset + 4 * last.doc_bits;
+        freq_words = last.freq_offset + 4 * last.freq_bits;
+    }
+    doc_words_.assign(v.doc_words_, v.doc_words_ + doc_words);
+    freq_words_.assign(v.freq_words_, v.freq_words_ + freq_words);
+    tail_.assign(v.tail_, v.tail_ + v.tail_count_);
+    pending_.clear();
+    if (v.bitmap_) bitmap_.assign(v.bitmap_, v.bitmap_ + v.bitmap_words_);
+    else bitmap_.clear();
+    max_frequency_ = v.max_frequency_;
+    total_frequency_ = v.total_frequency_;
+}
+
+void PostingList::decode(std::vector<Posting>& out) const {
+    out.reserve(out.size() + size());
+    for_each([&out](uint32_t doc, uint32_t freq) {
+        out.push_back(Posting(doc, freq));
+    });
+}
+
+void PostingList::rebuild(const std::vector<Posting>& postings) {
+    blocks_.clear();
+    doc_words_.clear();
+    freq_words_.clear();
+    tail_.clear();
+    max_frequency_ = 0;
+    total_frequency_ = 0;
+    for (size_t i = 0; i < postings.size(); ++i)
+        add(postings[i].doc_id, postings[i].frequency);
+}
+
+void PostingList::add(size_t doc_id, size_t frequency) {
+    if (!bitmap_.empty()) drop_bitmap();
+    total_frequency_ += frequency;
+    if (!tail_.empty() && tail_.back().doc_id == doc_id) {
+        tail_.back().frequency += frequency;
+        if (tail_.back().frequency > max_frequency_) max_frequency_ = tail_.back().frequency;
+        return;
+    }
+    if (tail_.empty() || tail_.back().doc_id < doc_id) {
+        if (tail_.size() == CODEC_BLOCK) seal_tail();
+        tail_.push_back(Posting(doc_id, frequency));
+        if (frequency > max_frequency_) max_frequency_ = frequency;
+        return;
+    }
+
+    // A document indexed out of order (its URL was seen earlier in the
+    // corpus). Collected separately and merged in by flush().
+    size_t lo = 0, hi = pending_.size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (pending_[mid].doc_id < doc_id) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < pending_.size() && pending_[lo].doc_id == doc_id) {
+        pending_[lo].frequency += frequency;
+        return;
+    }
+    pending_.push_back(Posting());
+    for (size_t i = pending_.size() - 1; i > lo; --i)
+        pending_[i] = pending_[i - 1];
+    pending_[lo] = Posting(doc_id, frequency);
+}
+
+static void merge_postings(const std::vector<Posting>& a, const std::vector<Posting>& b,
+                           std::vector<Posting>& out) {
+    out.reserve(a.size() + b.size());
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (a[i].doc_id == b[j].doc_id) {
+            out.push_back(Posting(a[i].doc_id, a[i].frequency + b[j].frequency));
+            ++i; ++j;
+        } else if (a[i].doc_id < b[j].doc_id) {
+            out.push_back(a[i++]);
+        } else {
+            out.push_back(b[j++]);
         }
     }
-    postings.push_back(Posting(doc_id, 1));
+    while (i < a.size()) out.push_back(a[i++]);
+    while (j < b.size()) out.push_back(b[j++]);
 }
 
-void PostingList::sort_by_doc_id() {
-    for (size_t i = 1; i < postings.size(); ++i) {
-        Posting key = postings[i];
-        size_t j = i;
-        while (j > 0 && postings[j - 1].doc_id > key.doc_id) {
-            postings[j] = postings[j - 1];
-            --j;
+void PostingList::flush() {
+    if (pending_.empty()) return;
+    std::vector<Posting> current;
+    decode(current);
+    std::vector<Posting> merged;
+    merge_postings(current, pending_, merged);
+    std::vector<Posting>().swap(pending_);
+    rebuild(merged);
+}
+
+void PostingList::build_bitmap(size_t universe) {
+    bitmap_.assign((universe + 63) / 64, 0);
+    for_each([this](uint32_t doc, uint32_t) {
+        bitmap_[doc >> 6] |= uint64_t(1) << (doc & 63);
+    });
+}
+
+void PostingList::merge_from(const PostingList& other) {
+    if (other.empty()) return;
+
+    std::vector<Posting> src;
+    other.decode(src);
+    if (empty() || tail_.back().doc_id < src.front().doc_id) {
+        for (size_t i = 0; i < src.size(); ++i)
+            add(src[i].doc_id, src[i].frequency);
+        return;
+    }
+
+    std::vector<Posting> dst;
+    decode(dst);
+    std::vector<Posting> merged;
+    merge_postings(dst, src, merged);
+    rebuild(merged);
+}
+
+size_t PostingList::memory_usage() const {
+    return blocks_.capacity() * sizeof(PostingBlock)
+         + (doc_words_.capacity() + freq_words_.capacity()) * sizeof(uint32_t)
+         + tail_.capacity() * sizeof(Posting)
+         + bitmap_.capacity() * sizeof(uint64_t);
+}
+
+PostingCursor::PostingCursor(const PostingView& list) : list_(list) {
+    load(0);
+}
+
+void PostingCursor::load(size_t block) {
+    block_ = block;
+    pos_ = 0;
+    count_ = 0;
+    freqs_loaded_ = false;
+    size_t sealed = list_.block_count_;
+    if (block < sealed) {
+        list_.decode_block_docs(block, docs_);
+        count_ = CODEC_BLOCK;
+    } else if (block == sealed) {
+        const Posting* tail = list_.tail_;
+        for (size_t i = 0; i < list_.tail_count_; ++i) {
+            docs_[i] = tail[i].doc_id;
+            freqs_[i] = tail[i].frequency;
         }
-        postings[j] = key;
+        count_ = list_.tail_count_;
+        freqs_loaded_ = true;
     }
 }
 
-size_t InvertedIndex::get_doc_index(const std::string& doc_id) {
-    for (size_t i = 0; i < documents_.size(); ++i) {
-        if (documents_[i] == doc_id) {
-            return i;
+uint32_t PostingCursor::frequency() {
+    if (!freqs_loaded_) {
+        list_.decode_block_freqs(block_, freqs_);
+        freqs_loaded_ = true;
+    }
+    return freqs_[pos_];
+}
+
+void PostingCursor::next() {
+    if (++pos_ == count_ && block_ < list_.block_count_)
+        load(block_ + 1);
+}
+
+void PostingCursor::advance_to(uint32_t target) {
+    if (!valid()) return;
+    if (docs_[count_ - 1] < target) {
+        size_t sealed = list_.block_count_;
+        if (block_ >= sealed) {
+            pos_ = count_;
+            return;
+        }
+        size_t b = block_ + 1;
+        while (b < sealed && list_.blocks_[b].last_doc < target) ++b;
+        load(b);
+        if (!valid()) return;
+        if (docs_[count_ - 1] < target) {
+            pos_ = count_;
+            return;
         }
     }
-    documents_.push_back(doc_id);
-    return documents_.size() - 1;
+    while (docs_[pos_] < target) ++pos_;
+}
+
+size_t InvertedIndex::get_doc_index(std::string_view doc_id) {
+    return docs_.intern(doc_id);
+}
+
+bool InvertedIndex::find_doc_index(std::string_view doc_id, size_t& index) const {
+    uint32_t id = docs_.find(doc_id);
+    if (id == TermDictionary::NONE) return false;
+    index = id;
+    return true;
 }
 
 void InvertedIndex::add_document(const std::string& doc_id, const std::vector<std::string>& terms) {
-    size_t doc_index = get_doc_index(doc_id);
-    
-    for (size_t i = 0; i < terms.size(); ++i) {
-        PostingList& pl = index_.get_or_create(terms[i]);
-        pl.add(doc_index);
+    std::vector<uint32_t> term_ids;
+    term_ids.reserve(terms.size());
+    for (size_t i = 0; i < terms.size(); ++i)
+        term_ids.push_back(intern_term(terms[i]));
+    add_postings(get_doc_index(doc_id), term_ids);
+}
+
+uint32_t InvertedIndex::intern_term(std::string_view term) {
+    detach();
+    uint32_t id = terms_.intern(term);
+    if (id == postings_.size()) postings_.emplace_back();
+    return id;
+}
+
+void InvertedIndex::add_postings(size_t doc_index, const std::vector<uint32_t>& term_ids) {
+    detach();
+    for (size_t i = 0; i < term_ids.size(); ++i)
+        postings_[term_ids[i]].add(doc_index);
+    add_doc_length(doc_index, term_ids.size());
+}
+
+void InvertedIndex::add_doc_length(size_t index, size_t length) {
+    if (index >= doc_lengths_.size()) doc_lengths_.resize(index + 1, 0);
+    doc_lengths_[index] += length;
+}
+
+void InvertedIndex::merge_doc_lengths(const InvertedIndex& other) {
+    for (size_t i = 0; i < other.doc_lengths_.size(); ++i)
+        if (other.doc_lengths_[i]) add_doc_length(i, other.doc_lengths_[i]);
+}
+
+// For dumps written before document lengths were stored.
+void InvertedIndex::recount_doc_lengths() {
+    detach();
+    doc_lengths_.assign(docs_.size(), 0);
+    for (size_t id = 0; id < postings_.size(); ++id) {
+        postings_[id].for_each([this](uint32_t doc, uint32_t freq) {
+            add_doc_length(doc, freq);
+        });
+    }
+    compute_statistics();
+}
+
+void InvertedIndex::compute_statistics() {
+    size_t n = docs_.size();
+    if (n > 0 && doc_lengths_.size() < n) doc_lengths_.resize(n, 0);
+    uint64_t total = 0;
+    for (size_t i = 0; i < doc_lengths_.size(); ++i)
+        total += doc_lengths_[i];
+    total_terms_ = total;
+}
+
+void InvertedIndex::finalize() {
+    detach();
+    size_t universe = docs_.size();
+    for (size_t id = 0; id < postings_.size(); ++id) {
+        PostingList& pl = postings_[id];
+        pl.flush();
+        if (universe > 0 && pl.size() * DENSE_RATIO >= universe) pl.build_bitmap(universe);
+        else pl.drop_bitmap();
     }
+    compute_statistics();
+}
+
+PostingView InvertedIndex::find_postings(std::string_view term) const {
+    uint32_t id = terms_.find(term);
+    return id == TermDictionary::NONE ? PostingView() : postings(id);
+}
+
+size_t InvertedIndex::postings_memory() const {
+    size_t total = 0;
+    for (size_t id = 0; id < postings_.size(); ++id)
+        total += postings_[id].memory_usage();
+    return total;
 }
 
-PostingList* InvertedIndex::get_posting_list(const std::string& term) {
-    return index_.find(term);
+PostingView InvertedIndex::image_view(uint32_t id) const {
+    const ImageEntry& e = image_.entries[id];
+    PostingView v;
+    v.blocks_ = image_.blocks + e.block_begin;
+    v.doc_words_ = image_.doc_words + e.doc_word_begin;
+    v.freq_words_ = image_.freq_words + e.freq_word_begin;
+    v.tail_ = image_.tails + e.tail_begin;
+    v.block_count_ = e.block_count;
+    v.tail_count_ = e.tail_count;
+    if (e.bitmap_begin != UINT64_MAX) {
+        v.bitmap_ = image_.bitmaps + e.bitmap_begin;
+        v.bitmap_words_ = image_.bitmap_words;
+    }
+    v.max_frequency_ = e.max_frequency;
+    v.total_frequency_ = e.total_frequency;
+    return v;
 }
 
-const PostingList* InvertedIndex::get_posting_list(const std::string& term) const {
-    return index_.find(term);
+void InvertedIndex::detach() {
+    if (!is_mapped_) return;
+    std::vector<PostingList> lists(terms_.size());
+    for (uint32_t id = 0; id < lists.size(); ++id)
+        lists[id].assign(image_view(id));
+    postings_.swap(lists);
+    image_ = ImagePostings();
+    is_mapped_ = false;
 }
 
-const std::string& InvertedIndex::get_doc_id(size_t index) const {
-    return documents_[index];
+// Sections: IDXMETA0 holds the document and term counts, the total
+// document length and the bitmap size; IDXDOCS0 and IDXTERMS are
+// sorted string tables; IDXLENS0 has the document lengths; IDXPLIST one
+// ImageEntry per term; the rest are the concatenated posting streams.
+void InvertedIndex::write_image(ImageWriter& out) const {
+    size_t bitmap_words = (docs_.size() + 63) / 64;
+    size_t n = terms_.size();
+
+    out.begin("IDXMETA0");
+    out.write_u64(docs_.size());
+    out.write_u64(n);
+    out.write_u64(total_terms_);
+    out.write_u64(bitmap_words);
+
+    docs_.write_image(out, "IDXDOCS0");
+    terms_.write_image(out, "IDXTERMS");
+
+    out.begin("IDXLENS0");
+    out.write_array(doc_lengths_);
+
+    out.begin("IDXPLIST");
+    ImageEntry e;
+    std::memset(&e, 0, sizeof(e));
+    uint64_t bitmaps = 0;
+    for (uint32_t id = 0; id < n; ++id) {
+        PostingView v = postings(id);
+        e.block_count = v.block_count_;
+        e.tail_count = v.tail_count_;
+        e.max_frequency = v.max_frequency_;
+        e.total_frequency = v.total_frequency_;
+        e.bitmap_begin = UINT64_MAX;
+        if (v.bitmap_ && v.bitmap_words_ == bitmap_words) {
+            e.bitmap_begin = bitmaps;
+            bitmaps += bitmap_words;
+        }
+        out.write(&e, sizeof(e));
+        e.block_begin += v.block_count_;
+        if (v.block_count_ > 0) {
+            const PostingBlock& last = v.blocks_[v.block_count_ - 1];
+            e.doc_word_begin += last.doc_offset + 4 * last.doc_bits;
+            e.freq_word_begin += last.freq_offset + 4 * last.freq_bits;
+        }
+        e.tail_begin += v.tail_count_;
+    }
+
+    out.begin("IDXBLOCK");
+    for (uint32_t id = 0; id < n; ++id) {
+        PostingView v = postings(id);
+        out.write(v.blocks_, v.block_count_ * sizeof(PostingBlock));
+    }
+    out.begin("IDXDOCWD");
+    for (uint32_t id = 0; id < n; ++id) {
+        PostingView v = postings(id);
+        if (v.block_count_ == 0) continue;
+        const PostingBlock& last = v.blocks_[v.block_count_ - 1];
+        out.write(v.doc_words_, (last.doc_offset + 4 * last.doc_bits) * sizeof(uint32_t));
+    }
+    out.begin("IDXFRQWD");
+    for (uint32_t id = 0; id < n; ++id) {
+        PostingView v = postings(id);
+        if (v.block_count_ == 0) continue;
+        const PostingBlock& last = v.blocks_[v.block_count_ - 1];
+        out.write(v.freq_words_, (last.freq_offset + 4 * last.freq_bits) * sizeof(uint32_t));
+    }
+    out.begin("IDXTAILS");
+    for (uint32_t id = 0; id < n; ++id) {
+        PostingView v = postings(id);
+        out.write(v.tail_, v.tail_count_ * sizeof(Posting));
+    }
+    out.begin("IDXBITMP");
+    for (uint32_t id = 0; id < n; ++id) {
+        PostingView v = postings(id);
+        if (v.bitmap_ && v.bitmap_words_ == bitmap_words)
+            out.write(v.bitmap_, bitmap_words * sizeof(uint64_t));
+    }
 }
 
-size_t InvertedIndex::vocabulary_size() const {
-    return index_.size();
+// Doc ids index the length column and every doc id bitmap, so a list's
+// ids must be strictly increasing and below num_docs: decoded blocks end
+// on their last_doc, the tail follows them, and a bitmap has no bits set
+// past num_docs.
+bool InvertedIndex::valid_doc_ids(const PostingView& v, size_t num_docs) {
+    uint32_t docs[CODEC_BLOCK];
+    uint64_t next = 0;
+    for (size_t b = 0; b < v.block_count_; ++b) {
+        v.decode_block_docs(b, docs);
+        for (size_t i = 0; i < CODEC_BLOCK; ++i) {
+            if (docs[i] < next) return false;
+            next = uint64_t(docs[i]) + 1;
+        }
+        if (docs[CODEC_BLOCK - 1] != v.blocks_[b].last_doc) return false;
+    }
+    for (size_t i = 0; i < v.tail_count_; ++i) {
+        if (v.tail_[i].doc_id < next) return false;
+        next = uint64_t(v.tail_[i].doc_id) + 1;
+    }
+    if (next > num_docs) return false;
+    if (v.bitmap_ && num_docs % 64 != 0 && v.bitmap_words_ > 0 &&
+        v.bitmap_[v.bitmap_words_ - 1] >> (num_docs % 64) != 0)
+        return false;
+    return true;
 }
 
-size_t InvertedIndex::document_count() const {
-    return documents_.size();
+bool InvertedIndex::attach_image(const MappedImage& image) {
+    clear();
+    size_t count = 0;
+    const uint64_t* meta = image.array<uint64_t>("IDXMETA0", count);
+    if (!meta || count < 4) return false;
+    uint64_t num_docs = meta[0], num_terms = meta[1];
+
+    ImagePostings p;
+    size_t entries = 0, blocks = 0, doc_words = 0, freq_words = 0, tails = 0, bitmaps = 0, lengths = 0;
+    p.entries = image.array<ImageEntry>("IDXPLIST", entries);
+    p.blocks = image.array<PostingBlock>("IDXBLOCK", blocks);
+    p.doc_words = image.array<uint32_t>("IDXDOCWD", doc_words);
+    p.freq_words = image.array<uint32_t>("IDXFRQWD", freq_words);
+    p.tails = image.array<Posting>("IDXTAILS", tails);
+    p.bitmaps = image.array<uint64_t>("IDXBITMP", bitmaps);
+    p.bitmap_words = meta[3];
+    const uint32_t* lens = image.array<uint32_t>("IDXLENS0", lengths);
+    if (!p.entries || entries != num_terms || !lens || lengths != num_docs ||
+        p.bitmap_words != (num_docs + 63) / 64 ||
+        !docs_.attach_image(image, "IDXDOCS0") || !terms_.attach_image(image, "IDXTERMS") ||
+        docs_.size() != num_docs || terms_.size() != num_terms) {
+        clear();
+        return false;
+    }
+    // Every list and each of its blocks must lie inside the sections, so
+    // a corrupt image fails here rather than on the query that reads it.
+    for (size_t id = 0; id < num_terms; ++id) {
+        const ImageEntry& e = p.entries[id];
+        bool ok = e.block_begin <= blocks && e.block_count <= blocks - e.block_begin &&
+                  e.tail_count <= CODEC_BLOCK &&
+                  e.tail_begin <= tails && e.tail_count <= tails - e.tail_begin &&
+                  e.doc_word_begin <= doc_words && e.freq_word_begin <= freq_words;
+        if (ok && e.bitmap_begin != UINT64_MAX)
+            ok = e.bitmap_begin <= bitmaps && p.bitmap_words <= bitmaps - e.bitmap_begin;
+        for (size_t b = 0; ok && b < e.block_count; ++b) {
+            const PostingBlock& block = p.blocks[e.block_begin + b];
+            ok = block.doc_bits <= 32 && block.freq_bits <= 32 &&
+                 block.doc_offset + 4ull * block.doc_bits <= doc_words - e.doc_word_begin &&
+                 block.freq_offset + 4ull * block.freq_bits <= freq_words - e.freq_word_begin;
+        }
+        if (!ok) {
+            clear();
+            return false;
+        }
+    }
+
+    image_ = p;
+    is_mapped_ = true;
+    for (uint32_t id = 0; id < num_terms; ++id) {
+        if (!valid_doc_ids(image_view(id), num_docs)) {
+            clear();
+            return false;
+        }
+    }
+    doc_lengths_.assign(lens, lens + lengths);
+    total_terms_ = meta[2];
+    return true;
 }
@@ -1,52 +1,259 @@
 #ifndef INVERTED_INDEX_H
 #define INVERTED_INDEX_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include "string_map.h"
+#include "term_dictionary.h"
+#include "posting_codec.h"
 
 struct Posting {
-    size_t doc_id;
-    size_t frequency;
+    uint32_t doc_id;
+    uint32_t frequency;
     
     Posting() : doc_id(0), frequency(0) {}
     Posting(size_t d, size_t f) : doc_id(d), frequency(f) {}
 };
 
+// Header of a sealed block; offsets are in words into the list's doc and
+// frequency streams. Written to index images as is, so the unused padding
+// is zeroed when a block is sealed.
+struct PostingBlock {
+    uint32_t last_doc;
+    uint32_t doc_offset;
+    uint32_t freq_offset;
+    uint8_t doc_bits;
+    uint8_t freq_bits;
+};
+
+// Read-only view of a flushed posting list, pointing either into a
+// PostingList or into a mapped index image. Valid as long as its source
+// is neither modified nor unmapped.
+class PostingView {
+    friend class PostingList;
+    friend class PostingCursor;
+    friend class InvertedIndex;
+
+private:
+    const PostingBlock* blocks_ = nullptr;
+    const uint32_t* doc_words_ = nullptr;
+    const uint32_t* freq_words_ = nullptr;
+    const Posting* tail_ = nullptr;
+    const uint64_t* bitmap_ = nullptr;
+    size_t block_count_ = 0;
+    size_t tail_count_ = 0;
+    size_t bitmap_words_ = 0;
+    uint32_t max_frequency_ = 0;
+    uint64_t total_frequency_ = 0;
+
+    void decode_block_docs(size_t b, uint32_t* docs) const;
+    void decode_block_freqs(size_t b, uint32_t* freqs) const;
+
+public:
+    size_t size() const { return block_count_ * CODEC_BLOCK + tail_count_; }
+    bool empty() const { return block_count_ == 0 && tail_count_ == 0; }
+    uint32_t max_frequency() const { return max_frequency_; }
+    uint64_t total_frequency() const { return total_frequency_; }
+    // nullptr unless the list is dense enough to carry a bitmap.
+    const uint64_t* bitmap() const { return bitmap_; }
+    size_t bitmap_words() const { return bitmap_words_; }
+    void decode_doc_ids(std::vector<uint32_t>& out) const;
+
+    template<typename Func>
+    void for_each(Func func) const {
+        uint32_t docs[CODEC_BLOCK];
+        uint32_t freqs[CODEC_BLOCK];
+        for (size_t b = 0; b < block_count_; ++b) {
+            decode_block_docs(b, docs);
+            decode_block_freqs(b, freqs);
+            for (size_t i = 0; i < CODEC_BLOCK; ++i)
+                func(docs[i], freqs[i]);
+        }
+        for (size_t i = 0; i < tail_count_; ++i)
+            func(tail_[i].doc_id, tail_[i].frequency);
+    }
+};
+
+// Postings are kept in sealed blocks of CODEC_BLOCK entries plus an
+// uncompressed tail. A sealed block stores doc id gaps and frequencies as
+// two separately bit-packed streams; its header keeps the last doc id so
+// lookups can skip whole blocks. The most recent posting always lives in
+// the tail, so repeated occurrences in one document only bump a counter.
+// Documents added out of order wait in pending_ until flush(), which must
+// run before the list is read. Dense lists also keep a bitmap of their doc
+// ids for the boolean evaluator; any add() drops it until the next
+// build_bitmap().
 class PostingList {
+    friend class InvertedIndex;
+
+private:
+    std::vector<PostingBlock> blocks_;
+    std::vector<uint32_t> doc_words_;
+    std::vector<uint32_t> freq_words_;
+    std::vector<Posting> tail_;
+    std::vector<Posting> pending_;
+    std::vector<uint64_t> bitmap_;
+    uint32_t max_frequency_ = 0;
+    uint64_t total_frequency_ = 0;
+
+    void seal_tail();
+    void decode(std::vector<Posting>& out) const;
+    void rebuild(const std::vector<Posting>& postings);
+    void assign(const PostingView& view);
+
 public:
-    std::vector<Posting> postings;
-    
-    void add(size_t doc_id);
-    void sort_by_doc_id();
+    void add(size_t doc_id, size_t frequency = 1);
+    void merge_from(const PostingList& other);
+    void flush();
+    void build_bitmap(size_t universe);
+    void drop_bitmap() { std::vector<uint64_t>().swap(bitmap_); }
+
+    PostingView view() const;
+    size_t size() const { return blocks_.size() * CODEC_BLOCK + tail_.size(); }
+    bool empty() const { return blocks_.empty() && tail_.empty(); }
+    uint32_t max_frequency() const { return max_frequency_; }
+    // Collection frequency: the sum of all frequencies, pending ones included.
+    uint64_t total_frequency() const { return total_frequency_; }
+    size_t memory_usage() const;
+
+    template<typename Func>
+    void for_each(Func func) const { view().for_each(func); }
+};
+
+// Forward-only reader over a posting list, decoding one block at a time.
+// Frequencies are only decoded for blocks where they are asked for.
+class PostingCursor {
+private:
+    PostingView list_;
+    size_t block_;
+    size_t pos_;
+    size_t count_;
+    bool freqs_loaded_;
+    uint32_t docs_[CODEC_BLOCK];
+    uint32_t freqs_[CODEC_BLOCK];
+
+    void load(size_t block);
+
+public:
+    explicit PostingCursor(const PostingView& list);
+
+    bool valid() const { return pos_ < count_; }
+    uint32_t doc() const { return docs_[pos_]; }
+    uint32_t frequency();
+    void next();
+    // Moves to the first posting with doc id >= target.
+    void advance_to(uint32_t target);
 };
 
 class InvertedIndex {
+public:
+    // Lists covering at least 1/DENSE_RATIO of the documents get a bitmap.
+    static const size_t DENSE_RATIO = 8;
+
 private:
-    StringMap<PostingList> index_{262144};
-    std::vector<std::string> documents_;
+    // Per-term record of an image's posting table; the begin fields index
+    // the shared block, word, tail and bitmap sections.
+    struct ImageEntry {
+        uint64_t block_begin;
+        uint64_t doc_word_begin;
+        uint64_t freq_word_begin;
+        uint64_t tail_begin;
+        uint64_t bitmap_begin;
+        uint64_t total_frequency;
+        uint32_t block_count;
+        uint32_t tail_count;
+        uint32_t max_frequency;
+        uint32_t reserved;
+    };
+
+    // Posting sections of the attached image, if any.
+    struct ImagePostings {
+        const ImageEntry* entries = nullptr;
+        const PostingBlock* blocks = nullptr;
+        const uint32_t* doc_words = nullptr;
+        const uint32_t* freq_words = nullptr;
+        const Posting* tails = nullptr;
+        const uint64_t* bitmaps = nullptr;
+        size_t bitmap_words = 0;
+    };
+
+    // Posting lists are indexed by the term's id in terms_; documents are
+    // named by their URL in docs_.
+    TermDictionary terms_;
+    TermDictionary docs_;
+    std::vector<PostingList> postings_;
+    ImagePostings image_;
+    bool is_mapped_ = false;
+    std::vector<uint32_t> doc_lengths_;
+    uint64_t total_terms_ = 0;
+
+    PostingView image_view(uint32_t id) const;
+    static bool valid_doc_ids(const PostingView& v, size_t num_docs);
+    void detach();
     
 public:
+    // Initial table sizes; both dictionaries grow as needed.
+    explicit InvertedIndex(size_t term_capacity = 262144, size_t doc_capacity = 16384)
+        : terms_(term_capacity), docs_(doc_capacity) {}
+
     void add_document(const std::string& doc_id, const std::vector<std::string>& terms);
-    PostingList* get_posting_list(const std::string& term);
-    const PostingList* get_posting_list(const std::string& term) const;
-    
-    size_t get_doc_index(const std::string& doc_id);
-    const std::string& get_doc_id(size_t index) const;
+    // One entry per token, as returned by intern_term().
+    void add_postings(size_t doc_index, const std::vector<uint32_t>& term_ids);
+    void finalize();
+
+    uint32_t intern_term(std::string_view term);
+    uint32_t find_term(std::string_view term) const { return terms_.find(term); }
+    std::string_view term(uint32_t id) const { return terms_.term(id); }
+    PostingList& posting_list(uint32_t id) { detach(); return postings_[id]; }
+    PostingView postings(uint32_t id) const { return is_mapped_ ? image_view(id) : postings_[id].view(); }
+    // Empty for unknown terms.
+    PostingView find_postings(std::string_view term) const;
     
-    size_t vocabulary_size() const;
-    size_t document_count() const;
+    size_t get_doc_index(std::string_view doc_id);
+    bool find_doc_index(std::string_view doc_id, size_t& index) const;
+    std::string_view get_doc_id(size_t index) const { return docs_.term(static_cast<uint32_t>(index)); }
     
-    const std::vector<std::string>& documents() const { return documents_; }
+    size_t vocabulary_size() const { return terms_.size(); }
+    size_t document_count() const { return docs_.size(); }
+    size_t postings_memory() const;
+    // Number of indexed tokens, i.e. the sum of all document lengths.
+    uint64_t total_terms() const { return total_terms_; }
+
+    // Document length is the number of indexed terms, so it always equals
+    // the sum of the document's term frequencies.
+    uint32_t doc_length(size_t index) const { return index < doc_lengths_.size() ? doc_lengths_[index] : 0; }
+    const std::vector<uint32_t>& doc_lengths() const { return doc_lengths_; }
+    void add_doc_length(size_t index, size_t length);
+    void merge_doc_lengths(const InvertedIndex& other);
+    void recount_doc_lengths();
+    // Refreshes total_terms(); run by finalize() and after document lengths
+    // change.
+    void compute_statistics();
+
+    void clear() {
+        terms_.clear(); docs_.clear(); std::vector<PostingList>().swap(postings_);
+        image_ = ImagePostings(); is_mapped_ = false;
+        doc_lengths_.clear(); total_terms_ = 0;
+    }
+    void reserve_vocabulary(size_t n) { terms_.reserve(n); postings_.reserve(n); }
+    void reserve_documents(size_t n) { docs_.reserve(n); }
+    void add_document_name(const std::string& name) { get_doc_index(name); }
+    void insert_posting_list(const std::string& term, PostingList&& pl) { postings_[intern_term(term)] = std::move(pl); }
 
-    void clear() { index_.clear(); documents_.clear(); }
-    void reserve_vocabulary(size_t n) { index_.reserve(n); }
-    void add_document_name(const std::string& name) { documents_.push_back(name); }
-    void insert_posting_list(const std::string& term, const PostingList& pl) { index_.insert(term, pl); }
+    // A finalized index written by write_image() can be served straight
+    // from the mapped file: attach_image() only copies the document
+    // lengths. The image must stay mapped until clear(); the first change
+    // to the vocabulary or the postings copies them out of it.
+    void write_image(ImageWriter& out) const;
+    bool attach_image(const MappedImage& image);
+    bool mapped() const { return is_mapped_; }
 
+    // Visits terms in id order, i.e. in order of first occurrence.
     template<typename Func>
     void for_each_term(Func func) const {
-        index_.for_each(func);
+        for (uint32_t id = 0; id < terms_.size(); ++id)
+            func(terms_.term(id), postings(id));
     }
 };
 
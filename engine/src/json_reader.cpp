@@ -1,109 +1,242 @@
 #include "json_reader.h"
 #include <iostream>
+#include <cstdint>
+#include <cstring>
 
-std::string NdjsonReader::unescape_json_string(const std::string& str) {
-    std::string result;
-    result.reserve(str.size());
-    
-    for (size_t i = 0; i < str.size(); ++i) {
-        if (str[i] == '\\' && i + 1 < str.size()) {
-            char next = str[i + 1];
-            switch (next) {
-                case 'n': result += '\n'; ++i; break;
-                case 'r': result += '\r'; ++i; break;
-                case 't': result += '\t'; ++i; break;
-                case '"': result += '"'; ++i; break;
-                case '\\': result += '\\'; ++i; break;
-                case '/': result += '/'; ++i; break;
-                case 'u':
-                    if (i + 5 < str.size()) {
-                        result += '?';
-                        i += 5;
-                    }
-                    break;
-                default:
-                    result += str[i];
-            }
-        } else {
-            result += str[i];
-        }
-    }
-    
-    return result;
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NDJSON_X86 1
+#endif
+
+namespace {
+
+// Each finder returns the offset of the first '"' or '\\' in [p, end),
+// or end - p when there is none.
+
+size_t find_special_scalar(const char* p, const char* end) {
+    const char* s = p;
+    while (s < end && *s != '"' && *s != '\\') ++s;
+    return s - p;
 }
 
-std::string NdjsonReader::extract_field(const std::string& json, const std::string& field) {
-    std::string search = "\"" + field + "\":";
-    size_t pos = json.find(search);
-    
-    if (pos == std::string::npos) {
-        search = "\"" + field + "\": ";
-        pos = json.find(search);
+#ifdef NDJSON_X86
+size_t find_special_sse2(const char* p, const char* end) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const char* s = p;
+    while (end - s >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)));
+        if (mask) return (s - p) + __builtin_ctz(mask);
+        s += 16;
     }
-    
-    if (pos == std::string::npos) {
-        return "";
+    return (s - p) + find_special_scalar(s, end);
+}
+
+__attribute__((target("avx2")))
+size_t find_special_avx2(const char* p, const char* end) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i bslash = _mm256_set1_epi8('\\');
+    const char* s = p;
+    while (end - s >= 64) {
+        __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s));
+        __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + 32));
+        uint32_t mlo = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(lo, quote), _mm256_cmpeq_epi8(lo, bslash)));
+        uint32_t mhi = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(hi, quote), _mm256_cmpeq_epi8(hi, bslash)));
+        uint64_t mask = mlo | (static_cast<uint64_t>(mhi) << 32);
+        if (mask) return (s - p) + __builtin_ctzll(mask);
+        s += 64;
     }
-    
-    pos += search.size();
-    
-    while (pos < json.size() && (json[pos] == ' ' || json[pos] == '\t')) {
-        ++pos;
+    if (end - s >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, bslash)));
+        if (mask) return (s - p) + __builtin_ctz(mask);
+        s += 32;
     }
-    
-    if (pos >= json.size()) return "";
-    
-    if (json[pos] == '"') {
-        ++pos;
-        std::string value;
-        while (pos < json.size() && json[pos] != '"') {
-            if (json[pos] == '\\' && pos + 1 < json.size()) {
-                value += json[pos];
-                value += json[pos + 1];
-                pos += 2;
+    return (s - p) + find_special_sse2(s, end);
+}
+#endif
+
+typedef size_t (*FindSpecialFn)(const char*, const char*);
+
+FindSpecialFn select_find_special() {
+#ifdef NDJSON_X86
+    if (__builtin_cpu_supports("avx2")) return find_special_avx2;
+    return find_special_sse2;
+#else
+    return find_special_scalar;
+#endif
+}
+
+const FindSpecialFn find_special = select_find_special();
+
+inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+inline const char* skip_space(const char* p, const char* end) {
+    while (p < end && is_space(*p)) ++p;
+    return p;
+}
+
+inline bool is_hex(char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+// p points just past the opening quote. Unescaped bytes are appended to
+// dest (if given) in runs; returns the position after the closing quote.
+const char* scan_string(const char* p, const char* end, std::string* dest) {
+    while (p < end) {
+        size_t run = find_special(p, end);
+        if (dest) dest->append(p, run);
+        p += run;
+        if (p >= end) return end;
+        if (*p == '"') return p + 1;
+
+        if (p + 1 >= end) {
+            if (dest) dest->push_back('\\');
+            return end;
+        }
+        char next = p[1];
+        if (next == 'u') {
+            // Only a complete \uXXXX is consumed, so a truncated one never
+            // swallows the closing quote.
+            if (end - p >= 6 && is_hex(p[2]) && is_hex(p[3]) && is_hex(p[4]) && is_hex(p[5])) {
+                if (dest) dest->push_back('?');
+                p += 6;
             } else {
-                value += json[pos];
-                ++pos;
+                p += 1;
             }
+            continue;
+        }
+        char out = next;
+        switch (next) {
+            case 'n': out = '\n'; break;
+            case 'r': out = '\r'; break;
+            case 't': out = '\t'; break;
+            case '"': case '\\': case '/': break;
+            default:
+                if (dest) dest->push_back('\\');
+                p += 1;
+                continue;
         }
-        return unescape_json_string(value);
+        if (dest) dest->push_back(out);
+        p += 2;
     }
-    
-    if (json[pos] >= '0' && json[pos] <= '9') {
-        std::string value;
-        while (pos < json.size() && json[pos] >= '0' && json[pos] <= '9') {
-            value += json[pos];
-            ++pos;
+    return end;
+}
+
+const char* skip_value(const char* p, const char* end) {
+    if (p >= end) return end;
+    if (*p == '"') return scan_string(p + 1, end, nullptr);
+    if (*p == '{' || *p == '[') {
+        size_t depth = 0;
+        while (p < end) {
+            char c = *p;
+            if (c == '"') { p = scan_string(p + 1, end, nullptr); continue; }
+            if (c == '{' || c == '[') ++depth;
+            else if (c == '}' || c == ']') {
+                if (--depth == 0) return p + 1;
+            }
+            ++p;
         }
-        return value;
+        return end;
     }
-    
-    return "";
+    while (p < end && *p != ',' && *p != '}' && !is_space(*p)) ++p;
+    return p;
 }
 
-std::vector<Document> NdjsonReader::load(const std::string& filename) {
-    std::vector<Document> documents;
-    std::ifstream file(filename);
-    
-    if (!file.is_open()) {
+}
+
+void NdjsonReader::extract_fields(const std::string& json, JsonField* fields, size_t count) {
+    const char* p = json.data();
+    const char* end = p + json.size();
+
+    p = skip_space(p, end);
+    if (p >= end || *p != '{') return;
+    ++p;
+
+    size_t remaining = count;
+    while (remaining > 0) {
+        while (p < end && (is_space(*p) || *p == ',')) ++p;
+        if (p >= end || *p != '"') return;
+
+        const char* key = p + 1;
+        p = scan_string(key, end, nullptr);
+        size_t key_len = p - key - 1;
+
+        p = skip_space(p, end);
+        if (p >= end || *p != ':') return;
+        p = skip_space(p + 1, end);
+        if (p >= end) return;
+
+        std::string* dest = nullptr;
+        for (size_t i = 0; i < count; ++i) {
+            if (fields[i].value && std::strlen(fields[i].name) == key_len &&
+                std::memcmp(fields[i].name, key, key_len) == 0) {
+                dest = fields[i].value;
+                fields[i].value = nullptr;
+                --remaining;
+                break;
+            }
+        }
+
+        if (dest && *p == '"') {
+            p = scan_string(p + 1, end, dest);
+        } else if (dest && *p >= '0' && *p <= '9') {
+            const char* start = p;
+            while (p < end && *p >= '0' && *p <= '9') ++p;
+            dest->append(start, p - start);
+            p = skip_value(p, end);
+        } else {
+            p = skip_value(p, end);
+        }
+    }
+}
+
+std::string NdjsonReader::extract_field(const std::string& json, const std::string& field) {
+    std::string value;
+    JsonField f = {field.c_str(), &value};
+    extract_fields(json, &f, 1);
+    return value;
+}
+
+NdjsonStream::NdjsonStream(const std::string& filename) : file_(filename), bytes_read_(0) {
+    if (!file_.is_open()) {
         std::cerr << "Cannot open file: " << filename << std::endl;
-        return documents;
     }
+}
+
+bool NdjsonStream::next(Document& doc) {
+    while (std::getline(file_, line_)) {
+        bytes_read_ += line_.size() + 1;
+        if (!line_.empty() && NdjsonReader::parse_document(line_, doc))
+            return true;
+    }
+    return false;
+}
+
+bool NdjsonReader::parse_document(const std::string& line, Document& doc) {
+    doc.url.clear();
+    doc.title.clear();
+    doc.text.clear();
+    JsonField fields[] = {
+        {"url", &doc.url},
+        {"title", &doc.title},
+        {"text", &doc.text},
+    };
+    extract_fields(line, fields, 3);
+    return !doc.url.empty() && !doc.text.empty();
+}
+
+std::vector<Document> NdjsonReader::load(const std::string& filename) {
+    std::vector<Document> documents;
+    NdjsonStream stream(filename);
     
-    std::string line;
-    while (std::getline(file, line)) {
-        if (line.empty()) continue;
-        
-        Document doc;
-        doc.url = extract_field(line, "url");
-        doc.title = extract_field(line, "title");
-        doc.text = extract_field(line, "text");
-        
-        if (!doc.url.empty() && !doc.text.empty()) {
-            documents.push_back(doc);
-        }
+    Document doc;
+    while (stream.next(doc)) {
+        documents.push_back(std::move(doc));
     }
     
-    file.close();
     return documents;
 }
@@ -11,11 +11,32 @@ struct Document {
     std::string text;
 };
 
+struct JsonField {
+    const char* name;
+    std::string* value;
+};
+
+class NdjsonStream {
+private:
+    std::ifstream file_;
+    std::string line_;
+    size_t bytes_read_;
+
+public:
+    explicit NdjsonStream(const std::string& filename);
+
+    bool is_open() const { return file_.is_open(); }
+    bool next(Document& doc);
+    size_t bytes_read() const { return bytes_read_; }
+};
+
 class NdjsonReader {
 public:
     static std::vector<Document> load(const std::string& filename);
+    // False unless the line has a non-empty url and text.
+    static bool parse_document(const std::string& line, Document& doc);
     static std::string extract_field(const std::string& json, const std::string& field);
-    static std::string unescape_json_string(const std::string& str);
+    static void extract_fields(const std::string& json, JsonField* fields, size_t count);
 };
 
 #endif
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <algorithm>
 #include <chrono>
 #include <string>
 #include <sstream>
@@ -7,37 +8,162 @@
 #include <fstream>
 #include <iomanip>
 #include <cstdint>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <sys/stat.h>
 #include "httplib.h"
 #include "json_reader.h"
 #include "tokenizer.h"
 #include "stemmer.h"
+#include "stem_cache.h"
 #include "inverted_index.h"
+#include "segmented_index.h"
 #include "boolean_search.h"
+#include "query_cache.h"
 #include "zipf_analyzer.h"
+#include "doc_store.h"
+#include "index_image.h"
+#include "bounded_queue.h"
 
-static std::vector<Document> g_documents;
-static InvertedIndex g_index;
-static ZipfAnalyzer g_zipf;
-static double g_index_time = 0;
-static size_t g_total_tokens = 0;
+// One built or loaded index together with everything that refers to its
+// doc ids and records. Requests take the current one with
+// current_corpus() and keep using it until they are done, so a hot swap
+// never changes the index under a running request.
+struct Corpus {
+    // Mapping of the loaded IRDUMP02 image, if any. The base segment and
+    // doc_texts read from it; members are destroyed in reverse order, so
+    // it is unmapped after the merge thread of segments has stopped.
+    std::unique_ptr<MappedImage> image;
+    // Guards documents once the server runs: ingest workers append
+    // records while request threads read them.
+    std::mutex records_mutex;
+    std::vector<Document> documents;
+    DocumentStore doc_texts;
+    // Surface form -> stem for query-time lexing, collected from the build
+    // workers' caches and persisted in the dump. Read-only once serving.
+    StemCache stem_cache;
+    SegmentedIndex segments;
+    double index_time;
+    std::atomic<size_t> total_tokens;
 
-struct DocLookup {
-    StringMap<size_t> url_to_idx;
-    
-    void build(const std::vector<Document>& docs) {
-        for (size_t i = 0; i < docs.size(); ++i) {
-            url_to_idx.insert(docs[i].url, i);
+    Corpus() : stem_cache(1 << 16), index_time(0), total_tokens(0) {}
+
+    // Record of every document of a freshly built or loaded index: the
+    // last record with its URL, or documents.size() if there is none.
+    std::vector<uint32_t> doc_records(const InvertedIndex& index) const {
+        std::vector<uint32_t> records(index.document_count(), static_cast<uint32_t>(documents.size()));
+        for (size_t i = 0; i < documents.size(); ++i) {
+            size_t idx = 0;
+            if (index.find_doc_index(documents[i].url, idx)) records[idx] = static_cast<uint32_t>(i);
         }
+        return records;
     }
-    
-    const Document* find(const std::string& url) const {
-        const size_t* idx = url_to_idx.find(url);
-        if (idx) return &g_documents[*idx];
-        return nullptr;
+
+    // Copies url and title of a record; false if there is none.
+    bool read_record(size_t record, Document& doc) {
+        std::lock_guard<std::mutex> lock(records_mutex);
+        if (record >= documents.size()) return false;
+        doc.url = documents[record].url;
+        doc.title = documents[record].title;
+        return true;
+    }
+
+    bool find_record(const SegmentSet& set, std::string_view url, size_t& record, Document& doc) {
+        return set.find_record(url, record) && read_record(record, doc);
+    }
+
+    // The text goes in under the same lock, so record and text ids stay
+    // in step.
+    uint32_t append_record(const Document& doc) {
+        std::lock_guard<std::mutex> lock(records_mutex);
+        uint32_t record = static_cast<uint32_t>(documents.size());
+        doc_texts.append(doc.text);
+        Document entry;
+        entry.url = doc.url;
+        entry.title = doc.title;
+        documents.push_back(std::move(entry));
+        return record;
     }
 };
 
-static DocLookup g_doc_lookup;
+// Identifies one version of a file: differs once it is rewritten or
+// another one is renamed over it.
+struct FileStamp {
+    bool exists = false;
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    uint64_t size = 0;
+    int64_t mtime_sec = 0;
+    int64_t mtime_nsec = 0;
+
+    bool operator==(const FileStamp& o) const {
+        return exists == o.exists && device == o.device && inode == o.inode && size == o.size &&
+               mtime_sec == o.mtime_sec && mtime_nsec == o.mtime_nsec;
+    }
+    bool operator!=(const FileStamp& o) const { return !(*this == o); }
+};
+
+// Hot swaps. Dumps are loaded on the reload thread, which is asked for one
+// through POST /api/reload or polls a watched dump, and swapped in whole.
+// Defined before g_corpus so it outlives it: the corpus deleter uses it.
+struct ReloadState {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wanted;
+    bool running;
+    bool stopping;
+    // Dump to load next; empty if none was asked for.
+    std::string pending;
+    // Polled once a second if set. A new dump is loaded once it looked the
+    // same on two polls, so one still being copied in is left alone.
+    std::string watch_path;
+    FileStamp seen;
+    // Swapped-out corpora that no request holds any more.
+    std::vector<Corpus*> retired;
+    std::atomic<bool> loading;
+    std::atomic<size_t> swaps;
+
+    ReloadState() : running(false), stopping(false), loading(false), swaps(0) {}
+};
+
+static ReloadState g_reload;
+static std::string g_spool_path;
+
+// Deleter of every published corpus. The last reference to a swapped-out
+// corpus is usually dropped by a request; destroying it unmaps its image
+// and stops its merge thread, so while the reload thread runs it is
+// handed over to be destroyed there.
+struct CorpusDeleter {
+    void operator()(Corpus* corpus) const {
+        {
+            std::lock_guard<std::mutex> lock(g_reload.mutex);
+            if (g_reload.running) {
+                g_reload.retired.push_back(corpus);
+                corpus = nullptr;
+            }
+        }
+        if (corpus) delete corpus;
+        else g_reload.wanted.notify_one();
+    }
+};
+
+// Read and replaced with the atomic shared_ptr operations only.
+static std::shared_ptr<Corpus> g_corpus;
+
+static std::shared_ptr<Corpus> current_corpus() {
+    return std::atomic_load(&g_corpus);
+}
+
+// Keys carry the generation of the segment set a ranking was computed
+// on, so entries of a replaced segment set are never hit again and age
+// out. A corpus swap drops them all at once.
+static std::unique_ptr<QueryCache> g_query_cache;
+
+static std::mutex g_log_mutex;
 
 void log_msg(const std::string& level, const std::string& msg) {
     auto now = std::chrono::system_clock::now();
@@ -51,6 +177,7 @@ void log_msg(const std::string& level, const std::string& msg) {
     char time_str[32];
     strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm_buf);
     
+    std::lock_guard<std::mutex> lock(g_log_mutex);
     std::cout << "[" << time_str << "."
               << (ms.count() / 100) << (ms.count() / 10 % 10) << (ms.count() % 10)
               << "] [" << level << "] " << msg << std::endl;
@@ -122,8 +249,17 @@ size_t file_size_bytes(const std::string& path) {
     return f.tellg();
 }
 
-static void write_u64(std::ofstream& f, uint64_t v) {
-    f.write(reinterpret_cast<const char*>(&v), 8);
+static FileStamp file_stamp(const std::string& path) {
+    FileStamp stamp;
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) return stamp;
+    stamp.exists = true;
+    stamp.device = st.st_dev;
+    stamp.inode = st.st_ino;
+    stamp.size = st.st_size;
+    stamp.mtime_sec = st.st_mtim.tv_sec;
+    stamp.mtime_nsec = st.st_mtim.tv_nsec;
+    return stamp;
 }
 
 static uint64_t read_u64(std::ifstream& f) {
@@ -132,11 +268,6 @@ static uint64_t read_u64(std::ifstream& f) {
     return v;
 }
 
-static void write_str(std::ofstream& f, const std::string& s) {
-    write_u64(f, s.size());
-    if (!s.empty()) f.write(s.data(), s.size());
-}
-
 static std::string read_str(std::ifstream& f) {
     uint64_t len = read_u64(f);
     if (len == 0) return "";
@@ -150,56 +281,93 @@ bool is_dump_file(const std::string& path) {
     if (!f.good()) return false;
     char magic[8] = {};
     f.read(magic, 8);
-    return std::string(magic, 8) == "IRDUMP01";
+    std::string format(magic, 8);
+    return format == "IRDUMP01" || format == "IRDUMP02";
 }
 
-bool save_dump(const std::string& path) {
+// IRDUMP02 is an index image (see index_image.h). Besides the index's own
+// sections it holds DUMPMETA (record count, total tokens, index time in
+// ms), the record URLs and titles as string tables, the compressed texts
+// (see DocumentStore), DOCRECRD with the record of every index document,
+// and the stem cache as two parallel string tables. The file is written
+// beside the target and renamed over it, so processes still mapping the
+// old dump are not disturbed.
+bool save_dump(Corpus& corpus, const std::string& path) {
     log_msg("INFO", "Saving index dump to: " + path);
     auto t0 = std::chrono::high_resolution_clock::now();
 
-    std::ofstream f(path, std::ios::binary);
-    if (!f.good()) {
-        log_msg("ERROR", "Cannot open dump file for writing: " + path);
+    std::string tmp_path = path + ".tmp";
+    ImageWriter out;
+    if (!out.open(tmp_path, "IRDUMP02")) {
+        log_msg("ERROR", "Cannot open dump file for writing: " + tmp_path);
         return false;
     }
 
-    f.write("IRDUMP01", 8);
+    // The dump holds a single segment without deleted documents. Its
+    // records all exist before the record table is copied; documents
+    // ingested meanwhile only add records no segment refers to. The copy
+    // is the only part done under the record lock, so searches and ingest
+    // carry on while the file is written.
+    std::shared_ptr<const SegmentSet> segments = corpus.segments.force_merge();
+    InvertedIndex empty;
+    const Segment* seg = segments->segments.empty() ? nullptr : &segments->segments[0];
 
-    write_u64(f, g_documents.size());
-    for (size_t i = 0; i < g_documents.size(); ++i) {
-        write_str(f, g_documents[i].url);
-        write_str(f, g_documents[i].title);
-        write_str(f, g_documents[i].text);
+    std::vector<Document> records;
+    uint64_t total_tokens;
+    {
+        std::lock_guard<std::mutex> lock(corpus.records_mutex);
+        records.resize(corpus.documents.size());
+        for (size_t i = 0; i < records.size(); ++i) {
+            records[i].url = corpus.documents[i].url;
+            records[i].title = corpus.documents[i].title;
+        }
+        total_tokens = corpus.total_tokens;
     }
 
-    const auto& idx_docs = g_index.documents();
-    write_u64(f, idx_docs.size());
-    for (size_t i = 0; i < idx_docs.size(); ++i)
-        write_str(f, idx_docs[i]);
+    out.begin("DUMPMETA");
+    out.write_u64(records.size());
+    out.write_u64(total_tokens);
+    out.write_u64(static_cast<uint64_t>(corpus.index_time * 1000));
 
-    write_u64(f, g_index.vocabulary_size());
-    g_index.for_each_term([&f](const std::string& term, const PostingList& pl) {
-        write_str(f, term);
-        write_u64(f, pl.postings.size());
-        for (size_t i = 0; i < pl.postings.size(); ++i) {
-            write_u64(f, pl.postings[i].doc_id);
-            write_u64(f, pl.postings[i].frequency);
-        }
-    });
+    std::vector<std::string_view> strings(records.size());
+    for (size_t i = 0; i < records.size(); ++i)
+        strings[i] = records[i].url;
+    out.write_strings("RECURLS0", strings, false);
+    for (size_t i = 0; i < records.size(); ++i)
+        strings[i] = records[i].title;
+    out.write_strings("RECTITLE", strings, false);
+    if (!corpus.doc_texts.write_image(out, records.size())) {
+        log_msg("ERROR", "Document text spool is incomplete, dump not written");
+        out.finish();
+        std::remove(tmp_path.c_str());
+        return false;
+    }
 
-    write_u64(f, g_zipf.total_terms());
-    write_u64(f, g_zipf.unique_terms());
-    g_zipf.for_each_term_count([&f](const std::string& term, size_t count) {
-        write_str(f, term);
-        write_u64(f, count);
-    });
+    out.begin("DOCRECRD");
+    for (size_t i = 0; seg && i < seg->records->size(); ++i)
+        out.write_u64((*seg->records)[i]);
+
+    (seg ? *seg->index : empty).write_image(out);
 
-    write_u64(f, g_total_tokens);
-    uint64_t time_ms = static_cast<uint64_t>(g_index_time * 1000);
-    write_u64(f, time_ms);
+    // Sorted by word, so the section does not depend on slot layout.
+    std::vector<std::pair<std::string_view, std::string_view>> stem_entries;
+    corpus.stem_cache.for_each([&stem_entries](const std::string& word, const std::string& stem) {
+        stem_entries.emplace_back(word, stem);
+    });
+    std::sort(stem_entries.begin(), stem_entries.end());
+    std::vector<std::string_view> words, stems;
+    for (size_t i = 0; i < stem_entries.size(); ++i) {
+        words.push_back(stem_entries[i].first);
+        stems.push_back(stem_entries[i].second);
+    }
+    out.write_strings("STEMWORD", words, false);
+    out.write_strings("STEMSTEM", stems, false);
 
-    f.write("IREND000", 8);
-    f.close();
+    if (!out.finish() || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        log_msg("ERROR", "Cannot write dump file: " + path);
+        std::remove(tmp_path.c_str());
+        return false;
+    }
 
     auto t1 = std::chrono::high_resolution_clock::now();
     auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
@@ -210,86 +378,333 @@ bool save_dump(const std::string& path) {
     return true;
 }
 
-bool load_dump(const std::string& path) {
-    log_msg("INFO", "Loading index dump from: " + path);
-    auto t0 = std::chrono::high_resolution_clock::now();
+// Maps an IRDUMP02 dump and serves from it. Only the record URLs and
+// titles, document lengths, the record table and the stem cache are
+// copied out; postings, vocabulary and compressed texts stay in the
+// mapping.
+static bool load_image(Corpus& corpus, const std::string& path) {
+    std::unique_ptr<MappedImage> image(new MappedImage());
+    if (!image->open(path, "IRDUMP02")) {
+        log_msg("ERROR", "Cannot map dump file: " + path);
+        return false;
+    }
 
-    std::ifstream f(path, std::ios::binary);
-    if (!f.good()) {
-        log_msg("ERROR", "Cannot open dump file: " + path);
+    size_t meta_count = 0, num_records = 0;
+    const uint64_t* meta = image->array<uint64_t>("DUMPMETA", meta_count);
+    const uint64_t* doc_records = image->array<uint64_t>("DOCRECRD", num_records);
+    StringTable urls, titles, words, stems;
+    if (!meta || meta_count < 3 || !doc_records ||
+        !urls.attach(*image, "RECURLS0") || !titles.attach(*image, "RECTITLE") ||
+        urls.size() != meta[0] || titles.size() != meta[0] ||
+        !words.attach(*image, "STEMWORD") || !stems.attach(*image, "STEMSTEM") ||
+        words.size() != stems.size()) {
+        log_msg("ERROR", "Invalid dump file format");
         return false;
     }
 
-    char magic[8] = {};
-    f.read(magic, 8);
-    if (std::string(magic, 8) != "IRDUMP01") {
+    corpus.segments.clear();
+    corpus.doc_texts.clear();
+    corpus.image.reset();
+    std::shared_ptr<InvertedIndex> index = std::make_shared<InvertedIndex>();
+    if (!index->attach_image(*image) || !corpus.doc_texts.attach_image(*image) ||
+        corpus.doc_texts.size() != meta[0] || num_records != index->document_count()) {
+        corpus.doc_texts.clear();
         log_msg("ERROR", "Invalid dump file format");
         return false;
     }
 
+    corpus.documents.clear();
+    corpus.documents.reserve(urls.size());
+    for (size_t i = 0; i < urls.size(); ++i) {
+        Document doc;
+        doc.url = urls.at(i);
+        doc.title = titles.at(i);
+        corpus.documents.push_back(std::move(doc));
+    }
+    corpus.segments.reset(index, std::vector<uint32_t>(doc_records, doc_records + num_records));
+
+    corpus.stem_cache.clear();
+    for (size_t i = 0; i < words.size(); ++i)
+        corpus.stem_cache.insert(std::string(words.at(i)), std::string(stems.at(i)));
+
+    corpus.total_tokens = meta[1];
+    corpus.index_time = meta[2] / 1000.0;
+    log_msg("INFO", "Mapped " + std::to_string(image->size() / 1024 / 1024) + " MB index image");
+    corpus.image = std::move(image);
+    return true;
+}
+
+// IRDUMP01: a flat stream of length-prefixed fields, rebuilt in memory.
+static bool load_stream(Corpus& corpus, std::ifstream& f) {
     uint64_t num_docs = read_u64(f);
-    g_documents.clear();
-    g_documents.reserve(num_docs);
+    corpus.documents.clear();
+    corpus.documents.reserve(num_docs);
+    corpus.doc_texts.clear();
     for (uint64_t i = 0; i < num_docs; ++i) {
         Document doc;
         doc.url = read_str(f);
         doc.title = read_str(f);
-        doc.text = read_str(f);
-        g_documents.push_back(std::move(doc));
+        corpus.doc_texts.append(read_str(f));
+        corpus.documents.push_back(std::move(doc));
     }
-    log_msg("INFO", "Loaded " + std::to_string(g_documents.size()) + " documents");
+    log_msg("INFO", "Loaded " + std::to_string(corpus.documents.size()) + " documents");
 
-    g_doc_lookup.build(g_documents);
-
-    g_index.clear();
+    corpus.segments.clear();
+    corpus.image.reset();
+    std::shared_ptr<InvertedIndex> index = std::make_shared<InvertedIndex>();
     uint64_t num_idx_docs = read_u64(f);
+    index->reserve_documents(num_idx_docs);
     for (uint64_t i = 0; i < num_idx_docs; ++i)
-        g_index.add_document_name(read_str(f));
+        index->add_document_name(read_str(f));
 
     uint64_t num_terms = read_u64(f);
-    g_index.reserve_vocabulary(num_terms);
+    index->reserve_vocabulary(num_terms);
     for (uint64_t i = 0; i < num_terms; ++i) {
         std::string term = read_str(f);
         uint64_t num_postings = read_u64(f);
         PostingList pl;
-        pl.postings.reserve(num_postings);
         for (uint64_t j = 0; j < num_postings; ++j) {
             uint64_t doc_id = read_u64(f);
             uint64_t freq = read_u64(f);
-            pl.postings.push_back(Posting(doc_id, freq));
+            pl.add(doc_id, freq);
         }
-        g_index.insert_posting_list(term, pl);
+        index->insert_posting_list(term, std::move(pl));
     }
-    log_msg("INFO", "Loaded " + std::to_string(g_index.vocabulary_size()) + " terms");
+    index->finalize();
+    log_msg("INFO", "Loaded " + std::to_string(index->vocabulary_size()) + " terms");
 
-    g_zipf.clear();
-    uint64_t total_terms = read_u64(f);
-    uint64_t unique_terms = read_u64(f);
-    g_zipf.set_total_terms(total_terms);
-    g_zipf.reserve(unique_terms);
-    for (uint64_t i = 0; i < unique_terms; ++i) {
-        std::string term = read_str(f);
-        uint64_t count = read_u64(f);
-        g_zipf.insert_term_count(term, count);
+    read_u64(f);
+    uint64_t zipf_terms = read_u64(f);
+    for (uint64_t i = 0; i < zipf_terms; ++i) {
+        f.seekg(read_u64(f), std::ios::cur);
+        read_u64(f);
     }
 
-    g_total_tokens = read_u64(f);
+    corpus.total_tokens = read_u64(f);
     uint64_t time_ms = read_u64(f);
-    g_index_time = time_ms / 1000.0;
+    corpus.index_time = time_ms / 1000.0;
+
+    // Optional sections follow, each tagged, until IREND000.
+    bool has_lengths = false;
+    corpus.stem_cache.clear();
+    while (true) {
+        char section[8] = {};
+        f.read(section, 8);
+        if (!f.good()) break;
+        std::string tag(section, 8);
+        if (tag == "IRLEN001") {
+            uint64_t num_lengths = read_u64(f);
+            for (uint64_t i = 0; i < num_lengths; ++i)
+                index->add_doc_length(i, read_u64(f));
+            index->compute_statistics();
+            has_lengths = true;
+        } else if (tag == "IRSTM001") {
+            uint64_t num_stems = read_u64(f);
+            for (uint64_t i = 0; i < num_stems; ++i) {
+                std::string word = read_str(f);
+                corpus.stem_cache.insert(word, read_str(f));
+            }
+        } else {
+            break;
+        }
+    }
+    if (!has_lengths) {
+        log_msg("INFO", "Dump has no document lengths, recounting from postings");
+        index->recount_doc_lengths();
+    }
+    corpus.segments.reset(index, corpus.doc_records(*index));
+
+    return true;
+}
 
-    f.close();
+bool load_dump(Corpus& corpus, const std::string& path) {
+    log_msg("INFO", "Loading index dump from: " + path);
+    auto t0 = std::chrono::high_resolution_clock::now();
+
+    std::ifstream f(path, std::ios::binary);
+    if (!f.good()) {
+        log_msg("ERROR", "Cannot open dump file: " + path);
+        return false;
+    }
+
+    char magic[8] = {};
+    f.read(magic, 8);
+    std::string format(magic, 8);
+    bool ok = false;
+    if (format == "IRDUMP02") {
+        f.close();
+        ok = load_image(corpus, path);
+    } else if (format == "IRDUMP01") {
+        ok = load_stream(corpus, f);
+    } else {
+        log_msg("ERROR", "Invalid dump file format");
+    }
+    if (!ok) return false;
 
     auto t1 = std::chrono::high_resolution_clock::now();
     auto load_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
 
     log_msg("INFO", "Dump loaded in " + std::to_string(load_ms / 1000.0) + "s");
-    log_msg("INFO", "Documents: " + std::to_string(g_documents.size()));
-    log_msg("INFO", "Vocabulary: " + std::to_string(g_index.vocabulary_size()));
-    log_msg("INFO", "Total tokens: " + std::to_string(g_total_tokens));
+    std::shared_ptr<const SegmentSet> segments = corpus.segments.snapshot();
+    log_msg("INFO", "Documents: " + std::to_string(corpus.documents.size()));
+    log_msg("INFO", "Vocabulary: " + std::to_string(segments->vocabulary_size()));
+    log_msg("INFO", "Postings memory: " + std::to_string(segments->postings_memory() / 1024) + " KB");
+    log_msg("INFO", "Cached stems: " + std::to_string(corpus.stem_cache.size()));
+    log_msg("INFO", "Total tokens: " + std::to_string(corpus.total_tokens));
     return true;
 }
 
-void build_index(const std::string& input_file, const std::string& input_file2 = "") {
+struct PendingDoc {
+    size_t seq;
+    size_t doc_id;
+    std::string text;
+
+    PendingDoc() : seq(0), doc_id(0) {}
+};
+
+struct IndexShard {
+    InvertedIndex* index;
+    std::unique_ptr<InvertedIndex> own_index;
+    bool track_terms;
+    // Sequence number of the document each term id first appeared in.
+    std::vector<size_t> term_seqs;
+    StemCache stems;
+
+    IndexShard() : index(nullptr), track_terms(false) {}
+};
+
+struct BuildProgress {
+    std::atomic<size_t> indexed;
+    std::atomic<size_t> tokens;
+    std::atomic<size_t> bytes_read;
+    size_t total_bytes;
+    std::chrono::high_resolution_clock::time_point start_time;
+
+    BuildProgress() : indexed(0), tokens(0), bytes_read(0), total_bytes(0) {}
+};
+
+static void index_worker(BoundedQueue<PendingDoc>& queue, IndexShard& shard, BuildProgress& progress) {
+    Tokenizer tokenizer;
+    std::string token_arena;
+    std::vector<TokenView> tokens;
+    std::vector<uint32_t> term_ids;
+    PendingDoc doc;
+
+    while (queue.pop(doc)) {
+        tokenizer.tokenize(doc.text, token_arena, tokens);
+        progress.tokens += tokens.size();
+
+        term_ids.clear();
+        for (size_t j = 0; j < tokens.size(); ++j) {
+            uint32_t id = shard.index->intern_term(shard.stems.stem(tokens[j].text));
+            if (shard.track_terms && id == shard.term_seqs.size())
+                shard.term_seqs.push_back(doc.seq);
+            term_ids.push_back(id);
+        }
+
+        shard.index->add_postings(doc.doc_id, term_ids);
+
+        size_t n = progress.indexed.fetch_add(1) + 1;
+        if (n % 500 == 0) {
+            auto now = std::chrono::high_resolution_clock::now();
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - progress.start_time).count();
+            double speed = n * 1000.0 / (elapsed > 0 ? elapsed : 1);
+
+            log_msg("INFO", "Indexed " + std::to_string(n) + " docs ("
+                    + std::to_string((int)speed) + " docs/s"
+                    + ", read " + std::to_string(progress.bytes_read / 1024 / 1024) + "/"
+                    + std::to_string(progress.total_bytes / 1024 / 1024) + " MB"
+                    + ", tokens so far: " + std::to_string(progress.tokens) + ")");
+        }
+    }
+    shard.index->finalize();
+}
+
+// Runs on the reader thread. Doc ids are assigned here, in corpus order,
+// which only touches the document table of the index; the worker only
+// touches its term map.
+static size_t stream_corpus(Corpus& corpus, const std::string& path, InvertedIndex& index, BoundedQueue<PendingDoc>& queue,
+                            size_t& next_seq, BuildProgress& progress) {
+    NdjsonStream stream(path);
+    size_t bytes_before = progress.bytes_read;
+    size_t count = 0;
+
+    Document doc;
+    while (stream.next(doc)) {
+        PendingDoc pending;
+        pending.seq = next_seq++;
+        pending.doc_id = index.get_doc_index(doc.url);
+        corpus.doc_texts.append(doc.text);
+        pending.text = std::move(doc.text);
+
+        Document record;
+        record.url = std::move(doc.url);
+        record.title = std::move(doc.title);
+        corpus.documents.push_back(std::move(record));
+
+        progress.bytes_read = bytes_before + stream.bytes_read();
+        queue.push(std::move(pending));
+        ++count;
+    }
+    return count;
+}
+
+// Workers pull documents from a FIFO queue, so every shard sees its
+// documents in corpus order and its term ids follow first occurrence.
+// Interning shard vocabularies by the sequence number of their first
+// occurrence reproduces the term ids of a single-threaded build, which
+// keeps the dump identical.
+static void merge_shards(InvertedIndex& index, std::vector<std::unique_ptr<IndexShard>>& shards,
+                         size_t num_threads) {
+    // local_ids[s][g] is shard s's id for global term g, or NONE.
+    std::vector<std::vector<uint32_t>> local_ids(shards.size());
+    std::vector<size_t> pos(shards.size(), 0);
+    while (true) {
+        size_t best = shards.size();
+        for (size_t s = 0; s < shards.size(); ++s) {
+            if (pos[s] >= shards[s]->term_seqs.size()) continue;
+            if (best == shards.size() || shards[s]->term_seqs[pos[s]] < shards[best]->term_seqs[pos[best]])
+                best = s;
+        }
+        if (best == shards.size()) break;
+        uint32_t local = static_cast<uint32_t>(pos[best]++);
+        uint32_t global = index.intern_term(shards[best]->index->term(local));
+        std::vector<uint32_t>& ids = local_ids[best];
+        if (ids.size() <= global) ids.resize(global + 1, TermDictionary::NONE);
+        ids[global] = local;
+    }
+    size_t vocabulary = index.vocabulary_size();
+    for (size_t s = 0; s < shards.size(); ++s)
+        local_ids[s].resize(vocabulary, TermDictionary::NONE);
+
+    const size_t chunk = 64;
+    std::atomic<size_t> next_term(0);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < num_threads; ++t) {
+        workers.emplace_back([&index, &shards, &local_ids, &next_term, vocabulary, chunk]() {
+            while (true) {
+                size_t from = next_term.fetch_add(chunk);
+                if (from >= vocabulary) break;
+                size_t to = from + chunk < vocabulary ? from + chunk : vocabulary;
+                for (size_t g = from; g < to; ++g) {
+                    PostingList& dst = index.posting_list(static_cast<uint32_t>(g));
+                    for (size_t s = 0; s < shards.size(); ++s) {
+                        uint32_t local = local_ids[s][g];
+                        if (local != TermDictionary::NONE)
+                            dst.merge_from(shards[s]->index->posting_list(local));
+                    }
+                }
+            }
+        });
+    }
+    for (size_t t = 0; t < workers.size(); ++t)
+        workers[t].join();
+    for (size_t s = 0; s < shards.size(); ++s)
+        index.merge_doc_lengths(*shards[s]->index);
+}
+
+void build_index(Corpus& corpus, const std::string& input_file, const std::string& input_file2 = "",
+                 size_t num_threads = 1) {
     log_msg("INFO", "============================================================");
     log_msg("INFO", "SEARCH ENGINE - Starting up");
     log_msg("INFO", "============================================================");
@@ -304,100 +719,347 @@ void build_index(const std::string& input_file, const std::string& input_file2 =
         return;
     }
     
+    bool has_input2 = !input_file2.empty() && file_exists(input_file2);
     size_t corpus_bytes = file_size_bytes(input_file);
     log_msg("INFO", "Corpus file size: " + std::to_string(corpus_bytes / 1024 / 1024) + " MB (" + std::to_string(corpus_bytes) + " bytes)");
     
-    log_msg("INFO", "Loading documents from: " + input_file);
-    auto load_start = std::chrono::high_resolution_clock::now();
-    
-    g_documents = NdjsonReader::load(input_file);
+    BuildProgress progress;
+    progress.total_bytes = corpus_bytes + (has_input2 ? file_size_bytes(input_file2) : 0);
     
-    if (!input_file2.empty() && file_exists(input_file2)) {
-        auto docs2 = NdjsonReader::load(input_file2);
-        log_msg("INFO", "Loaded " + std::to_string(docs2.size()) + " documents from " + input_file2);
-        for (size_t i = 0; i < docs2.size(); ++i)
-            g_documents.push_back(std::move(docs2[i]));
-    }
-    
-    auto load_end = std::chrono::high_resolution_clock::now();
-    auto load_ms = std::chrono::duration_cast<std::chrono::milliseconds>(load_end - load_start).count();
-    
-    if (g_documents.empty()) {
-        log_msg("ERROR", "No documents loaded! File might be empty or malformed.");
-        return;
+    std::shared_ptr<InvertedIndex> index = std::make_shared<InvertedIndex>();
+    std::vector<std::unique_ptr<IndexShard>> shards;
+    for (size_t t = 0; t < num_threads; ++t) {
+        std::unique_ptr<IndexShard> shard(new IndexShard());
+        if (num_threads == 1) {
+            shard->index = index.get();
+        } else {
+            shard->own_index.reset(new InvertedIndex());
+            shard->index = shard->own_index.get();
+            shard->track_terms = true;
+        }
+        shards.push_back(std::move(shard));
     }
     
-    log_msg("INFO", "Loaded " + std::to_string(g_documents.size()) + " documents total in " + std::to_string(load_ms / 1000.0) + "s");
-    log_msg("INFO", "First document: " + g_documents[0].title + " (" + g_documents[0].url + ")");
-    log_msg("INFO", "First doc text length: " + std::to_string(g_documents[0].text.size()) + " chars");
-    
-    log_msg("INFO", "Building document lookup table...");
-    g_doc_lookup.build(g_documents);
-    log_msg("INFO", "Lookup table ready");
-    
-    Tokenizer tokenizer;
-    PorterStemmer stemmer;
-    
     log_msg("INFO", "------------------------------------------------------------");
-    log_msg("INFO", "Starting indexing pipeline...");
+    log_msg("INFO", "Starting indexing pipeline (" + std::to_string(num_threads) + " threads)...");
     log_msg("INFO", "------------------------------------------------------------");
     
     auto start_time = std::chrono::high_resolution_clock::now();
-    g_total_tokens = 0;
+    progress.start_time = start_time;
+    corpus.segments.clear();
+    corpus.documents.clear();
+    corpus.doc_texts.clear();
     
-    for (size_t i = 0; i < g_documents.size(); ++i) {
-        const auto& doc = g_documents[i];
-        auto tokens = tokenizer.tokenize(doc.text);
-        g_total_tokens += tokens.size();
-        
-        std::vector<std::string> stemmed_terms;
-        for (size_t j = 0; j < tokens.size(); ++j) {
-            std::string stem = stemmer.stem(tokens[j].text);
-            stemmed_terms.push_back(stem);
-            g_zipf.add_term(stem);
-        }
-        
-        g_index.add_document(doc.url, stemmed_terms);
-        
-        if ((i + 1) % 500 == 0) {
-            auto now = std::chrono::high_resolution_clock::now();
-            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time).count();
-            double speed = (i + 1) * 1000.0 / elapsed;
-            double eta = (g_documents.size() - i - 1) / speed;
-            
-            log_msg("INFO", "Indexed " + std::to_string(i + 1) + "/" + std::to_string(g_documents.size())
-                    + " docs (" + std::to_string((int)speed) + " docs/s"
-                    + ", ETA: " + std::to_string((int)eta) + "s"
-                    + ", tokens so far: " + std::to_string(g_total_tokens)
-                    + ", vocab: " + std::to_string(g_index.vocabulary_size()) + ")");
-        }
+    BoundedQueue<PendingDoc> queue(64 * num_threads);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < shards.size(); ++t)
+        workers.emplace_back(index_worker, std::ref(queue), std::ref(*shards[t]), std::ref(progress));
+    
+    log_msg("INFO", "Streaming documents from: " + input_file);
+    size_t next_seq = 0;
+    stream_corpus(corpus, input_file, *index, queue, next_seq, progress);
+    if (has_input2) {
+        size_t count2 = stream_corpus(corpus, input_file2, *index, queue, next_seq, progress);
+        log_msg("INFO", "Read " + std::to_string(count2) + " documents from " + input_file2);
+    }
+    queue.close();
+    for (size_t t = 0; t < workers.size(); ++t)
+        workers[t].join();
+    if (!corpus.doc_texts.good())
+        log_msg("ERROR", "Cannot write the document text spool, some texts will read back empty");
+    
+    if (shards.size() > 1) {
+        log_msg("INFO", "Merging " + std::to_string(shards.size()) + " shards...");
+        merge_shards(*index, shards, num_threads);
+        index->finalize();
+    }
+    // Slots depend on insertion order, and which shard saw a word first
+    // depends on scheduling, so the entries go in sorted by word.
+    size_t stem_hits = 0, stem_misses = 0;
+    std::vector<std::pair<std::string, std::string>> stem_entries;
+    for (size_t t = 0; t < shards.size(); ++t) {
+        const StemCache& stems = shards[t]->stems;
+        stem_hits += stems.hits();
+        stem_misses += stems.misses();
+        stems.for_each([&stem_entries](const std::string& word, const std::string& stem) {
+            stem_entries.emplace_back(word, stem);
+        });
     }
+    std::sort(stem_entries.begin(), stem_entries.end());
+    corpus.stem_cache.clear();
+    for (size_t i = 0; i < stem_entries.size(); ++i)
+        if (i == 0 || stem_entries[i].first != stem_entries[i - 1].first)
+            corpus.stem_cache.insert(stem_entries[i].first, stem_entries[i].second);
+    shards.clear();
+    corpus.total_tokens = progress.tokens.load();
     
     auto end_time = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
-    g_index_time = duration.count() / 1000.0;
+    corpus.index_time = duration.count() / 1000.0;
+    corpus.segments.reset(index, corpus.doc_records(*index));
+    
+    if (corpus.documents.empty()) {
+        log_msg("ERROR", "No documents loaded! File might be empty or malformed.");
+        return;
+    }
+    
+    log_msg("INFO", "Read " + std::to_string(corpus.documents.size()) + " documents total");
+    log_msg("INFO", "First document: " + corpus.documents[0].title + " (" + corpus.documents[0].url + ")");
+    log_msg("INFO", "First doc text length: " + std::to_string(corpus.doc_texts.text_size(0)) + " chars");
     
     log_msg("INFO", "============================================================");
     log_msg("INFO", "INDEXING COMPLETE");
     log_msg("INFO", "============================================================");
-    log_msg("INFO", "Documents indexed:  " + std::to_string(g_index.document_count()));
-    log_msg("INFO", "Vocabulary size:    " + std::to_string(g_index.vocabulary_size()));
-    log_msg("INFO", "Total tokens:       " + std::to_string(g_total_tokens));
-    log_msg("INFO", "Processing time:    " + std::to_string(g_index_time) + " seconds");
-    log_msg("INFO", "Speed:              " + std::to_string((int)(g_documents.size() / g_index_time)) + " docs/sec");
+    log_msg("INFO", "Documents indexed:  " + std::to_string(index->document_count()));
+    log_msg("INFO", "Vocabulary size:    " + std::to_string(index->vocabulary_size()));
+    log_msg("INFO", "Postings memory:    " + std::to_string(index->postings_memory() / 1024) + " KB");
+    log_msg("INFO", "Total tokens:       " + std::to_string(corpus.total_tokens));
+    log_msg("INFO", "Stem cache hits:    " + std::to_string(stem_hits) + "/" + std::to_string(stem_hits + stem_misses)
+            + " (" + std::to_string(stem_hits + stem_misses ? 100 * stem_hits / (stem_hits + stem_misses) : 0) + "%)");
+    log_msg("INFO", "Processing time:    " + std::to_string(corpus.index_time) + " seconds");
+    log_msg("INFO", "Speed:              " + std::to_string((int)(corpus.documents.size() / corpus.index_time)) + " docs/sec");
     
-    g_zipf.print_stats();
+    ZipfAnalyzer(*corpus.segments.snapshot()).print_stats();
     std::cout.flush();
     
     log_msg("INFO", "Index built in memory, ready to serve");
 }
 
+// Tokenizes and stems documents into a corpus's segment buffer after
+// appending their records. One per thread.
+struct LiveIndexer {
+    Tokenizer tokenizer;
+    StemCache stems;
+    std::string token_arena;
+    std::vector<TokenView> tokens;
+    std::vector<std::string> terms;
+
+    LiveIndexer() : stems(4096) {}
+
+    void add(Corpus& corpus, const Document& doc) {
+        tokenizer.tokenize(doc.text, token_arena, tokens);
+        terms.clear();
+        for (size_t j = 0; j < tokens.size(); ++j) {
+            const std::string* cached = corpus.stem_cache.find(tokens[j].text);
+            terms.push_back(cached ? *cached : stems.stem(tokens[j].text));
+        }
+        uint32_t record = corpus.append_record(doc);
+        corpus.segments.add_document(doc.url, record, terms);
+        corpus.total_tokens += tokens.size();
+    }
+};
+
+// Indexes an NDJSON file into a new segment and publishes it. URLs that
+// are already indexed count as re-crawled: the old copy stops matching in
+// the same publish. Records of replaced documents stay in the corpus
+// until the next rebuild.
+static size_t add_documents(Corpus& corpus, const std::string& path) {
+    NdjsonStream stream(path);
+    if (!stream.is_open()) return 0;
+    LiveIndexer indexer;
+    size_t count = 0;
+
+    Document doc;
+    while (stream.next(doc)) {
+        indexer.add(corpus, doc);
+        ++count;
+    }
+    corpus.segments.refresh();
+    return count;
+}
+
+// Documents posted to /api/ingest. Request threads hand them to one
+// bounded queue per worker, chosen by URL so the versions of a page are
+// indexed in the order they arrived; workers buffer them in the current
+// corpus and the refresher publishes its buffer every refresh_ms. Readers
+// only ever see published segment sets, so ingestion never blocks a search.
+struct IngestState {
+    std::vector<std::unique_ptr<BoundedQueue<Document>>> queues;
+    std::vector<std::thread> workers;
+    std::thread refresher;
+    size_t refresh_ms;
+    std::mutex mutex;
+    std::condition_variable stop_wanted;
+    bool stopping;
+    std::atomic<size_t> indexed;
+    std::atomic<size_t> refused;
+
+    IngestState() : refresh_ms(0), stopping(false), indexed(0), refused(0) {}
+};
+
+static IngestState g_ingest;
+
+static void ingest_worker(BoundedQueue<Document>* queue) {
+    LiveIndexer indexer;
+    Document doc;
+    while (queue->pop(doc)) {
+        indexer.add(*current_corpus(), doc);
+        ++g_ingest.indexed;
+    }
+}
+
+static void ingest_refresher() {
+    std::unique_lock<std::mutex> lock(g_ingest.mutex);
+    while (!g_ingest.stopping) {
+        g_ingest.stop_wanted.wait_for(lock, std::chrono::milliseconds(g_ingest.refresh_ms));
+        lock.unlock();
+        current_corpus()->segments.refresh();
+        lock.lock();
+    }
+}
+
+static void start_ingest(size_t workers, size_t queue_capacity, size_t refresh_ms) {
+    g_ingest.refresh_ms = refresh_ms;
+    for (size_t t = 0; t < workers; ++t)
+        g_ingest.queues.emplace_back(new BoundedQueue<Document>(queue_capacity));
+    for (size_t t = 0; t < workers; ++t)
+        g_ingest.workers.emplace_back(ingest_worker, g_ingest.queues[t].get());
+    g_ingest.refresher = std::thread(ingest_refresher);
+}
+
+// Drains the queues and publishes what they held.
+static void stop_ingest() {
+    for (size_t t = 0; t < g_ingest.queues.size(); ++t)
+        g_ingest.queues[t]->close();
+    for (size_t t = 0; t < g_ingest.workers.size(); ++t)
+        g_ingest.workers[t].join();
+    {
+        std::lock_guard<std::mutex> lock(g_ingest.mutex);
+        g_ingest.stopping = true;
+    }
+    g_ingest.stop_wanted.notify_one();
+    if (g_ingest.refresher.joinable()) g_ingest.refresher.join();
+    current_corpus()->segments.refresh();
+}
+
+// Queues documents in order without waiting and stops at the first one
+// whose queue is full; returns how many were queued.
+static size_t submit_ingest(std::vector<Document>& docs) {
+    std::hash<std::string> hash;
+    size_t n = 0;
+    for (; n < docs.size(); ++n) {
+        BoundedQueue<Document>& queue = *g_ingest.queues[hash(docs[n].url) % g_ingest.queues.size()];
+        if (!queue.try_push(docs[n])) break;
+    }
+    g_ingest.refused += docs.size() - n;
+    return n;
+}
+
+static size_t ingest_queued() {
+    size_t n = 0;
+    for (size_t t = 0; t < g_ingest.queues.size(); ++t)
+        n += g_ingest.queues[t]->size();
+    return n;
+}
+
+// Requests that took the old corpus before the exchange finish on it; the
+// last one to let go hands it back to this thread through CorpusDeleter.
+// Documents ingested into the old corpus after the dump was written are
+// not carried over.
+static bool swap_corpus(const std::string& path) {
+    g_reload.loading = true;
+    std::shared_ptr<Corpus> fresh(new Corpus, CorpusDeleter());
+    bool ok = is_dump_file(path) && fresh->doc_texts.open(g_spool_path) && load_dump(*fresh, path);
+    g_reload.loading = false;
+    if (!ok) {
+        log_msg("ERROR", "Reload of " + path + " failed, still serving the previous index");
+        return false;
+    }
+    std::atomic_exchange(&g_corpus, std::move(fresh));
+    g_query_cache->clear();
+    ++g_reload.swaps;
+    log_msg("INFO", "Swapped in index from " + path);
+    return true;
+}
+
+// Callers hold lock on g_reload.mutex; it is released while destroying.
+static void destroy_retired(std::unique_lock<std::mutex>& lock) {
+    std::vector<Corpus*> retired;
+    retired.swap(g_reload.retired);
+    lock.unlock();
+    for (size_t i = 0; i < retired.size(); ++i)
+        delete retired[i];
+    if (!retired.empty()) log_msg("INFO", "Released previous index");
+    lock.lock();
+}
+
+static void reload_loop() {
+    FileStamp candidate;
+    std::unique_lock<std::mutex> lock(g_reload.mutex);
+    while (!g_reload.stopping) {
+        if (!g_reload.retired.empty()) {
+            destroy_retired(lock);
+            continue;
+        }
+        if (g_reload.pending.empty()) {
+            if (g_reload.watch_path.empty()) {
+                g_reload.wanted.wait(lock);
+                continue;
+            }
+            g_reload.wanted.wait_for(lock, std::chrono::seconds(1));
+            if (g_reload.stopping || !g_reload.pending.empty() || !g_reload.retired.empty()) continue;
+            FileStamp stamp = file_stamp(g_reload.watch_path);
+            bool stable = stamp == candidate;
+            candidate = stamp;
+            if (!stamp.exists || stamp == g_reload.seen || !stable) continue;
+            g_reload.seen = stamp;
+            g_reload.pending = g_reload.watch_path;
+        }
+        std::string path;
+        path.swap(g_reload.pending);
+        lock.unlock();
+        swap_corpus(path);
+        lock.lock();
+    }
+}
+
+static void start_reload(const std::string& watch_path) {
+    {
+        std::lock_guard<std::mutex> lock(g_reload.mutex);
+        g_reload.watch_path = watch_path;
+        if (!watch_path.empty()) g_reload.seen = file_stamp(watch_path);
+        g_reload.running = true;
+    }
+    g_reload.thread = std::thread(reload_loop);
+}
+
+// Corpora released from here on are destroyed by whoever lets go last.
+static void stop_reload() {
+    {
+        std::lock_guard<std::mutex> lock(g_reload.mutex);
+        g_reload.stopping = true;
+        g_reload.running = false;
+    }
+    g_reload.wanted.notify_one();
+    if (g_reload.thread.joinable()) g_reload.thread.join();
+    std::unique_lock<std::mutex> lock(g_reload.mutex);
+    destroy_retired(lock);
+}
+
+// A later request replaces one that has not started loading yet.
+static void request_reload(const std::string& path) {
+    {
+        std::lock_guard<std::mutex> lock(g_reload.mutex);
+        g_reload.pending = path;
+    }
+    g_reload.wanted.notify_one();
+}
+
+// A dump this process wrote itself holds nothing new for the watcher.
+static void note_own_dump(const std::string& path) {
+    std::lock_guard<std::mutex> lock(g_reload.mutex);
+    if (path == g_reload.watch_path) g_reload.seen = file_stamp(path);
+}
+
 void print_cli_help() {
     std::cout << "\nCommands:\n"
               << "  <query>           Search (supports &&, ||, !, parentheses)\n"
               << "  :stats            Show index statistics\n"
               << "  :zipf [N]         Show top N terms (default 20)\n"
               << "  :dump [path]      Save index dump\n"
+              << "  :add <file>       Index or re-crawl the documents of an NDJSON file\n"
+              << "  :delete <url>     Remove a document\n"
+              << "  :rank tfidf|bm25  Choose the ranking function\n"
               << "  :help             Show this help\n"
               << "  :quit             Exit\n\n"
               << "Examples:\n"
@@ -408,11 +1070,20 @@ void print_cli_help() {
               << std::endl;
 }
 
+static bool parse_ranking(const std::string& name, Ranking& ranking) {
+    if (name == "tfidf") ranking = Ranking::TFIDF;
+    else if (name == "bm25") ranking = Ranking::BM25;
+    else return false;
+    return true;
+}
+
 void run_cli(const std::string& dump_path) {
-    BooleanSearch search(g_index);
+    Ranking ranking = Ranking::TFIDF;
     
-    std::cout << "\nSearch engine ready. " << g_index.document_count()
-              << " documents, " << g_index.vocabulary_size() << " terms.\n";
+    std::shared_ptr<Corpus> corpus = current_corpus();
+    std::shared_ptr<const SegmentSet> segments = corpus->segments.snapshot();
+    std::cout << "\nSearch engine ready. " << segments->live_document_count()
+              << " documents, " << segments->vocabulary_size() << " terms.\n";
     print_cli_help();
     
     std::string user_query;
@@ -422,6 +1093,8 @@ void run_cli(const std::string& dump_path) {
         if (!std::getline(std::cin, user_query)) break;
         
         if (user_query.empty()) continue;
+        corpus = current_corpus();
+        segments = corpus->segments.snapshot();
         if (user_query == ":quit" || user_query == ":exit" || user_query == "quit" || user_query == "exit") break;
 
         if (user_query == ":help") {
@@ -431,11 +1104,12 @@ void run_cli(const std::string& dump_path) {
 
         if (user_query == ":stats") {
             std::cout << "\n=== Index Statistics ===\n"
-                      << "Documents:     " << g_index.document_count() << "\n"
-                      << "Vocabulary:    " << g_index.vocabulary_size() << "\n"
-                      << "Total tokens:  " << g_total_tokens << "\n"
-                      << "Unique terms:  " << g_zipf.unique_terms() << "\n"
-                      << "Index time:    " << std::fixed << std::setprecision(1) << g_index_time << "s\n"
+                      << "Documents:     " << segments->live_document_count() << "\n"
+                      << "Vocabulary:    " << segments->vocabulary_size() << "\n"
+                      << "Segments:      " << segments->segments.size() << "\n"
+                      << "Total tokens:  " << corpus->total_tokens << "\n"
+                      << "Unique terms:  " << ZipfAnalyzer(*segments).unique_terms() << "\n"
+                      << "Index time:    " << std::fixed << std::setprecision(1) << corpus->index_time << "s\n"
                       << std::endl;
             continue;
         }
@@ -446,7 +1120,7 @@ void run_cli(const std::string& dump_path) {
                 std::string arg = user_query.substr(6);
                 if (!arg.empty()) n = std::stoi(arg);
             }
-            auto terms = g_zipf.get_sorted_terms();
+            auto terms = ZipfAnalyzer(*segments).get_sorted_terms();
             size_t count = terms.size() < static_cast<size_t>(n) ? terms.size() : static_cast<size_t>(n);
             std::cout << "\nTop " << count << " terms:\n";
             for (size_t i = 0; i < count; ++i) {
@@ -458,18 +1132,49 @@ void run_cli(const std::string& dump_path) {
             continue;
         }
 
+        if (user_query.substr(0, 5) == ":rank") {
+            std::string name = user_query.size() > 6 ? user_query.substr(6) : "";
+            if (parse_ranking(name, ranking))
+                std::cout << "Ranking: " << name << "\n" << std::endl;
+            else
+                std::cout << "Usage: :rank tfidf|bm25\n" << std::endl;
+            continue;
+        }
+
         if (user_query.substr(0, 5) == ":dump") {
             std::string path = dump_path;
             if (user_query.size() > 6) {
                 path = user_query.substr(6);
                 while (!path.empty() && path[0] == ' ') path = path.substr(1);
             }
-            save_dump(path);
+            save_dump(*corpus, path);
+            continue;
+        }
+
+        if (user_query.substr(0, 4) == ":add") {
+            std::string path = user_query.size() > 5 ? user_query.substr(5) : "";
+            if (path.empty() || !file_exists(path)) {
+                std::cout << "Usage: :add <ndjson file>\n" << std::endl;
+                continue;
+            }
+            auto t0 = std::chrono::high_resolution_clock::now();
+            size_t count = add_documents(*corpus, path);
+            auto t1 = std::chrono::high_resolution_clock::now();
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+            std::cout << "Indexed " << count << " documents in " << ms << " ms, "
+                      << corpus->segments.snapshot()->segments.size() << " segments\n" << std::endl;
+            continue;
+        }
+
+        if (user_query.substr(0, 7) == ":delete") {
+            std::string url = user_query.size() > 8 ? user_query.substr(8) : "";
+            std::cout << (corpus->segments.remove(url) ? "Deleted " : "Not found: ") << url << "\n" << std::endl;
             continue;
         }
 
+        BooleanSearch search(*segments, &corpus->stem_cache);
         auto t0 = std::chrono::high_resolution_clock::now();
-        auto results = search.search(user_query, 50);
+        auto results = search.search(user_query, 50, nullptr, ranking);
         auto t1 = std::chrono::high_resolution_clock::now();
         auto search_us = std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
         
@@ -478,11 +1183,12 @@ void run_cli(const std::string& dump_path) {
         
         size_t show = results.size() < 10 ? results.size() : 10;
         for (size_t i = 0; i < show; ++i) {
-            const Document* doc = g_doc_lookup.find(results[i].doc_id);
-            std::string title = doc ? doc->title : "";
+            size_t rec = 0;
+            Document entry;
+            std::string title = corpus->find_record(*segments, results[i].doc_id, rec, entry) ? entry.title : "";
             std::cout << "  " << (i + 1) << ". " << title << "\n"
                       << "     " << results[i].doc_id << "\n"
-                      << "     TF-IDF: " << std::fixed << std::setprecision(2) << results[i].score << "\n"
+                      << (ranking == Ranking::BM25 ? "     BM25: " : "     TF-IDF: ") << std::fixed << std::setprecision(2) << results[i].score << "\n"
                       << std::endl;
         }
         if (results.size() > show)
@@ -490,11 +1196,15 @@ void run_cli(const std::string& dump_path) {
     }
 }
 
-void run_server(int port) {
+void run_server(int port, size_t workers, size_t ingest_workers, size_t ingest_queue, size_t refresh_ms,
+                const std::string& dump_path, bool watch_dump) {
     httplib::Server svr;
-    BooleanSearch search(g_index);
-    
-    svr.Get("/api/search", [&search](const httplib::Request& req, httplib::Response& res) {
+    if (workers > 0)
+        svr.new_task_queue = [workers] { return new httplib::ThreadPool(workers); };
+
+    // Every request searches the corpus and segment set current when it
+    // arrived and resolves its doc ids against that same set.
+    svr.Get("/api/search", [](const httplib::Request& req, httplib::Response& res) {
         res.set_header("Access-Control-Allow-Origin", "*");
         
         std::string query = req.get_param_value("q");
@@ -503,6 +1213,12 @@ void run_server(int port) {
         
         if (req.has_param("limit")) limit = std::stoi(req.get_param_value("limit"));
         if (req.has_param("page")) page = std::stoi(req.get_param_value("page"));
+        Ranking ranking = Ranking::TFIDF;
+        if (req.has_param("rank") && !parse_ranking(req.get_param_value("rank"), ranking)) {
+            res.status = 400;
+            res.set_content("{\"error\":\"rank must be tfidf or bm25\"}", "application/json");
+            return;
+        }
         
         int per_page = 10;
         
@@ -511,12 +1227,24 @@ void run_server(int port) {
             return;
         }
         
+        std::shared_ptr<Corpus> corpus = current_corpus();
+        std::shared_ptr<const SegmentSet> segments = corpus->segments.snapshot();
+        const BooleanSearch search(*segments, &corpus->stem_cache);
         auto t0 = std::chrono::high_resolution_clock::now();
-        auto results = search.search(query, limit);
+        size_t hits = 0;
+        size_t k = limit > 0 ? limit : 0;
+        std::vector<ScoredDoc> results;
+        BooleanSearch::PreparedQuery prepared = search.prepare_query(query, ranking);
+        bool cached = g_query_cache->lookup(prepared.key, k, results, hits);
+        if (!cached) {
+            results = search.rank(prepared, k, &hits);
+            g_query_cache->store(prepared.key, k, results, hits);
+        }
         auto t1 = std::chrono::high_resolution_clock::now();
         auto search_us = std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
         
-        log_msg("QUERY", "\"" + query + "\" -> " + std::to_string(results.size()) + " results in " + std::to_string(search_us / 1000.0) + "ms");
+        log_msg("QUERY", "\"" + query + "\" -> " + std::to_string(hits) + " hits in " + std::to_string(search_us / 1000.0) + "ms"
+                + (cached ? " (cached)" : ""));
         
         int total = results.size();
         int pages = (total + per_page - 1) / per_page;
@@ -534,13 +1262,15 @@ void run_server(int port) {
             
             std::string title;
             std::string snippet;
-            const Document* doc = g_doc_lookup.find(results[i].doc_id);
-            if (doc) {
-                title = doc->title;
-                snippet = make_snippet(doc->text, query);
+            std::string url(segments->get_doc_id(results[i].doc_id));
+            size_t rec = segments->record(results[i].doc_id);
+            Document entry;
+            if (corpus->read_record(rec, entry)) {
+                title = entry.title;
+                snippet = make_snippet(corpus->doc_texts.get(rec), query);
             }
             
-            json << "{\"url\":\"" << escape_json_str(results[i].doc_id)
+            json << "{\"url\":\"" << escape_json_str(url)
                  << "\",\"title\":\"" << escape_json_str(title)
                  << "\",\"score\":" << results[i].score
                  << ",\"snippet\":\"" << escape_json_str(snippet)
@@ -548,6 +1278,7 @@ void run_server(int port) {
         }
         
         json << "],\"total\":" << total
+             << ",\"hits\":" << hits
              << ",\"page\":" << page
              << ",\"pages\":" << pages << "}";
         
@@ -557,12 +1288,26 @@ void run_server(int port) {
     svr.Get("/api/stats", [](const httplib::Request&, httplib::Response& res) {
         res.set_header("Access-Control-Allow-Origin", "*");
         
+        std::shared_ptr<Corpus> corpus = current_corpus();
+        std::shared_ptr<const SegmentSet> segments = corpus->segments.snapshot();
+        ZipfAnalyzer zipf(*segments);
         std::ostringstream json;
-        json << "{\"documents\":" << g_index.document_count()
-             << ",\"vocabulary\":" << g_index.vocabulary_size()
-             << ",\"total_terms\":" << g_zipf.total_terms()
-             << ",\"unique_terms\":" << g_zipf.unique_terms()
-             << ",\"index_time\":" << std::fixed << std::setprecision(1) << g_index_time
+        json << "{\"documents\":" << segments->live_document_count()
+             << ",\"vocabulary\":" << segments->vocabulary_size()
+             << ",\"segments\":" << segments->segments.size()
+             << ",\"total_terms\":" << zipf.total_terms()
+             << ",\"unique_terms\":" << zipf.unique_terms()
+             << ",\"index_time\":" << std::fixed << std::setprecision(1) << corpus->index_time
+             << ",\"cache\":{\"hits\":" << g_query_cache->hits()
+             << ",\"misses\":" << g_query_cache->misses()
+             << ",\"entries\":" << g_query_cache->entries()
+             << ",\"bytes\":" << g_query_cache->bytes() << "}"
+             << ",\"ingest\":{\"queued\":" << ingest_queued()
+             << ",\"buffered\":" << corpus->segments.buffered()
+             << ",\"indexed\":" << g_ingest.indexed
+             << ",\"refused\":" << g_ingest.refused << "}"
+             << ",\"reload\":{\"loading\":" << (g_reload.loading ? "true" : "false")
+             << ",\"swaps\":" << g_reload.swaps << "}"
              << ",\"status\":\"ready\"}";
         
         res.set_content(json.str(), "application/json");
@@ -574,13 +1319,15 @@ void run_server(int port) {
         int limit = 5000;
         if (req.has_param("limit")) limit = std::stoi(req.get_param_value("limit"));
         
-        auto terms = g_zipf.get_sorted_terms();
+        std::shared_ptr<const SegmentSet> segments = current_corpus()->segments.snapshot();
+        ZipfAnalyzer zipf(*segments);
+        auto terms = zipf.get_sorted_terms();
         size_t max_freq = terms.empty() ? 1 : terms[0].frequency;
         size_t count = terms.size() < (size_t)limit ? terms.size() : (size_t)limit;
         
         std::ostringstream json;
         json << "{\"total_unique\":" << terms.size()
-             << ",\"total_terms\":" << g_zipf.total_terms()
+             << ",\"total_terms\":" << zipf.total_terms()
              << ",\"data\":[";
         
         for (size_t i = 0; i < count; ++i) {
@@ -604,13 +1351,15 @@ void run_server(int port) {
         res.set_header("Access-Control-Allow-Origin", "*");
         
         std::string url = req.get_param_value("url");
-        const Document* doc = g_doc_lookup.find(url);
+        size_t rec = 0;
+        Document entry;
+        std::shared_ptr<Corpus> corpus = current_corpus();
         
-        if (doc) {
+        if (corpus->find_record(*corpus->segments.snapshot(), url, rec, entry)) {
             std::ostringstream json;
-            json << "{\"url\":\"" << escape_json_str(doc->url)
-                 << "\",\"title\":\"" << escape_json_str(doc->title)
-                 << "\",\"text\":\"" << escape_json_str(doc->text) << "\"}";
+            json << "{\"url\":\"" << escape_json_str(entry.url)
+                 << "\",\"title\":\"" << escape_json_str(entry.title)
+                 << "\",\"text\":\"" << escape_json_str(corpus->doc_texts.get(rec)) << "\"}";
             res.set_content(json.str(), "application/json");
         } else {
             res.status = 404;
@@ -618,26 +1367,95 @@ void run_server(int port) {
         }
     });
 
-    svr.Post("/api/dump", [](const httplib::Request&, httplib::Response& res) {
+    svr.Post("/api/dump", [dump_path](const httplib::Request&, httplib::Response& res) {
         res.set_header("Access-Control-Allow-Origin", "*");
-        bool ok = save_dump("/app/data/index.dump");
+        bool ok = save_dump(*current_corpus(), dump_path);
+        if (ok) note_own_dump(dump_path);
         if (ok) res.set_content("{\"status\":\"ok\"}", "application/json");
         else { res.status = 500; res.set_content("{\"error\":\"dump failed\"}", "application/json"); }
     });
     
+    // NDJSON, one document per line as the scraper writes them; lines
+    // without a url and text are counted as invalid. When a queue is full
+    // the rest of the batch is refused with 503, and resume_line is the
+    // first line to send again.
+    svr.Post("/api/ingest", [](const httplib::Request& req, httplib::Response& res) {
+        res.set_header("Access-Control-Allow-Origin", "*");
+        std::vector<Document> docs;
+        std::vector<size_t> lines;
+        size_t invalid = 0;
+        size_t line_no = 0;
+        std::string line;
+        for (size_t pos = 0; pos < req.body.size(); ++line_no) {
+            size_t end = req.body.find('\n', pos);
+            if (end == std::string::npos) end = req.body.size();
+            line.assign(req.body, pos, end - pos);
+            pos = end + 1;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty()) continue;
+            Document doc;
+            if (NdjsonReader::parse_document(line, doc)) {
+                docs.push_back(std::move(doc));
+                lines.push_back(line_no);
+            } else {
+                ++invalid;
+            }
+        }
+        if (docs.empty()) {
+            res.status = 400;
+            res.set_content("{\"error\":\"no documents\",\"invalid\":" + std::to_string(invalid) + "}",
+                            "application/json");
+            return;
+        }
+
+        size_t accepted = submit_ingest(docs);
+        std::ostringstream json;
+        json << "{\"accepted\":" << accepted << ",\"invalid\":" << invalid;
+        if (accepted < docs.size()) {
+            res.status = 503;
+            res.set_header("Retry-After", "1");
+            json << ",\"error\":\"ingest queue full\",\"resume_line\":" << lines[accepted];
+        } else {
+            res.status = 202;
+        }
+        json << "}";
+        res.set_content(json.str(), "application/json");
+    });
+
+    // Reloads the dump the server started from in the background and swaps
+    // it in. An admin endpoint: it takes no path and is not offered to
+    // other origins.
+    svr.Post("/api/reload", [dump_path](const httplib::Request&, httplib::Response& res) {
+        if (!is_dump_file(dump_path)) {
+            res.status = 400;
+            res.set_content("{\"error\":\"not a dump file\"}", "application/json");
+            return;
+        }
+        request_reload(dump_path);
+        res.status = 202;
+        res.set_content("{\"status\":\"loading\",\"path\":\"" + escape_json_str(dump_path) + "\"}", "application/json");
+    });
+
     log_msg("INFO", "============================================================");
     log_msg("INFO", "HTTP SERVER READY");
     log_msg("INFO", "============================================================");
     log_msg("INFO", "Listening on 0.0.0.0:" + std::to_string(port));
     log_msg("INFO", "Endpoints:");
-    log_msg("INFO", "  GET  /api/search?q=...&page=1&limit=50");
+    log_msg("INFO", "  GET  /api/search?q=...&page=1&limit=50&rank=tfidf|bm25");
     log_msg("INFO", "  GET  /api/stats");
     log_msg("INFO", "  GET  /api/zipf?limit=5000");
     log_msg("INFO", "  GET  /api/document?url=...");
     log_msg("INFO", "  POST /api/dump");
+    log_msg("INFO", "  POST /api/ingest (NDJSON, " + std::to_string(ingest_workers) + " workers, refresh every "
+            + std::to_string(refresh_ms) + " ms)");
+    log_msg("INFO", "  POST /api/reload" + std::string(watch_dump ? " (watching " + dump_path + ")" : ""));
     log_msg("INFO", "------------------------------------------------------------");
     
+    start_ingest(ingest_workers, ingest_queue, refresh_ms);
+    start_reload(watch_dump ? dump_path : "");
     svr.listen("0.0.0.0", port);
+    stop_reload();
+    stop_ingest();
 }
 
 int main(int argc, char* argv[]) {
@@ -648,6 +1466,13 @@ int main(int argc, char* argv[]) {
     bool serve_mode = false;
     bool force_rebuild = false;
     int port = 9090;
+    size_t num_threads = 1;
+    size_t num_workers = 0;
+    size_t cache_mb = 64;
+    size_t ingest_workers = 2;
+    size_t ingest_queue = 1024;
+    size_t refresh_ms = 250;
+    bool watch_dump = false;
     
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
@@ -655,6 +1480,8 @@ int main(int argc, char* argv[]) {
             serve_mode = true;
         } else if (arg == "--rebuild") {
             force_rebuild = true;
+        } else if (arg == "--watch") {
+            watch_dump = true;
         } else if (arg == "--port" && i + 1 < argc) {
             port = std::stoi(argv[++i]);
         } else if (arg == "--input" && i + 1 < argc) {
@@ -663,6 +1490,25 @@ int main(int argc, char* argv[]) {
             input_file2 = argv[++i];
         } else if (arg == "--dump" && i + 1 < argc) {
             dump_path = argv[++i];
+        } else if (arg == "--threads" && i + 1 < argc) {
+            int n = std::stoi(argv[++i]);
+            // hardware_concurrency() may report 0 when it cannot tell.
+            num_threads = n > 0 ? n : std::max(1u, std::thread::hardware_concurrency());
+        } else if (arg == "--cache-mb" && i + 1 < argc) {
+            int n = std::stoi(argv[++i]);
+            cache_mb = n > 0 ? n : 0;
+        } else if (arg == "--workers" && i + 1 < argc) {
+            int n = std::stoi(argv[++i]);
+            num_workers = n > 0 ? n : 0;
+        } else if (arg == "--ingest-workers" && i + 1 < argc) {
+            int n = std::stoi(argv[++i]);
+            ingest_workers = n > 0 ? n : 1;
+        } else if (arg == "--ingest-queue" && i + 1 < argc) {
+            int n = std::stoi(argv[++i]);
+            ingest_queue = n > 0 ? n : 1;
+        } else if (arg == "--refresh-ms" && i + 1 < argc) {
+            int n = std::stoi(argv[++i]);
+            refresh_ms = n > 0 ? n : 1;
         }
     }
     
@@ -670,28 +1516,42 @@ int main(int argc, char* argv[]) {
     log_msg("INFO", "Input: " + input_file);
     log_msg("INFO", "Input2: " + input_file2);
     log_msg("INFO", "Dump:  " + dump_path);
+    g_query_cache.reset(new QueryCache(cache_mb << 20));
     
+    // Spools are unlinked once open, so every corpus reuses the path.
+    std::shared_ptr<Corpus> corpus(new Corpus, CorpusDeleter());
+    g_spool_path = dump_path + ".text";
+    if (!corpus->doc_texts.open(g_spool_path)) {
+        log_msg("WARN", "Cannot create text spool " + g_spool_path + ", using /tmp");
+        g_spool_path = "/tmp/engine.text";
+        if (!corpus->doc_texts.open(g_spool_path)) {
+            log_msg("FATAL", "Cannot create document text spool");
+            return 1;
+        }
+    }
+
     bool loaded = false;
 
     if (!force_rebuild && file_exists(dump_path) && is_dump_file(dump_path)) {
-        loaded = load_dump(dump_path);
+        loaded = load_dump(*corpus, dump_path);
         if (!loaded) log_msg("WARN", "Failed to load dump, falling back to corpus");
     }
 
     if (!loaded) {
-        build_index(input_file, input_file2);
-        if (!g_documents.empty()) {
-            save_dump(dump_path);
+        build_index(*corpus, input_file, input_file2, num_threads);
+        if (!corpus->documents.empty()) {
+            save_dump(*corpus, dump_path);
         }
     }
     
-    if (g_documents.empty()) {
+    if (corpus->documents.empty()) {
         log_msg("FATAL", "No documents loaded, exiting");
         return 1;
     }
+    std::atomic_store(&g_corpus, std::move(corpus));
     
     if (serve_mode) {
-        run_server(port);
+        run_server(port, num_workers, ingest_workers, ingest_queue, refresh_ms, dump_path, watch_dump);
     } else {
         run_cli(dump_path);
     }
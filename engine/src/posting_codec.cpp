@@ -0,0 +1,106 @@
+#include "posting_codec.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+uint32_t codec_max_bits(const uint32_t* in) {
+    uint32_t acc = 0;
+    for (size_t i = 0; i < CODEC_BLOCK; ++i)
+        acc |= in[i];
+    uint32_t bits = 0;
+    while (acc) { ++bits; acc >>= 1; }
+    return bits;
+}
+
+void codec_pack(const uint32_t* in, uint32_t bits, uint32_t* out) {
+    if (bits == 0) return;
+    for (size_t lane = 0; lane < 4; ++lane) {
+        uint64_t acc = 0;
+        uint32_t used = 0;
+        size_t w = 0;
+        for (size_t j = 0; j < CODEC_BLOCK / 4; ++j) {
+            acc |= static_cast<uint64_t>(in[j * 4 + lane]) << used;
+            used += bits;
+            if (used >= 32) {
+                out[w * 4 + lane] = static_cast<uint32_t>(acc);
+                acc >>= 32;
+                used -= 32;
+                ++w;
+            }
+        }
+    }
+}
+
+#if defined(__SSE2__)
+
+void codec_unpack(const uint32_t* in, uint32_t bits, uint32_t* out) {
+    __m128i* dst = reinterpret_cast<__m128i*>(out);
+    if (bits == 0) {
+        for (size_t j = 0; j < CODEC_BLOCK / 4; ++j)
+            _mm_storeu_si128(dst + j, _mm_setzero_si128());
+        return;
+    }
+    const __m128i* src = reinterpret_cast<const __m128i*>(in);
+    const __m128i mask = _mm_set1_epi32(bits == 32 ? 0xFFFFFFFFu : (1u << bits) - 1);
+    __m128i cur = _mm_loadu_si128(src);
+    uint32_t used = 0;
+    size_t w = 0;
+    for (size_t j = 0; j < CODEC_BLOCK / 4; ++j) {
+        __m128i v = _mm_srl_epi32(cur, _mm_cvtsi32_si128(used));
+        used += bits;
+        if (used >= 32) {
+            used -= 32;
+            if (++w < bits) {
+                cur = _mm_loadu_si128(src + w);
+                if (used > 0)
+                    v = _mm_or_si128(v, _mm_sll_epi32(cur, _mm_cvtsi32_si128(bits - used)));
+            }
+        }
+        _mm_storeu_si128(dst + j, _mm_and_si128(v, mask));
+    }
+}
+
+void codec_prefix_sum(const uint32_t* in, uint32_t base, uint32_t* out) {
+    const __m128i one = _mm_set1_epi32(1);
+    __m128i carry = _mm_set1_epi32(base);
+    for (size_t j = 0; j < CODEC_BLOCK / 4; ++j) {
+        __m128i v = _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in) + j), one);
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi32(v, carry);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out) + j, v);
+        carry = _mm_shuffle_epi32(v, 0xFF);
+    }
+}
+
+#else
+
+void codec_unpack(const uint32_t* in, uint32_t bits, uint32_t* out) {
+    const uint32_t mask = bits == 32 ? 0xFFFFFFFFu : (1u << bits) - 1;
+    for (size_t lane = 0; lane < 4; ++lane) {
+        uint64_t acc = 0;
+        uint32_t avail = 0;
+        size_t w = 0;
+        for (size_t j = 0; j < CODEC_BLOCK / 4; ++j) {
+            if (avail < bits) {
+                acc |= static_cast<uint64_t>(in[w * 4 + lane]) << avail;
+                avail += 32;
+                ++w;
+            }
+            out[j * 4 + lane] = static_cast<uint32_t>(acc) & mask;
+            acc >>= bits;
+            avail -= bits;
+        }
+    }
+}
+
+void codec_prefix_sum(const uint32_t* in, uint32_t base, uint32_t* out) {
+    uint32_t prev = base;
+    for (size_t i = 0; i < CODEC_BLOCK; ++i) {
+        prev += in[i] + 1;
+        out[i] = prev;
+    }
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef POSTING_CODEC_H
+#define POSTING_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Fixed-size blocks of 128 unsigned ints, bit-packed in four interleaved
+// 32-bit lanes (value i goes to lane i % 4) so SSE2 can unpack four values
+// per instruction. A block packed with `bits` bits takes 4 * bits words.
+
+const size_t CODEC_BLOCK = 128;
+
+uint32_t codec_max_bits(const uint32_t* in);
+void codec_pack(const uint32_t* in, uint32_t bits, uint32_t* out);
+void codec_unpack(const uint32_t* in, uint32_t bits, uint32_t* out);
+
+// out[i] = base + 1 + in[0] + 1 + ... + in[i] + 1, i.e. the inverse of storing
+// strictly increasing values as (gap - 1). Works in place.
+void codec_prefix_sum(const uint32_t* in, uint32_t base, uint32_t* out);
+
+#endif
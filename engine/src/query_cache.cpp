@@ -0,0 +1,130 @@
+#include "query_cache.h"
+
+QueryCache::QueryCache(size_t max_bytes, size_t num_shards)
+    : shard_limit_(num_shards ? max_bytes / num_shards : 0), hits_(0), misses_(0) {
+    for (size_t i = 0; i < num_shards; ++i)
+        shards_.push_back(std::unique_ptr<Shard>(new Shard()));
+}
+
+QueryCache::Shard& QueryCache::shard_for(const std::string& key) {
+    size_t h = 2166136261u;
+    for (size_t i = 0; i < key.size(); ++i)
+        h = (h ^ static_cast<unsigned char>(key[i])) * 16777619u;
+    return *shards_[h % shards_.size()];
+}
+
+void QueryCache::unlink(Shard& shard, size_t n) {
+    Node& node = shard.nodes[n];
+    if (node.prev != SIZE_MAX) shard.nodes[node.prev].next = node.next;
+    else shard.head = node.next;
+    if (node.next != SIZE_MAX) shard.nodes[node.next].prev = node.prev;
+    else shard.tail = node.prev;
+}
+
+void QueryCache::push_front(Shard& shard, size_t n) {
+    Node& node = shard.nodes[n];
+    node.prev = SIZE_MAX;
+    node.next = shard.head;
+    if (shard.head != SIZE_MAX) shard.nodes[shard.head].prev = n;
+    shard.head = n;
+    if (shard.tail == SIZE_MAX) shard.tail = n;
+}
+
+void QueryCache::evict(Shard& shard, size_t n) {
+    unlink(shard, n);
+    Node& node = shard.nodes[n];
+    shard.slots.erase(node.key);
+    shard.bytes -= node.bytes;
+    std::string().swap(node.key);
+    std::vector<ScoredDoc>().swap(node.docs);
+    shard.free_nodes.push_back(n);
+}
+
+bool QueryCache::lookup(const std::string& key, size_t k, std::vector<ScoredDoc>& docs,
+                        size_t& total_hits) {
+    if (!enabled() || key.empty()) return false;
+    Shard& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    size_t* slot = shard.slots.find(key);
+    if (!slot) {
+        ++misses_;
+        return false;
+    }
+    Node& node = shard.nodes[*slot];
+    if (node.depth < k && node.docs.size() < node.total_hits) {
+        ++misses_;
+        return false;
+    }
+    size_t n = k < node.docs.size() ? k : node.docs.size();
+    docs.assign(node.docs.begin(), node.docs.begin() + n);
+    total_hits = node.total_hits;
+    unlink(shard, *slot);
+    push_front(shard, *slot);
+    ++hits_;
+    return true;
+}
+
+void QueryCache::store(const std::string& key, size_t k, const std::vector<ScoredDoc>& docs,
+                       size_t total_hits) {
+    if (!enabled() || key.empty()) return;
+    size_t bytes = sizeof(Node) + key.size() + docs.size() * sizeof(ScoredDoc);
+    if (bytes > shard_limit_) return;
+
+    Shard& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    size_t* existing = shard.slots.find(key);
+    if (existing) evict(shard, *existing);
+    while (shard.bytes + bytes > shard_limit_ && shard.tail != SIZE_MAX)
+        evict(shard, shard.tail);
+
+    size_t n;
+    if (!shard.free_nodes.empty()) {
+        n = shard.free_nodes.back();
+        shard.free_nodes.pop_back();
+    } else {
+        n = shard.nodes.size();
+        shard.nodes.push_back(Node());
+    }
+    Node& node = shard.nodes[n];
+    node.key = key;
+    node.docs = docs;
+    node.total_hits = total_hits;
+    node.depth = k;
+    node.bytes = bytes;
+    push_front(shard, n);
+    shard.slots.insert(key, n);
+    shard.bytes += bytes;
+}
+
+void QueryCache::clear() {
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        Shard& shard = *shards_[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.slots.clear();
+        std::vector<Node>().swap(shard.nodes);
+        std::vector<size_t>().swap(shard.free_nodes);
+        shard.head = SIZE_MAX;
+        shard.tail = SIZE_MAX;
+        shard.bytes = 0;
+    }
+}
+
+size_t QueryCache::entries() {
+    size_t total = 0;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        std::lock_guard<std::mutex> lock(shards_[i]->mutex);
+        total += shards_[i]->slots.size();
+    }
+    return total;
+}
+
+size_t QueryCache::bytes() {
+    size_t total = 0;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        std::lock_guard<std::mutex> lock(shards_[i]->mutex);
+        total += shards_[i]->bytes;
+    }
+    return total;
+}
@@ -0,0 +1,66 @@
+#ifndef QUERY_CACHE_H
+#define QUERY_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "string_map.h"
+#include "boolean_search.h"
+
+// Ranked results keyed on BooleanSearch::canonical_query(). Keys are
+// spread over independently locked shards, each an LRU list bounded by
+// its share of the byte limit. An entry computed for the top k serves any
+// request for k or fewer results, and any k at all once it holds every hit.
+class QueryCache {
+private:
+    struct Node {
+        std::string key;
+        std::vector<ScoredDoc> docs;
+        size_t total_hits;
+        size_t depth;
+        size_t bytes;
+        size_t prev;
+        size_t next;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        StringMap<size_t> slots{256};
+        std::vector<Node> nodes;
+        std::vector<size_t> free_nodes;
+        size_t head;
+        size_t tail;
+        size_t bytes;
+
+        Shard() : head(SIZE_MAX), tail(SIZE_MAX), bytes(0) {}
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    size_t shard_limit_;
+    std::atomic<size_t> hits_;
+    std::atomic<size_t> misses_;
+
+    Shard& shard_for(const std::string& key);
+    static void unlink(Shard& shard, size_t n);
+    static void push_front(Shard& shard, size_t n);
+    static void evict(Shard& shard, size_t n);
+
+public:
+    QueryCache(size_t max_bytes, size_t num_shards = 16);
+
+    bool enabled() const { return shard_limit_ > 0; }
+
+    bool lookup(const std::string& key, size_t k, std::vector<ScoredDoc>& docs, size_t& total_hits);
+    void store(const std::string& key, size_t k, const std::vector<ScoredDoc>& docs, size_t total_hits);
+    void clear();
+
+    size_t hits() const { return hits_; }
+    size_t misses() const { return misses_; }
+    size_t entries();
+    size_t bytes();
+};
+
+#endif
@@ -0,0 +1,335 @@
+#include "segmented_index.h"
+
+// Shared by every SegmentedIndex, so sets of different indexes in one
+// process never share a generation either.
+static std::atomic<uint64_t> g_next_generation(1);
+
+size_t SegmentSet::document_count() const {
+    return segments.empty() ? 0 : segments.back().doc_base + segments.back().document_count();
+}
+
+size_t SegmentSet::live_document_count() const {
+    size_t total = 0;
+    for (size_t s = 0; s < segments.size(); ++s)
+        total += segments[s].live_count();
+    return total;
+}
+
+uint64_t SegmentSet::total_terms() const {
+    uint64_t total = 0;
+    for (size_t s = 0; s < segments.size(); ++s)
+        total += segments[s].index->total_terms();
+    return total;
+}
+
+size_t SegmentSet::vocabulary_size() const {
+    if (segments.size() == 1) return segments[0].index->vocabulary_size();
+    size_t count = 0;
+    for_each_term([&count](std::string_view, uint64_t) { ++count; });
+    return count;
+}
+
+size_t SegmentSet::postings_memory() const {
+    size_t total = 0;
+    for (size_t s = 0; s < segments.size(); ++s)
+        total += segments[s].index->postings_memory();
+    return total;
+}
+
+const Segment& SegmentSet::segment_of(size_t doc, size_t& local) const {
+    size_t lo = 1, hi = segments.size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (segments[mid].doc_base <= doc) lo = mid + 1;
+        else hi = mid;
+    }
+    const Segment& seg = segments[lo - 1];
+    local = doc - seg.doc_base;
+    return seg;
+}
+
+std::string_view SegmentSet::get_doc_id(size_t doc) const {
+    size_t local = 0;
+    return segment_of(doc, local).index->get_doc_id(local);
+}
+
+size_t SegmentSet::record(size_t doc) const {
+    size_t local = 0;
+    return (*segment_of(doc, local).records)[local];
+}
+
+bool SegmentSet::find_record(std::string_view url, size_t& record) const {
+    for (size_t s = segments.size(); s > 0; --s) {
+        const Segment& seg = segments[s - 1];
+        size_t local = 0;
+        if (seg.index->find_doc_index(url, local) && !seg.is_deleted(local)) {
+            record = (*seg.records)[local];
+            return true;
+        }
+    }
+    return false;
+}
+
+SegmentedIndex::SegmentedIndex() : current_(std::make_shared<SegmentSet>()) {}
+
+SegmentedIndex::~SegmentedIndex() {
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        stop_ = true;
+    }
+    merge_wanted_.notify_one();
+    if (merger_.joinable()) merger_.join();
+}
+
+std::shared_ptr<const SegmentSet> SegmentedIndex::snapshot() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return current_;
+}
+
+// Callers hold write_mutex_.
+void SegmentedIndex::publish(std::vector<Segment>&& segments) {
+    std::shared_ptr<SegmentSet> set = std::make_shared<SegmentSet>();
+    size_t base = 0;
+    for (size_t s = 0; s < segments.size(); ++s) {
+        segments[s].doc_base = base;
+        base += segments[s].document_count();
+    }
+    set->segments = std::move(segments);
+    std::lock_guard<std::mutex> lock(mutex_);
+    set->generation = g_next_generation++;
+    current_ = set;
+}
+
+void SegmentedIndex::reset(std::shared_ptr<const InvertedIndex> index, std::vector<uint32_t>&& records) {
+    std::lock_guard<std::mutex> merging(merge_mutex_);
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    buffer_.reset();
+    buffer_records_.clear();
+    std::vector<Segment> segments;
+    if (index) {
+        Segment seg;
+        seg.index = index;
+        seg.records = std::make_shared<const std::vector<uint32_t>>(std::move(records));
+        segments.push_back(seg);
+    }
+    publish(std::move(segments));
+}
+
+void SegmentedIndex::clear() {
+    std::vector<uint32_t> none;
+    reset(nullptr, std::move(none));
+}
+
+// Marks every live copy of the URL deleted, copying the bitmaps it changes.
+void SegmentedIndex::tombstone(std::vector<Segment>& segments, std::string_view url) const {
+    for (size_t s = 0; s < segments.size(); ++s) {
+        Segment& seg = segments[s];
+        size_t local = 0;
+        if (!seg.index->find_doc_index(url, local) || seg.is_deleted(local)) continue;
+        std::shared_ptr<std::vector<uint64_t>> deleted = seg.deleted
+            ? std::make_shared<std::vector<uint64_t>>(*seg.deleted)
+            : std::make_shared<std::vector<uint64_t>>((seg.document_count() + 63) / 64, 0);
+        (*deleted)[local >> 6] |= uint64_t(1) << (local & 63);
+        seg.deleted = deleted;
+        ++seg.deleted_count;
+    }
+}
+
+// Callers hold write_mutex_. Older copies of the buffered URLs are
+// deleted in the same publish that makes the new ones visible.
+void SegmentedIndex::seal_buffer() {
+    if (!buffer_ || buffer_->document_count() == 0) return;
+    buffer_->finalize();
+    Segment seg;
+    seg.index = std::shared_ptr<const InvertedIndex>(buffer_.release());
+    seg.records = std::make_shared<const std::vector<uint32_t>>(std::move(buffer_records_));
+    buffer_records_.clear();
+
+    std::vector<Segment> segments = snapshot()->segments;
+    for (size_t d = 0; d < seg.document_count(); ++d)
+        tombstone(segments, seg.index->get_doc_id(d));
+    segments.push_back(seg);
+    publish(std::move(segments));
+    request_merge();
+}
+
+void SegmentedIndex::add_document(std::string_view url, uint32_t record, const std::vector<std::string>& terms) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    size_t local = 0;
+    // A second copy in one buffer would share the first one's doc id.
+    if (buffer_ && buffer_->find_doc_index(url, local)) seal_buffer();
+    if (!buffer_) buffer_.reset(new InvertedIndex(16384, 1024));
+    std::vector<uint32_t> term_ids(terms.size());
+    for (size_t i = 0; i < terms.size(); ++i)
+        term_ids[i] = buffer_->intern_term(terms[i]);
+    buffer_->add_postings(buffer_->get_doc_index(url), term_ids);
+    buffer_records_.push_back(record);
+}
+
+bool SegmentedIndex::remove(std::string_view url) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    size_t local = 0;
+    if (buffer_ && buffer_->find_doc_index(url, local)) seal_buffer();
+    std::shared_ptr<const SegmentSet> set = snapshot();
+    std::vector<Segment> segments = set->segments;
+    tombstone(segments, url);
+    size_t before = 0, after = 0;
+    for (size_t s = 0; s < segments.size(); ++s) {
+        before += set->segments[s].deleted_count;
+        after += segments[s].deleted_count;
+    }
+    if (after == before) return false;
+    publish(std::move(segments));
+    request_merge();
+    return true;
+}
+
+void SegmentedIndex::refresh() {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    seal_buffer();
+}
+
+size_t SegmentedIndex::buffered() {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    return buffer_ ? buffer_->document_count() : 0;
+}
+
+// Callers hold write_mutex_.
+void SegmentedIndex::request_merge() {
+    merge_pending_ = true;
+    if (!merger_.joinable()) merger_ = std::thread(&SegmentedIndex::merge_loop, this);
+    merge_wanted_.notify_one();
+}
+
+void SegmentedIndex::merge_loop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(write_mutex_);
+            merge_wanted_.wait(lock, [this] { return stop_ || merge_pending_; });
+            if (stop_) return;
+            merge_pending_ = false;
+        }
+        std::lock_guard<std::mutex> merging(merge_mutex_);
+        size_t first = 0, count = 0;
+        while (!stop_) {
+            std::shared_ptr<const SegmentSet> set = snapshot();
+            if (!pick_merge(*set, first, count) || !merge_segments(*set, first, count)) break;
+        }
+    }
+}
+
+static size_t size_tier(size_t docs) {
+    size_t tier = 0;
+    for (; docs >= SegmentedIndex::TIER_FLOOR; docs /= SegmentedIndex::MERGE_FACTOR)
+        ++tier;
+    return tier;
+}
+
+// Mostly deleted segments first, then the newest run of MERGE_FACTOR
+// adjacent segments on one tier. Only adjacent segments are merged, so
+// doc ids keep following indexing order.
+bool SegmentedIndex::pick_merge(const SegmentSet& set, size_t& first, size_t& count) const {
+    const std::vector<Segment>& segments = set.segments;
+    for (size_t s = segments.size(); s > 0; --s) {
+        const Segment& seg = segments[s - 1];
+        if (seg.deleted_count > 0 && seg.deleted_count * 2 >= seg.document_count()) {
+            first = s - 1;
+            count = 1;
+            return true;
+        }
+    }
+    for (size_t end = segments.size(); end >= MERGE_FACTOR; --end) {
+        size_t tier = size_tier(segments[end - 1].live_count());
+        size_t s = end - MERGE_FACTOR;
+        while (s < end - 1 && size_tier(segments[s].live_count()) == tier) ++s;
+        if (s == end - 1) {
+            first = end - MERGE_FACTOR;
+            count = MERGE_FACTOR;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Runs without write_mutex_ on segments of `set`, then commits if they
+// are still current. Returns false if they are not.
+bool SegmentedIndex::merge_segments(const SegmentSet& set, size_t first, size_t count) {
+    const Segment* inputs = &set.segments[first];
+    size_t live = 0, vocabulary = 16384;
+    for (size_t i = 0; i < count; ++i) {
+        live += inputs[i].live_count();
+        if (inputs[i].index->vocabulary_size() > vocabulary) vocabulary = inputs[i].index->vocabulary_size();
+    }
+
+    // remap[i][d] is the merged id of input i's document d, or NONE.
+    std::shared_ptr<InvertedIndex> merged(new InvertedIndex(vocabulary, live > 1024 ? live : 1024));
+    std::shared_ptr<std::vector<uint32_t>> records = std::make_shared<std::vector<uint32_t>>();
+    records->reserve(live);
+    std::vector<std::vector<uint32_t>> remap(count);
+    for (size_t i = 0; i < count; ++i) {
+        const Segment& seg = inputs[i];
+        remap[i].assign(seg.document_count(), TermDictionary::NONE);
+        for (size_t d = 0; d < seg.document_count(); ++d) {
+            if (seg.is_deleted(d)) continue;
+            size_t before = merged->document_count();
+            size_t id = merged->get_doc_index(seg.index->get_doc_id(d));
+            if (id < before) continue;
+            remap[i][d] = static_cast<uint32_t>(id);
+            records->push_back((*seg.records)[d]);
+            merged->add_doc_length(id, seg.index->doc_length(d));
+        }
+    }
+    // Merged ids grow with the input and the local id, so every list is
+    // appended to in doc id order.
+    for (size_t i = 0; i < count; ++i) {
+        const std::vector<uint32_t>& ids = remap[i];
+        inputs[i].index->for_each_term([&merged, &ids](std::string_view term, const PostingView& pl) {
+            PostingList* dst = nullptr;
+            pl.for_each([&merged, &ids, &dst, term](uint32_t doc, uint32_t freq) {
+                if (ids[doc] == TermDictionary::NONE) return;
+                if (!dst) dst = &merged->posting_list(merged->intern_term(term));
+                dst->add(ids[doc], freq);
+            });
+        });
+    }
+    merged->finalize();
+
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    std::shared_ptr<const SegmentSet> now = snapshot();
+    if (now->segments.size() < first + count) return false;
+    for (size_t i = 0; i < count; ++i)
+        if (now->segments[first + i].index != inputs[i].index) return false;
+
+    Segment out;
+    out.index = merged;
+    out.records = records;
+    std::shared_ptr<std::vector<uint64_t>> deleted;
+    for (size_t i = 0; i < count; ++i) {
+        const Segment& seg = now->segments[first + i];
+        if (seg.deleted == inputs[i].deleted) continue;
+        for (size_t d = 0; d < seg.document_count(); ++d) {
+            uint32_t id = remap[i][d];
+            if (id == TermDictionary::NONE || !seg.is_deleted(d)) continue;
+            if (!deleted) deleted = std::make_shared<std::vector<uint64_t>>((merged->document_count() + 63) / 64, 0);
+            (*deleted)[id >> 6] |= uint64_t(1) << (id & 63);
+            ++out.deleted_count;
+        }
+    }
+    out.deleted = deleted;
+
+    std::vector<Segment> segments(now->segments.begin(), now->segments.begin() + first);
+    if (merged->document_count() > 0) segments.push_back(out);
+    segments.insert(segments.end(), now->segments.begin() + first + count, now->segments.end());
+    publish(std::move(segments));
+    ++merges_;
+    return true;
+}
+
+std::shared_ptr<const SegmentSet> SegmentedIndex::force_merge() {
+    std::lock_guard<std::mutex> merging(merge_mutex_);
+    refresh();
+    std::shared_ptr<const SegmentSet> set = snapshot();
+    if (set->segments.size() > 1 || (set->segments.size() == 1 && set->segments[0].deleted_count > 0))
+        merge_segments(*set, 0, set->segments.size());
+    return snapshot();
+}
@@ -0,0 +1,153 @@
+#ifndef SEGMENTED_INDEX_H
+#define SEGMENTED_INDEX_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "inverted_index.h"
+
+// An immutable piece of the index with its own documents and postings.
+// records maps the segment's documents to rows of the record table;
+// deleted marks documents removed or re-crawled after the segment was
+// sealed and is null while there are none. Global doc ids are doc_base
+// plus the local id.
+struct Segment {
+    std::shared_ptr<const InvertedIndex> index;
+    std::shared_ptr<const std::vector<uint32_t>> records;
+    std::shared_ptr<const std::vector<uint64_t>> deleted;
+    size_t deleted_count = 0;
+    size_t doc_base = 0;
+
+    size_t document_count() const { return index->document_count(); }
+    size_t live_count() const { return document_count() - deleted_count; }
+    bool is_deleted(size_t local) const {
+        return deleted && ((*deleted)[local >> 6] >> (local & 63)) & 1;
+    }
+};
+
+// What a query sees: segments oldest first, so global doc ids follow the
+// order documents were indexed in. generation is unique among all sets
+// published in the process, which is enough to tell two sets apart, even
+// ones of different indexes.
+class SegmentSet {
+public:
+    std::vector<Segment> segments;
+    uint64_t generation = 0;
+
+    // Size of the global doc id space, deleted documents included.
+    size_t document_count() const;
+    size_t live_document_count() const;
+    uint64_t total_terms() const;
+    size_t vocabulary_size() const;
+    size_t postings_memory() const;
+
+    // Segment holding a global doc id; local receives its id there.
+    const Segment& segment_of(size_t doc, size_t& local) const;
+    std::string_view get_doc_id(size_t doc) const;
+    size_t record(size_t doc) const;
+    // Record of the live document with this URL, newest segment first.
+    bool find_record(std::string_view url, size_t& record) const;
+
+    // Collection frequency of every term, summed over segments; terms in
+    // order of first occurrence.
+    template<typename Func>
+    void for_each_term(Func func) const;
+};
+
+// Segments plus a mutable buffer that collects new documents until
+// refresh() seals it into a segment. Publishing builds a new SegmentSet
+// and swaps it in, so readers holding a snapshot() are never disturbed.
+//
+// A background thread merges segments with a tiered policy: a run of
+// MERGE_FACTOR adjacent segments on the same size tier becomes one
+// segment, and a segment that is at least half deleted is rewritten on
+// its own. Merges drop deleted documents; deletes that arrive while a
+// merge runs are carried over when it commits.
+class SegmentedIndex {
+public:
+    static const size_t MERGE_FACTOR = 4;
+    // Segments with fewer live documents all share the lowest tier.
+    static const size_t TIER_FLOOR = 1024;
+
+private:
+    mutable std::mutex mutex_;
+    std::shared_ptr<const SegmentSet> current_;
+
+    // Guards the buffer and serializes changes to current_.
+    std::mutex write_mutex_;
+    std::unique_ptr<InvertedIndex> buffer_;
+    std::vector<uint32_t> buffer_records_;
+
+    // Held for the whole of a merge, so reset() can wait one out.
+    std::mutex merge_mutex_;
+    std::condition_variable merge_wanted_;
+    bool merge_pending_ = false;
+    std::atomic<bool> stop_{false};
+    std::atomic<size_t> merges_{0};
+    std::thread merger_;
+
+    void publish(std::vector<Segment>&& segments);
+    void seal_buffer();
+    void tombstone(std::vector<Segment>& segments, std::string_view url) const;
+    void request_merge();
+    void merge_loop();
+    bool pick_merge(const SegmentSet& set, size_t& first, size_t& count) const;
+    bool merge_segments(const SegmentSet& set, size_t first, size_t count);
+
+public:
+    SegmentedIndex();
+    ~SegmentedIndex();
+
+    SegmentedIndex(const SegmentedIndex&) = delete;
+    SegmentedIndex& operator=(const SegmentedIndex&) = delete;
+
+    std::shared_ptr<const SegmentSet> snapshot() const;
+
+    // Replaces everything with one segment; records holds the record of
+    // each of the index's documents. Waits for a running merge.
+    void reset(std::shared_ptr<const InvertedIndex> index, std::vector<uint32_t>&& records);
+    void clear();
+
+    // Buffers a document; an older copy of the URL stops matching once
+    // the document is published. terms are stemmed, one per token.
+    void add_document(std::string_view url, uint32_t record, const std::vector<std::string>& terms);
+    // False if no live copy of the URL exists.
+    bool remove(std::string_view url);
+    // Publishes the buffered documents as a new segment.
+    void refresh();
+    // Documents waiting for the next refresh().
+    size_t buffered();
+
+    // Merges everything into one segment without deleted documents and
+    // returns the result; used before writing a dump.
+    std::shared_ptr<const SegmentSet> force_merge();
+    size_t merge_count() const { return merges_; }
+};
+
+template<typename Func>
+void SegmentSet::for_each_term(Func func) const {
+    if (segments.size() == 1) {
+        segments[0].index->for_each_term([&func](std::string_view term, const PostingView& pl) {
+            func(term, pl.total_frequency());
+        });
+        return;
+    }
+    TermDictionary ids(16384);
+    std::vector<uint64_t> totals;
+    for (size_t s = 0; s < segments.size(); ++s) {
+        segments[s].index->for_each_term([&ids, &totals](std::string_view term, const PostingView& pl) {
+            uint32_t id = ids.intern(term);
+            if (id == totals.size()) totals.push_back(0);
+            totals[id] += pl.total_frequency();
+        });
+    }
+    for (uint32_t id = 0; id < totals.size(); ++id)
+        func(ids.term(id), totals[id]);
+}
+
+#endif
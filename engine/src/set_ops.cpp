@@ -0,0 +1,126 @@
+#include "set_ops.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// First index in [from, n) with arr[index] >= target, probing 1, 2, 4, ...
+// elements ahead before binary searching the last window.
+static size_t gallop(const uint32_t* arr, size_t from, size_t n, uint32_t target) {
+    if (from >= n || arr[from] >= target) return from;
+    size_t step = 1;
+    size_t lo = from;
+    while (lo + step < n && arr[lo + step] < target) {
+        lo += step;
+        step *= 2;
+    }
+    size_t hi = lo + step < n ? lo + step : n;
+    ++lo;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (arr[mid] < target) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static void intersect_gallop(const uint32_t* small, size_t ns, const uint32_t* large, size_t nl,
+                             std::vector<uint32_t>& out) {
+    size_t j = 0;
+    for (size_t i = 0; i < ns && j < nl; ++i) {
+        j = gallop(large, j, nl, small[i]);
+        if (j < nl && large[j] == small[i]) out.push_back(small[i]);
+    }
+}
+
+static void intersect_merge(const uint32_t* a, size_t na, const uint32_t* b, size_t nb,
+                            std::vector<uint32_t>& out, bool use_simd) {
+    size_t i = 0, j = 0;
+#if defined(__SSE2__)
+    // Compare four ids from each side at once: every element of va against
+    // all four rotations of vb, then drop the block with the smaller max.
+    while (use_simd && i + 4 <= na && j + 4 <= nb) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+        __m128i eq = _mm_cmpeq_epi32(va, vb);
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x39)));
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x4E)));
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x93)));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        for (size_t k = 0; k < 4; ++k)
+            if (mask & (1 << k)) out.push_back(a[i + k]);
+        uint32_t amax = a[i + 3];
+        uint32_t bmax = b[j + 3];
+        if (amax <= bmax) i += 4;
+        if (bmax <= amax) j += 4;
+    }
+#else
+    (void)use_simd;
+#endif
+    while (i < na && j < nb) {
+        if (a[i] == b[j]) { out.push_back(a[i]); ++i; ++j; }
+        else if (a[i] < b[j]) ++i;
+        else ++j;
+    }
+}
+
+void intersect_into(const uint32_t* a, size_t na, const uint32_t* b, size_t nb,
+                    std::vector<uint32_t>& out, IntersectMethod method) {
+    out.clear();
+    if (na == 0 || nb == 0) return;
+    out.reserve(na < nb ? na : nb);
+    if (method == IntersectMethod::AUTO) {
+        if (na * GALLOP_RATIO < nb || nb * GALLOP_RATIO < na) method = IntersectMethod::GALLOP;
+        else if (na <= nb * SIMD_RATIO && nb <= na * SIMD_RATIO) method = IntersectMethod::SIMD;
+        else method = IntersectMethod::MERGE;
+    }
+    if (method == IntersectMethod::GALLOP) {
+        if (na <= nb) intersect_gallop(a, na, b, nb, out);
+        else intersect_gallop(b, nb, a, na, out);
+    } else {
+        intersect_merge(a, na, b, nb, out, method == IntersectMethod::SIMD);
+    }
+}
+
+void unite_into(const uint32_t* a, size_t na, const uint32_t* b, size_t nb,
+                std::vector<uint32_t>& out) {
+    out.clear();
+    out.reserve(na + nb);
+    size_t i = 0, j = 0;
+    while (i < na && j < nb) {
+        if (a[i] == b[j]) { out.push_back(a[i]); ++i; ++j; }
+        else if (a[i] < b[j]) { out.push_back(a[i]); ++i; }
+        else { out.push_back(b[j]); ++j; }
+    }
+    out.insert(out.end(), a + i, a + na);
+    out.insert(out.end(), b + j, b + nb);
+}
+
+void subtract_into(const uint32_t* a, size_t na, const uint32_t* b, size_t nb,
+                   std::vector<uint32_t>& out) {
+    out.clear();
+    out.reserve(na);
+    if (nb * GALLOP_RATIO < na) {
+        size_t i = 0;
+        for (size_t j = 0; j < nb && i < na; ++j) {
+            size_t k = gallop(a, i, na, b[j]);
+            out.insert(out.end(), a + i, a + k);
+            i = k;
+            if (i < na && a[i] == b[j]) ++i;
+        }
+        out.insert(out.end(), a + i, a + na);
+        return;
+    }
+    size_t j = 0;
+    if (na * GALLOP_RATIO < nb) {
+        for (size_t i = 0; i < na; ++i) {
+            j = gallop(b, j, nb, a[i]);
+            if (j >= nb || b[j] != a[i]) out.push_back(a[i]);
+        }
+        return;
+    }
+    for (size_t i = 0; i < na; ++i) {
+        while (j < nb && b[j] < a[i]) ++j;
+        if (j >= nb || b[j] != a[i]) out.push_back(a[i]);
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef SET_OPS_H
+#define SET_OPS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Set operations over strictly increasing doc id arrays. Results are
+// written to `out`, which is cleared first and must not alias an input.
+// intersect and subtract switch to galloping search once one side is
+// GALLOP_RATIO times longer than the other; intersect uses the SSE2 block
+// compare only for lists within SIMD_RATIO of each other, since its
+// per-block overhead loses to a plain merge in between.
+
+const size_t GALLOP_RATIO = 16;
+const size_t SIMD_RATIO = 4;
+
+// AUTO picks by the length ratio as above; the others force one method,
+// for the tests and the crossover benchmark. SIMD is MERGE without SSE2.
+enum class IntersectMethod { AUTO, MERGE, SIMD, GALLOP };
+
+void intersect_into(const uint32_t* a, size_t na, const uint32_t* b, size_t nb,
+                    std::vector<uint32_t>& out,
+                    IntersectMethod method = IntersectMethod::AUTO);
+void unite_into(const uint32_t* a, size_t na, const uint32_t* b, size_t nb,
+                std::vector<uint32_t>& out);
+void subtract_into(const uint32_t* a, size_t na, const uint32_t* b, size_t nb,
+                   std::vector<uint32_t>& out);
+
+#endif
@@ -0,0 +1,79 @@
+#include "stem_cache.h"
+
+StemCache::StemCache(size_t capacity) : size_(0), hits_(0), misses_(0) {
+    size_t n = MAX_PROBE;
+    while (n < capacity) n *= 2;
+    slots_.resize(n);
+    mask_ = n - 1;
+}
+
+size_t StemCache::home(std::string_view word) const {
+    size_t h = 5381;
+    for (size_t i = 0; i < word.size(); ++i)
+        h = ((h << 5) + h) + static_cast<unsigned char>(word[i]);
+    return h & mask_;
+}
+
+const std::string* StemCache::find(std::string_view word) const {
+    size_t idx = home(word);
+    for (size_t i = 0; i < MAX_PROBE; ++i) {
+        const Slot& s = slots_[(idx + i) & mask_];
+        if (!s.used) return nullptr;
+        if (s.word == word) return &s.stem;
+    }
+    return nullptr;
+}
+
+void StemCache::insert(const std::string& word, const std::string& stem) {
+    size_t idx = home(word);
+    Slot* target = &slots_[idx];
+    for (size_t i = 0; i < MAX_PROBE; ++i) {
+        Slot& s = slots_[(idx + i) & mask_];
+        if (!s.used) {
+            target = &s;
+            ++size_;
+            break;
+        }
+        if (s.word == word) {
+            target = &s;
+            break;
+        }
+    }
+    target->word = word;
+    target->stem = stem;
+    target->used = true;
+}
+
+const std::string& StemCache::stem(std::string_view word) {
+    size_t idx = home(word);
+    Slot* empty = nullptr;
+    for (size_t i = 0; i < MAX_PROBE; ++i) {
+        Slot& s = slots_[(idx + i) & mask_];
+        if (!s.used) {
+            empty = &s;
+            break;
+        }
+        if (s.word == word) {
+            ++hits_;
+            return s.stem;
+        }
+    }
+    ++misses_;
+    Slot* target = empty ? empty : &slots_[idx];
+    if (empty) ++size_;
+    target->word = word;
+    target->stem.assign(word.data(), stemmer_.stem_length(word));
+    target->used = true;
+    return target->stem;
+}
+
+void StemCache::clear() {
+    for (size_t i = 0; i < slots_.size(); ++i) {
+        slots_[i].used = false;
+        std::string().swap(slots_[i].word);
+        std::string().swap(slots_[i].stem);
+    }
+    size_ = 0;
+    hits_ = 0;
+    misses_ = 0;
+}
@@ -0,0 +1,56 @@
+#ifndef STEM_CACHE_H
+#define STEM_CACHE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "stemmer.h"
+
+// Memoizes PorterStemmer::stem by surface form. Open addressing with
+// linear probing over a fixed number of slots: when a short probe run is
+// full, the word's home slot is overwritten, so memory stays bounded and
+// frequent forms keep winning their slots back.
+class StemCache {
+private:
+    struct Slot {
+        std::string word;
+        std::string stem;
+        bool used;
+
+        Slot() : used(false) {}
+    };
+
+    static const size_t MAX_PROBE = 8;
+
+    std::vector<Slot> slots_;
+    size_t mask_;
+    size_t size_;
+    size_t hits_;
+    size_t misses_;
+    PorterStemmer stemmer_;
+
+    size_t home(std::string_view word) const;
+
+public:
+    explicit StemCache(size_t capacity = 65536);
+
+    // The returned reference is valid until the next stem() or insert().
+    const std::string& stem(std::string_view word);
+    const std::string* find(std::string_view word) const;
+    void insert(const std::string& word, const std::string& stem);
+    void clear();
+
+    size_t size() const { return size_; }
+    size_t capacity() const { return slots_.size(); }
+    size_t hits() const { return hits_; }
+    size_t misses() const { return misses_; }
+
+    template<typename Func>
+    void for_each(Func func) const {
+        for (size_t i = 0; i < slots_.size(); ++i)
+            if (slots_[i].used) func(slots_[i].word, slots_[i].stem);
+    }
+};
+
+#endif
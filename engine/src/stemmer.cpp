@@ -1,25 +1,230 @@
 #include "stemmer.h"
-#include <cstring>
 
-bool PorterStemmer::is_vowel(const std::string& word, size_t pos) {
+// Suffix lists are matched from the end of the word through reversed
+// tries built at compile time. Within a list the first entry that matches
+// wins, as in the original sequential scan, so every terminal node keeps
+// the entry's list position and a lookup keeps the lowest one it passes.
+
+template<size_t MaxNodes>
+struct SuffixTrie {
+    struct Node {
+        unsigned char byte;
+        short first_child;
+        short next_sibling;
+        short rank;
+    };
+
+    Node nodes[MaxNodes];
+    size_t count;
+
+    // Length of the suffix that the list would strip from word[0, len),
+    // requiring len > rv + suffix length; 0 if none applies.
+    size_t match(const char* word, size_t len, size_t rv) const {
+        size_t best_len = 0;
+        short best_rank = -1;
+        short node = 0;
+        for (size_t depth = 1; depth <= len; ++depth) {
+            unsigned char c = word[len - depth];
+            short child = nodes[node].first_child;
+            while (child >= 0 && nodes[child].byte != c)
+                child = nodes[child].next_sibling;
+            if (child < 0) break;
+            node = child;
+            if (len <= rv + depth) break;
+            short rank = nodes[node].rank;
+            if (rank >= 0 && (best_rank < 0 || rank < best_rank)) {
+                best_rank = rank;
+                best_len = depth;
+            }
+        }
+        return best_len;
+    }
+};
+
+constexpr size_t c_strlen(const char* s) {
+    size_t n = 0;
+    while (s[n]) ++n;
+    return n;
+}
+
+template<size_t K>
+constexpr size_t trie_bound(const char* const (&suffixes)[K]) {
+    size_t n = 1;
+    for (size_t i = 0; i < K; ++i)
+        n += c_strlen(suffixes[i]);
+    return n;
+}
+
+template<size_t MaxNodes, size_t K>
+constexpr SuffixTrie<MaxNodes> build_trie(const char* const (&suffixes)[K]) {
+    SuffixTrie<MaxNodes> trie{};
+    trie.nodes[0] = {0, -1, -1, -1};
+    trie.count = 1;
+    for (size_t i = 0; i < K; ++i) {
+        size_t len = c_strlen(suffixes[i]);
+        short node = 0;
+        for (size_t d = 1; d <= len; ++d) {
+            unsigned char c = suffixes[i][len - d];
+            short child = trie.nodes[node].first_child;
+            while (child >= 0 && trie.nodes[child].byte != c)
+                child = trie.nodes[child].next_sibling;
+            if (child < 0) {
+                child = static_cast<short>(trie.count++);
+                trie.nodes[child] = {c, -1, trie.nodes[node].first_child, -1};
+                trie.nodes[node].first_child = child;
+            }
+            node = child;
+        }
+        if (trie.nodes[node].rank < 0) trie.nodes[node].rank = static_cast<short>(i);
+    }
+    return trie;
+}
+
+static constexpr const char* PERFECTIVE[] = {
+    "\xD0\xB8\xD0\xB2\xD1\x88\xD0\xB8\xD1\x81\xD1\x8C",
+    "\xD1\x8B\xD0\xB2\xD1\x88\xD0\xB8\xD1\x81\xD1\x8C",
+    "\xD0\xB2\xD1\x88\xD0\xB8\xD1\x81\xD1\x8C",
+    "\xD0\xB8\xD0\xB2\xD1\x88\xD0\xB8",
+    "\xD1\x8B\xD0\xB2\xD1\x88\xD0\xB8",
+    "\xD0\xB2\xD1\x88\xD0\xB8",
+    "\xD0\xB8\xD0\xB2",
+    "\xD1\x8B\xD0\xB2",
+    "\xD0\xB2",
+};
+
+static constexpr const char* REFLEXIVE[] = {
+    "\xD1\x81\xD1\x8F",
+    "\xD1\x81\xD1\x8C",
+};
+
+static constexpr const char* ADJECTIVE[] = {
+    "\xD0\xB8\xD0\xBC\xD0\xB8",
+    "\xD1\x8B\xD0\xBC\xD0\xB8",
+    "\xD0\xB5\xD0\xB3\xD0\xBE",
+    "\xD0\xBE\xD0\xB3\xD0\xBE",
+    "\xD0\xB5\xD0\xBC\xD1\x83",
+    "\xD0\xBE\xD0\xBC\xD1\x83",
+    "\xD0\xB5\xD0\xB5",
+    "\xD0\xB8\xD0\xB5",
+    "\xD1\x8B\xD0\xB5",
+    "\xD0\xBE\xD0\xB5",
+    "\xD0\xB5\xD0\xB9",
+    "\xD0\xB8\xD0\xB9",
+    "\xD1\x8B\xD0\xB9",
+    "\xD0\xBE\xD0\xB9",
+    "\xD0\xB5\xD0\xBC",
+    "\xD0\xB8\xD0\xBC",
+    "\xD1\x8B\xD0\xBC",
+    "\xD0\xBE\xD0\xBC",
+    "\xD0\xB8\xD1\x85",
+    "\xD1\x8B\xD1\x85",
+    "\xD1\x83\xD1\x8E",
+    "\xD1\x8E\xD1\x8E",
+    "\xD0\xB0\xD1\x8F",
+    "\xD1\x8F\xD1\x8F",
+    "\xD0\xBE\xD1\x8E",
+    "\xD0\xB5\xD1\x8E",
+};
+
+static constexpr const char* NOUN[] = {
+    "\xD0\xB8\xD1\x8F\xD0\xBC\xD0\xB8",
+    "\xD1\x8F\xD0\xBC\xD0\xB8",
+    "\xD0\xB0\xD0\xBC\xD0\xB8",
+    "\xD0\xB8\xD0\xB5\xD0\xB9",
+    "\xD0\xB8\xD1\x8F\xD0\xBC",
+    "\xD0\xB8\xD0\xB5\xD0\xBC",
+    "\xD0\xB8\xD1\x8F\xD1\x85",
+    "\xD0\xBE\xD0\xB2",
+    "\xD0\xB5\xD0\xB2",
+    "\xD0\xB5\xD0\xB9",
+    "\xD0\xBE\xD0\xB9",
+    "\xD0\xB8\xD0\xB9",
+    "\xD1\x8F\xD0\xBC",
+    "\xD0\xB5\xD0\xBC",
+    "\xD0\xB0\xD0\xBC",
+    "\xD0\xBE\xD0\xBC",
+    "\xD0\xB0\xD1\x85",
+    "\xD1\x8F\xD1\x85",
+    "\xD0\xB8\xD1\x8E",
+    "\xD1\x8C\xD1\x8E",
+    "\xD1\x8C\xD1\x8F",
+    "\xD1\x8C\xD0\xB5",
+    "\xD0\xB8\xD0\xB8",
+    "\xD0\xB8",
+    "\xD1\x8B",
+    "\xD1\x83",
+    "\xD0\xBE",
+    "\xD0\xB9",
+    "\xD0\xB0",
+    "\xD0\xB5",
+    "\xD1\x8F",
+    "\xD1\x8C",
+};
+
+static constexpr const char* VERB[] = {
+    "\xD0\xB5\xD0\xB9\xD1\x82\xD0\xB5",
+    "\xD1\x83\xD0\xB9\xD1\x82\xD0\xB5",
+    "\xD0\xB8\xD1\x82\xD0\xB5",
+    "\xD0\xB9\xD1\x82\xD0\xB5",
+    "\xD0\xB5\xD1\x88\xD1\x8C",
+    "\xD0\xB5\xD1\x82\xD0\xB5",
+    "\xD1\x83\xD1\x8E\xD1\x82",
+    "\xD1\x8E\xD1\x82",
+    "\xD0\xB0\xD1\x82",
+    "\xD1\x8F\xD1\x82",
+    "\xD0\xBD\xD1\x8B",
+    "\xD0\xB5\xD0\xBD",
+    "\xD1\x82\xD1\x8C",
+    "\xD0\xB8\xD1\x88\xD1\x8C",
+    "\xD1\x83\xD1\x8E",
+    "\xD1\x8E",
+    "\xD0\xBB\xD0\xB0",
+    "\xD0\xBD\xD0\xB0",
+    "\xD0\xBB\xD0\xB8",
+    "\xD0\xBB\xD0\xBE",
+    "\xD0\xBD\xD0\xBE",
+    "\xD0\xB5\xD1\x82",
+    "\xD0\xB9",
+    "\xD0\xBB",
+    "\xD0\xBD",
+};
+
+static constexpr const char* DERIVATIONAL[] = {
+    "\xD0\xBE\xD1\x81\xD1\x82\xD1\x8C",
+    "\xD0\xBE\xD1\x81\xD1\x82",
+};
+
+static constexpr const char* SUPERLATIVE[] = {
+    "\xD0\xB5\xD0\xB9\xD1\x88\xD0\xB5",
+    "\xD0\xB5\xD0\xB9\xD1\x88",
+};
+
+static constexpr auto PERFECTIVE_TRIE = build_trie<trie_bound(PERFECTIVE)>(PERFECTIVE);
+static constexpr auto REFLEXIVE_TRIE = build_trie<trie_bound(REFLEXIVE)>(REFLEXIVE);
+static constexpr auto ADJECTIVE_TRIE = build_trie<trie_bound(ADJECTIVE)>(ADJECTIVE);
+static constexpr auto NOUN_TRIE = build_trie<trie_bound(NOUN)>(NOUN);
+static constexpr auto VERB_TRIE = build_trie<trie_bound(VERB)>(VERB);
+static constexpr auto DERIVATIONAL_TRIE = build_trie<trie_bound(DERIVATIONAL)>(DERIVATIONAL);
+static constexpr auto SUPERLATIVE_TRIE = build_trie<trie_bound(SUPERLATIVE)>(SUPERLATIVE);
+
+static bool is_vowel(std::string_view word, size_t pos) {
     if (pos + 1 >= word.size()) return false;
-    
+
     unsigned char c1 = word[pos];
     unsigned char c2 = word[pos + 1];
-    
+
     if (c1 == 0xD0) {
-        return c2 == 0xB0 || c2 == 0xB5 || c2 == 0xB8 || 
-               c2 == 0xBE || c2 == 0xB8;
+        return c2 == 0xB0 || c2 == 0xB5 || c2 == 0xB8 || c2 == 0xBE;
     }
     if (c1 == 0xD1) {
-        return c2 == 0x83 || c2 == 0x8B || c2 == 0x8D || 
+        return c2 == 0x83 || c2 == 0x8B || c2 == 0x8D ||
                c2 == 0x8E || c2 == 0x8F || c2 == 0x91;
     }
-    
+
     return false;
 }
 
-size_t PorterStemmer::get_rv_position(const std::string& word) {
+static size_t get_rv_position(std::string_view word) {
     for (size_t i = 0; i + 1 < word.size(); i += 2) {
         if (is_vowel(word, i)) {
             return i + 2;
@@ -28,248 +233,59 @@ size_t PorterStemmer::get_rv_position(const std::string& word) {
     return word.size();
 }
 
-bool PorterStemmer::ends_with(const std::string& word, const std::string& suffix) {
-    if (suffix.size() > word.size()) return false;
-    return word.compare(word.size() - suffix.size(), suffix.size(), suffix) == 0;
+// Whether word[0, len) ends in the two-byte letter c1 c2 and keeps more
+// than rv bytes without it.
+static bool strip_letter(const char* word, size_t len, size_t rv, unsigned char c1, unsigned char c2) {
+    return len > rv + 2 &&
+           static_cast<unsigned char>(word[len - 2]) == c1 &&
+           static_cast<unsigned char>(word[len - 1]) == c2;
 }
 
-std::string PorterStemmer::remove_suffix(const std::string& word, size_t suffix_len) {
-    return word.substr(0, word.size() - suffix_len);
-}
+size_t PorterStemmer::stem_length(std::string_view word) const {
+    size_t len = word.size();
+    if (len < 4) return len;
 
-bool PorterStemmer::step1(std::string& word, size_t rv) {
-    const char* perfective[] = {
-        "\xD0\xB8\xD0\xB2\xD1\x88\xD0\xB8\xD1\x81\xD1\x8C",
-        "\xD1\x8B\xD0\xB2\xD1\x88\xD0\xB8\xD1\x81\xD1\x8C",
-        "\xD0\xB2\xD1\x88\xD0\xB8\xD1\x81\xD1\x8C",
-        "\xD0\xB8\xD0\xB2\xD1\x88\xD0\xB8",
-        "\xD1\x8B\xD0\xB2\xD1\x88\xD0\xB8",
-        "\xD0\xB2\xD1\x88\xD0\xB8",
-        "\xD0\xB8\xD0\xB2",
-        "\xD1\x8B\xD0\xB2",
-        "\xD0\xB2",
-        nullptr
-    };
-    
-    const char* reflexive[] = {
-        "\xD1\x81\xD1\x8F",
-        "\xD1\x81\xD1\x8C",
-        nullptr
-    };
-    
-    const char* adjective[] = {
-        "\xD0\xB8\xD0\xBC\xD0\xB8",
-        "\xD1\x8B\xD0\xBC\xD0\xB8",
-        "\xD0\xB5\xD0\xB3\xD0\xBE",
-        "\xD0\xBE\xD0\xB3\xD0\xBE",
-        "\xD0\xB5\xD0\xBC\xD1\x83",
-        "\xD0\xBE\xD0\xBC\xD1\x83",
-        "\xD0\xB5\xD0\xB5",
-        "\xD0\xB8\xD0\xB5",
-        "\xD1\x8B\xD0\xB5",
-        "\xD0\xBE\xD0\xB5",
-        "\xD0\xB5\xD0\xB9",
-        "\xD0\xB8\xD0\xB9",
-        "\xD1\x8B\xD0\xB9",
-        "\xD0\xBE\xD0\xB9",
-        "\xD0\xB5\xD0\xBC",
-        "\xD0\xB8\xD0\xBC",
-        "\xD1\x8B\xD0\xBC",
-        "\xD0\xBE\xD0\xBC",
-        "\xD0\xB8\xD1\x85",
-        "\xD1\x8B\xD1\x85",
-        "\xD1\x83\xD1\x8E",
-        "\xD1\x8E\xD1\x8E",
-        "\xD0\xB0\xD1\x8F",
-        "\xD1\x8F\xD1\x8F",
-        "\xD0\xBE\xD1\x8E",
-        "\xD0\xB5\xD1\x8E",
-        nullptr
-    };
-    
-    const char* noun[] = {
-        "\xD0\xB8\xD1\x8F\xD0\xBC\xD0\xB8",
-        "\xD1\x8F\xD0\xBC\xD0\xB8",
-        "\xD0\xB0\xD0\xBC\xD0\xB8",
-        "\xD0\xB8\xD0\xB5\xD0\xB9",
-        "\xD0\xB8\xD1\x8F\xD0\xBC",
-        "\xD0\xB8\xD0\xB5\xD0\xBC",
-        "\xD0\xB8\xD1\x8F\xD1\x85",
-        "\xD0\xBE\xD0\xB2",
-        "\xD0\xB5\xD0\xB2",
-        "\xD0\xB5\xD0\xB9",
-        "\xD0\xBE\xD0\xB9",
-        "\xD0\xB8\xD0\xB9",
-        "\xD1\x8F\xD0\xBC",
-        "\xD0\xB5\xD0\xBC",
-        "\xD0\xB0\xD0\xBC",
-        "\xD0\xBE\xD0\xBC",
-        "\xD0\xB0\xD1\x85",
-        "\xD1\x8F\xD1\x85",
-        "\xD0\xB8\xD1\x8E",
-        "\xD1\x8C\xD1\x8E",
-        "\xD1\x8C\xD1\x8F",
-        "\xD1\x8C\xD0\xB5",
-        "\xD0\xB8\xD0\xB8",
-        "\xD0\xB8",
-        "\xD1\x8B",
-        "\xD1\x83",
-        "\xD0\xBE",
-        "\xD0\xB9",
-        "\xD0\xB0",
-        "\xD0\xB5",
-        "\xD1\x8F",
-        "\xD1\x8C",
-        nullptr
-    };
-    
-    const char* verb[] = {
-        "\xD0\xB5\xD0\xB9\xD1\x82\xD0\xB5",
-        "\xD1\x83\xD0\xB9\xD1\x82\xD0\xB5",
-        "\xD0\xB8\xD1\x82\xD0\xB5",
-        "\xD0\xB9\xD1\x82\xD0\xB5",
-        "\xD0\xB5\xD1\x88\xD1\x8C",
-        "\xD0\xB5\xD1\x82\xD0\xB5",
-        "\xD1\x83\xD1\x8E\xD1\x82",
-        "\xD1\x8E\xD1\x82",
-        "\xD0\xB0\xD1\x82",
-        "\xD1\x8F\xD1\x82",
-        "\xD0\xBD\xD1\x8B",
-        "\xD0\xB5\xD0\xBD",
-        "\xD1\x82\xD1\x8C",
-        "\xD0\xB8\xD1\x88\xD1\x8C",
-        "\xD1\x83\xD1\x8E",
-        "\xD1\x8E",
-        "\xD0\xBB\xD0\xB0",
-        "\xD0\xBD\xD0\xB0",
-        "\xD0\xBB\xD0\xB8",
-        "\xD0\xBB\xD0\xBE",
-        "\xD0\xBD\xD0\xBE",
-        "\xD0\xB5\xD1\x82",
-        "\xD0\xB9",
-        "\xD0\xBB",
-        "\xD0\xBD",
-        nullptr
-    };
-    
-    for (int i = 0; perfective[i]; ++i) {
-        std::string suf = perfective[i];
-        if (word.size() > rv + suf.size() && ends_with(word, suf)) {
-            word = remove_suffix(word, suf.size());
-            return true;
-        }
-    }
-    
-    for (int i = 0; reflexive[i]; ++i) {
-        std::string suf = reflexive[i];
-        if (word.size() > rv + suf.size() && ends_with(word, suf)) {
-            word = remove_suffix(word, suf.size());
-            break;
-        }
-    }
-    
-    bool found = false;
-    for (int i = 0; adjective[i]; ++i) {
-        std::string suf = adjective[i];
-        if (word.size() > rv + suf.size() && ends_with(word, suf)) {
-            word = remove_suffix(word, suf.size());
-            found = true;
-            break;
-        }
-    }
-    
-    if (found) return true;
-    
-    for (int i = 0; verb[i]; ++i) {
-        std::string suf = verb[i];
-        if (word.size() > rv + suf.size() && ends_with(word, suf)) {
-            word = remove_suffix(word, suf.size());
-            return true;
-        }
-    }
-    
-    for (int i = 0; noun[i]; ++i) {
-        std::string suf = noun[i];
-        if (word.size() > rv + suf.size() && ends_with(word, suf)) {
-            word = remove_suffix(word, suf.size());
-            return true;
-        }
-    }
-    
-    return false;
-}
+    const char* w = word.data();
+    size_t rv = get_rv_position(word);
 
-bool PorterStemmer::step2(std::string& word, size_t rv) {
-    std::string suf = "\xD0\xB8";
-    if (word.size() > rv + suf.size() && ends_with(word, suf)) {
-        word = remove_suffix(word, suf.size());
-        return true;
+    // Step 1: perfective gerund, else reflexive followed by adjective,
+    // verb or noun endings.
+    size_t cut = PERFECTIVE_TRIE.match(w, len, rv);
+    if (cut) {
+        len -= cut;
+    } else {
+        len -= REFLEXIVE_TRIE.match(w, len, rv);
+        if ((cut = ADJECTIVE_TRIE.match(w, len, rv)) ||
+            (cut = VERB_TRIE.match(w, len, rv)) ||
+            (cut = NOUN_TRIE.match(w, len, rv)))
+            len -= cut;
     }
-    return false;
-}
 
-bool PorterStemmer::step3(std::string& word, size_t rv) {
-    const char* derivational[] = {
-        "\xD0\xBE\xD1\x81\xD1\x82\xD1\x8C",
-        "\xD0\xBE\xD1\x81\xD1\x82",
-        nullptr
-    };
-    
-    for (int i = 0; derivational[i]; ++i) {
-        std::string suf = derivational[i];
-        if (word.size() > rv + suf.size() && ends_with(word, suf)) {
-            word = remove_suffix(word, suf.size());
-            return true;
-        }
-    }
-    return false;
-}
+    // Step 2: и.
+    if (strip_letter(w, len, rv, 0xD0, 0xB8)) len -= 2;
 
-bool PorterStemmer::step4(std::string& word, size_t rv) {
-    std::string nn = "\xD0\xBD\xD0\xBD";
-    if (word.size() > rv + nn.size() && ends_with(word, nn)) {
-        word = remove_suffix(word, 2);
-        return true;
-    }
-    
-    const char* superlative[] = {
-        "\xD0\xB5\xD0\xB9\xD1\x88\xD0\xB5",
-        "\xD0\xB5\xD0\xB9\xD1\x88",
-        nullptr
-    };
-    
-    for (int i = 0; superlative[i]; ++i) {
-        std::string suf = superlative[i];
-        if (word.size() > rv + suf.size() && ends_with(word, suf)) {
-            word = remove_suffix(word, suf.size());
-            if (word.size() > rv + nn.size() && ends_with(word, nn)) {
-                word = remove_suffix(word, 2);
-            }
-            return true;
-        }
-    }
-    
-    std::string soft = "\xD1\x8C";
-    if (word.size() > rv + soft.size() && ends_with(word, soft)) {
-        word = remove_suffix(word, soft.size());
-        return true;
+    // Step 3: derivational ость/ост.
+    len -= DERIVATIONAL_TRIE.match(w, len, rv);
+
+    // Step 4: нн, superlative (then нн), or ь.
+    bool nn = len > rv + 4 &&
+              static_cast<unsigned char>(w[len - 4]) == 0xD0 && static_cast<unsigned char>(w[len - 3]) == 0xBD &&
+              static_cast<unsigned char>(w[len - 2]) == 0xD0 && static_cast<unsigned char>(w[len - 1]) == 0xBD;
+    if (nn) {
+        len -= 2;
+    } else if ((cut = SUPERLATIVE_TRIE.match(w, len, rv))) {
+        len -= cut;
+        if (len > rv + 4 &&
+            static_cast<unsigned char>(w[len - 4]) == 0xD0 && static_cast<unsigned char>(w[len - 3]) == 0xBD &&
+            static_cast<unsigned char>(w[len - 2]) == 0xD0 && static_cast<unsigned char>(w[len - 1]) == 0xBD)
+            len -= 2;
+    } else if (strip_letter(w, len, rv, 0xD1, 0x8C)) {
+        len -= 2;
     }
-    
-    return false;
+
+    return len;
 }
 
-std::string PorterStemmer::stem(const std::string& word) {
-    if (word.size() < 4) {
-        return word;
-    }
-    
-    std::string result = word;
-    size_t rv = get_rv_position(result);
-    
-    step1(result, rv);
-    step2(result, rv);
-    step3(result, rv);
-    step4(result, rv);
-    
-    return result;
+std::string PorterStemmer::stem(const std::string& word) const {
+    return word.substr(0, stem_length(word));
 }
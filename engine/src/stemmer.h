@@ -1,22 +1,17 @@
 #ifndef STEMMER_H
 #define STEMMER_H
 
+#include <cstddef>
 #include <string>
+#include <string_view>
 
+// Russian Porter-style stemmer. Every step only strips a suffix, so the
+// stem is always a prefix of the word: stem_length() returns its length
+// without copying or allocating.
 class PorterStemmer {
 public:
-    std::string stem(const std::string& word);
-
-private:
-    bool ends_with(const std::string& word, const std::string& suffix);
-    std::string remove_suffix(const std::string& word, size_t suffix_len);
-    size_t get_rv_position(const std::string& word);
-    bool is_vowel(const std::string& word, size_t pos);
-    
-    bool step1(std::string& word, size_t rv);
-    bool step2(std::string& word, size_t rv);
-    bool step3(std::string& word, size_t rv);
-    bool step4(std::string& word, size_t rv);
+    size_t stem_length(std::string_view word) const;
+    std::string stem(const std::string& word) const;
 };
 
 #endif
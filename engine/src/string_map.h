@@ -2,220 +2,411 @@
 #define STRING_MAP_H
 
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <new>
 #include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Open-addressing map from byte strings, laid out like a SwissTable. Each
+// slot has a control byte: EMPTY, DELETED, or the top 7 bits of the key's
+// hash. Lookups compare a group of 16 control bytes against the tag at
+// once and only touch slots whose tag matches; the full hash is stored in
+// the slot so a tag collision rarely reaches the key bytes, and rehashing
+// never recomputes it. Keys live back to back in an arena of fixed-size
+// chunks that are never reallocated; erase() leaves its key bytes behind,
+// and a rehash compacts the arena only once they make up half of it, so
+// keys otherwise stay in insertion order.
+//
+// Capacity is a power of two of at least one group. The first group's
+// control bytes are mirrored past the end so a group load never wraps.
+//
+// Growth is incremental: the full table is kept as old_ and every insert
+// of a new key moves the next MIGRATE_STEP of its slots across, so no
+// single insert pays for a whole-table rehash. Until it is drained,
+// lookups fall back to old_. Slot storage is raw memory: a slot's value
+// is constructed when it fills and destroyed when it empties, so a new
+// table costs no per-slot work up front. Values are only ever moved, never
+// copied, so V may be move-only as long as the const V& insert() is not
+// used.
 template<typename V>
 class StringMap {
 private:
-    struct Entry {
-        char* key;
+    struct Slot {
+        uint64_t hash;
+        size_t key_ref;     // arena chunk << 32 | offset within the chunk
         size_t key_len;
         V value;
-        bool occupied;
-        bool deleted;
+    };
+
+    struct Table {
+        int8_t* ctrl;
+        Slot* slots;
+        size_t capacity;
+
+        Table() : ctrl(nullptr), slots(nullptr), capacity(0) {}
+    };
+
+    static const size_t GROUP = 16;
+    static const size_t MIGRATE_STEP = 128;
+    static const size_t KEY_CHUNK = 65536;
+    static const int8_t CTRL_EMPTY = -128;
+    static const int8_t CTRL_DELETED = -2;
+
+    Table table_;
+    Table old_;
+    size_t migrated_;
+    std::vector<std::string> key_chunks_;
+    size_t key_bytes_;
+    size_t size_;
+    size_t live_;
+    size_t deleted_;
+    size_t garbage_;
 
-        Entry() : key(nullptr), key_len(0), occupied(false), deleted(false) {}
-        ~Entry() { 
-            if (key) delete[] key; 
+    static uint64_t hash_key(std::string_view key) {
+        const char* p = key.data();
+        size_t n = key.size();
+        uint64_t h = 0x9E3779B97F4A7C15ull ^ (n * 0xFF51AFD7ED558CCDull);
+        while (n >= 8) {
+            uint64_t w;
+            std::memcpy(&w, p, 8);
+            h = (h ^ (w * 0x87C37B91114253D5ull)) * 0x4CF5AD432745937Full;
+            h ^= h >> 29;
+            p += 8;
+            n -= 8;
+        }
+        if (n > 0) {
+            uint64_t w = 0;
+            std::memcpy(&w, p, n);
+            h = (h ^ (w * 0x87C37B91114253D5ull)) * 0x4CF5AD432745937Full;
         }
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ull;
+        h ^= h >> 33;
+        return h;
+    }
 
-        Entry(const Entry& other) : key(nullptr), key_len(other.key_len), 
-                                     value(other.value), occupied(other.occupied), 
-                                     deleted(other.deleted) {
-            if (other.key && other.key_len > 0) {
-                key = new char[key_len + 1];
-                std::memcpy(key, other.key, key_len);
-                key[key_len] = '\0';
-            }
+    static int8_t tag_of(uint64_t h) { return static_cast<int8_t>(h >> 57); }
+
+    // Bit i is set when control byte i of the group equals c.
+    static uint32_t match_byte(const int8_t* group, int8_t c) {
+#if defined(__SSE2__)
+        __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(c))));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP; ++i)
+            if (group[i] == c) mask |= 1u << i;
+        return mask;
+#endif
+    }
+
+    // Bit i is set when slot i of the group is EMPTY or DELETED.
+    static uint32_t match_free(const int8_t* group) {
+#if defined(__SSE2__)
+        __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(g));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP; ++i)
+            if (group[i] < 0) mask |= 1u << i;
+        return mask;
+#endif
+    }
+
+    static void set_ctrl(Table& t, size_t idx, int8_t c) {
+        t.ctrl[idx] = c;
+        if (idx < GROUP) t.ctrl[t.capacity + idx] = c;
+    }
+
+    static Table allocate(size_t capacity) {
+        Table t;
+        t.capacity = capacity;
+        t.ctrl = new int8_t[capacity + GROUP];
+        std::memset(t.ctrl, CTRL_EMPTY, capacity + GROUP);
+        t.slots = static_cast<Slot*>(::operator new(capacity * sizeof(Slot)));
+        return t;
+    }
+
+    static void release(Table& t) {
+        for (size_t i = 0; i < t.capacity; ++i)
+            if (t.ctrl[i] >= 0) t.slots[i].value.~V();
+        delete[] t.ctrl;
+        ::operator delete(t.slots);
+        t = Table();
+    }
+
+    const char* key_data(const Slot& s) const {
+        return key_chunks_[s.key_ref >> 32].data() + (s.key_ref & 0xFFFFFFFFu);
+    }
+
+    // Appends key to the last chunk, or to a new one when it does not fit
+    // in the reserved space, so stored keys never move.
+    static size_t store_key(std::vector<std::string>& chunks, std::string_view key) {
+        if (chunks.empty() || chunks.back().capacity() - chunks.back().size() < key.size()) {
+            chunks.push_back(std::string());
+            chunks.back().reserve(key.size() > KEY_CHUNK ? key.size() : KEY_CHUNK);
         }
+        std::string& chunk = chunks.back();
+        size_t ref = (chunks.size() - 1) << 32 | chunk.size();
+        chunk.append(key.data(), key.size());
+        return ref;
+    }
 
-        Entry& operator=(const Entry& other) {
-            if (this != &other) {
-                if (key) delete[] key;
-                key = nullptr;
-                key_len = other.key_len;
-                value = other.value;
-                occupied = other.occupied;
-                deleted = other.deleted;
-                if (other.key && other.key_len > 0) {
-                    key = new char[key_len + 1];
-                    std::memcpy(key, other.key, key_len);
-                    key[key_len] = '\0';
-                }
+    static size_t capacity_for(size_t n) {
+        size_t p = GROUP;
+        while (p < n) p *= 2;
+        return p;
+    }
+
+    // Probing visits groups at triangular offsets, which covers every group
+    // of a power-of-two table, and the load limit guarantees an EMPTY slot.
+    size_t find_in(const Table& t, std::string_view key, uint64_t h) const {
+        size_t mask = t.capacity - 1;
+        size_t pos = h & mask;
+        int8_t tag = tag_of(h);
+        for (size_t stride = GROUP;; stride += GROUP) {
+            const int8_t* group = t.ctrl + pos;
+            for (uint32_t m = match_byte(group, tag); m; m &= m - 1) {
+                size_t idx = (pos + __builtin_ctz(m)) & mask;
+                const Slot& s = t.slots[idx];
+                if (s.hash == h && s.key_len == key.size() &&
+                    (key.empty() || std::memcmp(key_data(s), key.data(), key.size()) == 0))
+                    return idx;
             }
-            return *this;
+            if (match_byte(group, CTRL_EMPTY)) return t.capacity;
+            pos = (pos + stride) & mask;
         }
-    };
-
-    Entry* buckets_;
-    size_t capacity_;
-    size_t size_;
-    static constexpr double LOAD_FACTOR = 0.5;
+    }
 
-    size_t hash1(const char* str, size_t len) const {
-        size_t h = 5381;
-        for (size_t i = 0; i < len; ++i) {
-            h = ((h << 5) + h) + static_cast<unsigned char>(str[i]);
+    static size_t free_in(const Table& t, uint64_t h) {
+        size_t mask = t.capacity - 1;
+        size_t pos = h & mask;
+        for (size_t stride = GROUP;; stride += GROUP) {
+            uint32_t m = match_free(t.ctrl + pos);
+            if (m) return (pos + __builtin_ctz(m)) & mask;
+            pos = (pos + stride) & mask;
         }
-        return h % capacity_;
     }
 
-    size_t hash2(const char* str, size_t len) const {
-        size_t h = 0;
-        for (size_t i = 0; i < len; ++i) {
-            h = h * 37 + static_cast<unsigned char>(str[i]);
+    Slot* lookup(std::string_view key, uint64_t h) const {
+        size_t idx = find_in(table_, key, h);
+        if (idx != table_.capacity) return &table_.slots[idx];
+        if (old_.capacity) {
+            idx = find_in(old_, key, h);
+            if (idx != old_.capacity) return &old_.slots[idx];
         }
-        return ((h % (capacity_ - 1)) | 1);
+        return nullptr;
     }
 
-    bool keys_equal(const char* k1, size_t len1, const char* k2, size_t len2) const {
-        if (len1 != len2) return false;
-        return std::memcmp(k1, k2, len1) == 0;
+    // Moves up to budget slots of old_ into table_. A moved slot becomes a
+    // tombstone so probe runs through old_ stay intact.
+    void migrate(size_t budget) {
+        size_t end = old_.capacity - migrated_ > budget ? migrated_ + budget : old_.capacity;
+        for (; migrated_ < end; ++migrated_) {
+            if (old_.ctrl[migrated_] < 0) continue;
+            Slot& from = old_.slots[migrated_];
+            size_t idx = free_in(table_, from.hash);
+            set_ctrl(table_, idx, tag_of(from.hash));
+            Slot& to = table_.slots[idx];
+            to.hash = from.hash;
+            to.key_ref = from.key_ref;
+            to.key_len = from.key_len;
+            new (&to.value) V(std::move(from.value));
+            from.value.~V();
+            set_ctrl(old_, migrated_, CTRL_DELETED);
+            ++live_;
+        }
+        if (migrated_ == old_.capacity) release(old_);
     }
 
-    void rehash() {
-        size_t old_capacity = capacity_;
-        Entry* old_buckets = buckets_;
+    void compact_keys() {
+        std::vector<std::string> chunks;
+        for (size_t i = 0; i < table_.capacity; ++i) {
+            if (table_.ctrl[i] < 0) continue;
+            Slot& s = table_.slots[i];
+            s.key_ref = store_key(chunks, std::string_view(key_data(s), s.key_len));
+        }
+        key_chunks_.swap(chunks);
+        key_bytes_ -= garbage_;
+        garbage_ = 0;
+    }
 
-        capacity_ = capacity_ * 2;
-        buckets_ = new Entry[capacity_];
-        size_ = 0;
+    // Retires the current table to old_ and starts draining it into a
+    // fresh one of the given capacity.
+    void start_resize(size_t capacity) {
+        if (old_.capacity) migrate(old_.capacity);
+        if (garbage_ * 2 > key_bytes_) compact_keys();
+        old_ = table_;
+        migrated_ = 0;
+        table_ = allocate(capacity);
+        live_ = 0;
+        deleted_ = 0;
+    }
 
-        for (size_t i = 0; i < old_capacity; ++i) {
-            if (old_buckets[i].occupied && !old_buckets[i].deleted) {
-                insert(old_buckets[i].key, old_buckets[i].key_len, old_buckets[i].value);
-            }
+    // Takes a free slot for a key known to be absent; its value is V().
+    size_t claim(std::string_view key, uint64_t h) {
+        if (old_.capacity) migrate(MIGRATE_STEP);
+        if ((live_ + deleted_ + 1) * 8 > table_.capacity * 7) {
+            // Tombstones left by erase() count towards the load factor; if
+            // they make up most of it, rebuilding at the same size clears them.
+            if (old_.capacity) migrate(old_.capacity);
+            start_resize(deleted_ > live_ ? table_.capacity : table_.capacity * 2);
+            migrate(MIGRATE_STEP);
         }
-
-        delete[] old_buckets;
+        size_t idx = free_in(table_, h);
+        if (table_.ctrl[idx] == CTRL_DELETED) --deleted_;
+        set_ctrl(table_, idx, tag_of(h));
+        Slot& s = table_.slots[idx];
+        s.hash = h;
+        s.key_ref = store_key(key_chunks_, key);
+        s.key_len = key.size();
+        new (&s.value) V();
+        key_bytes_ += key.size();
+        ++size_;
+        ++live_;
+        return idx;
     }
 
 public:
-    StringMap(size_t initial_capacity = 16384) 
-        : capacity_(initial_capacity), size_(0) {
-        buckets_ = new Entry[capacity_];
+    StringMap(size_t initial_capacity = 16384)
+        : migrated_(0), key_bytes_(0), size_(0), live_(0), deleted_(0), garbage_(0) {
+        table_ = allocate(capacity_for(initial_capacity));
     }
 
     ~StringMap() {
-        delete[] buckets_;
+        release(table_);
+        release(old_);
     }
 
     StringMap(const StringMap&) = delete;
     StringMap& operator=(const StringMap&) = delete;
 
-    void insert(const char* key, size_t key_len, const V& value) {
-        if (static_cast<double>(size_ + 1) / capacity_ > LOAD_FACTOR) {
-            rehash();
-        }
-
-        size_t h1 = hash1(key, key_len);
-        size_t h2 = hash2(key, key_len);
-        size_t idx = h1;
-
-        for (size_t i = 0; i < capacity_; ++i) {
-            if (!buckets_[idx].occupied || buckets_[idx].deleted) {
-                if (buckets_[idx].key) delete[] buckets_[idx].key;
-                buckets_[idx].key = new char[key_len + 1];
-                std::memcpy(buckets_[idx].key, key, key_len);
-                buckets_[idx].key[key_len] = '\0';
-                buckets_[idx].key_len = key_len;
-                buckets_[idx].value = value;
-                buckets_[idx].occupied = true;
-                buckets_[idx].deleted = false;
-                ++size_;
-                return;
-            }
-            if (keys_equal(buckets_[idx].key, buckets_[idx].key_len, key, key_len)) {
-                buckets_[idx].value = value;
-                return;
-            }
-            idx = (idx + h2) % capacity_;
-        }
+    void insert(std::string_view key, const V& value) {
+        get_or_create(key) = value;
     }
 
-    void insert(const std::string& key, const V& value) {
-        insert(key.c_str(), key.size(), value);
+    void insert(std::string_view key, V&& value) {
+        get_or_create(key) = std::move(value);
     }
 
-    V* find(const char* key, size_t key_len) {
-        size_t h1 = hash1(key, key_len);
-        size_t h2 = hash2(key, key_len);
-        size_t idx = h1;
+    V* find(std::string_view key) {
+        Slot* s = lookup(key, hash_key(key));
+        return s ? &s->value : nullptr;
+    }
 
-        for (size_t i = 0; i < capacity_; ++i) {
-            if (!buckets_[idx].occupied) {
-                return nullptr;
-            }
-            if (buckets_[idx].occupied && !buckets_[idx].deleted && 
-                keys_equal(buckets_[idx].key, buckets_[idx].key_len, key, key_len)) {
-                return &buckets_[idx].value;
-            }
-            idx = (idx + h2) % capacity_;
-        }
-        return nullptr;
+    const V* find(std::string_view key) const {
+        const Slot* s = lookup(key, hash_key(key));
+        return s ? &s->value : nullptr;
     }
 
-    V* find(const std::string& key) {
-        return find(key.c_str(), key.size());
+    V& get_or_create(std::string_view key) {
+        uint64_t h = hash_key(key);
+        Slot* s = lookup(key, h);
+        if (s) return s->value;
+        size_t idx = claim(key, h);
+        return table_.slots[idx].value;
     }
 
-    const V* find(const std::string& key) const {
-        return const_cast<StringMap*>(this)->find(key.c_str(), key.size());
+    // As get_or_create(), also pointing stored at the map's own copy of the
+    // key. Keys only move when a rehash compacts away erased ones, so in a
+    // map that is never erased from the view lives as long as the key.
+    V& get_or_create(std::string_view key, std::string_view& stored) {
+        uint64_t h = hash_key(key);
+        Slot* s = lookup(key, h);
+        if (!s) {
+            size_t idx = claim(key, h);
+            s = &table_.slots[idx];
+        }
+        stored = std::string_view(key_data(*s), s->key_len);
+        return s->value;
     }
 
-    V& get_or_create(const std::string& key) {
-        V* val = find(key);
-        if (val) return *val;
-        insert(key, V());
-        val = find(key);
-        if (!val) {
-            rehash();
-            insert(key, V());
-            val = find(key);
+    bool erase(std::string_view key) {
+        uint64_t h = hash_key(key);
+        Slot* s;
+        size_t idx = find_in(table_, key, h);
+        if (idx != table_.capacity) {
+            set_ctrl(table_, idx, CTRL_DELETED);
+            s = &table_.slots[idx];
+            --live_;
+            ++deleted_;
+        } else if (old_.capacity && (idx = find_in(old_, key, h)) != old_.capacity) {
+            set_ctrl(old_, idx, CTRL_DELETED);
+            s = &old_.slots[idx];
+        } else {
+            return false;
         }
-        return *val;
+        garbage_ += s->key_len;
+        s->value.~V();
+        --size_;
+        return true;
     }
 
-    bool contains(const std::string& key) const {
-        return const_cast<StringMap*>(this)->find(key) != nullptr;
+    bool contains(std::string_view key) const {
+        return lookup(key, hash_key(key)) != nullptr;
     }
 
     size_t size() const { return size_; }
+    size_t capacity() const { return table_.capacity; }
 
     void clear() {
-        for (size_t i = 0; i < capacity_; ++i) {
-            if (buckets_[i].key) { delete[] buckets_[i].key; buckets_[i].key = nullptr; }
-            buckets_[i].occupied = false;
-            buckets_[i].deleted = false;
-        }
+        release(old_);
+        for (size_t i = 0; i < table_.capacity; ++i)
+            if (table_.ctrl[i] >= 0) table_.slots[i].value.~V();
+        std::memset(table_.ctrl, CTRL_EMPTY, table_.capacity + GROUP);
+        key_chunks_.clear();
+        key_bytes_ = 0;
         size_ = 0;
+        live_ = 0;
+        deleted_ = 0;
+        garbage_ = 0;
     }
 
+    // Sized up front, so the table is rebuilt at once rather than drained.
     void reserve(size_t n) {
-        size_t needed = static_cast<size_t>(n / LOAD_FACTOR) + 1;
-        size_t p = 1;
-        while (p < needed) p *= 2;
-        if (p <= capacity_) return;
-        size_t old_capacity = capacity_;
-        Entry* old_buckets = buckets_;
-        capacity_ = p;
-        buckets_ = new Entry[capacity_];
-        size_ = 0;
-        for (size_t i = 0; i < old_capacity; ++i) {
-            if (old_buckets[i].occupied && !old_buckets[i].deleted) {
-                insert(old_buckets[i].key, old_buckets[i].key_len, old_buckets[i].value);
+        size_t p = capacity_for(n + n / 7 + 1);
+        if (p <= table_.capacity) return;
+        start_resize(p);
+        migrate(old_.capacity);
+    }
+
+    template<typename Func>
+    void for_each(Func func) const {
+        for (size_t i = 0; i < table_.capacity; ++i) {
+            if (table_.ctrl[i] >= 0) {
+                const Slot& s = table_.slots[i];
+                func(std::string_view(key_data(s), s.key_len), s.value);
+            }
+        }
+        for (size_t i = migrated_; i < old_.capacity; ++i) {
+            if (old_.ctrl[i] >= 0) {
+                const Slot& s = old_.slots[i];
+                func(std::string_view(key_data(s), s.key_len), s.value);
             }
         }
-        delete[] old_buckets;
     }
 
     template<typename Func>
-    void for_each(Func func) const {
-        for (size_t i = 0; i < capacity_; ++i) {
-            if (buckets_[i].occupied && !buckets_[i].deleted) {
-                func(std::string(buckets_[i].key, buckets_[i].key_len), buckets_[i].value);
+    void for_each(Func func) {
+        for (size_t i = 0; i < table_.capacity; ++i) {
+            if (table_.ctrl[i] >= 0) {
+                Slot& s = table_.slots[i];
+                func(std::string_view(key_data(s), s.key_len), s.value);
+            }
+        }
+        for (size_t i = migrated_; i < old_.capacity; ++i) {
+            if (old_.ctrl[i] >= 0) {
+                Slot& s = old_.slots[i];
+                func(std::string_view(key_data(s), s.key_len), s.value);
             }
         }
     }
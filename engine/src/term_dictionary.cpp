@@ -0,0 +1,45 @@
+#include "term_dictionary.h"
+
+uint32_t TermDictionary::intern(std::string_view term) {
+    if (is_mapped_) {
+        uint32_t id = mapped_.find(term);
+        if (id != NONE) return id;
+        detach();
+    }
+    std::string_view stored;
+    size_t before = ids_.size();
+    uint32_t& id = ids_.get_or_create(term, stored);
+    if (ids_.size() != before) {
+        id = static_cast<uint32_t>(terms_.size());
+        terms_.push_back(stored);
+    }
+    return id;
+}
+
+uint32_t TermDictionary::find(std::string_view term) const {
+    if (is_mapped_) return mapped_.find(term);
+    const uint32_t* id = ids_.find(term);
+    return id ? *id : NONE;
+}
+
+void TermDictionary::detach() {
+    StringTable table = mapped_;
+    clear();
+    reserve(table.size() + 1);
+    for (size_t i = 0; i < table.size(); ++i)
+        intern(table.at(i));
+}
+
+void TermDictionary::write_image(ImageWriter& out, const char* tag) const {
+    std::vector<std::string_view> strings(size());
+    for (size_t i = 0; i < strings.size(); ++i)
+        strings[i] = term(static_cast<uint32_t>(i));
+    out.write_strings(tag, strings, true);
+}
+
+bool TermDictionary::attach_image(const MappedImage& image, const char* tag) {
+    clear();
+    if (!mapped_.attach(image, tag)) return false;
+    is_mapped_ = true;
+    return true;
+}
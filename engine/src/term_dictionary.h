@@ -0,0 +1,47 @@
+#ifndef TERM_DICTIONARY_H
+#define TERM_DICTIONARY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "string_map.h"
+#include "index_image.h"
+
+// Interns terms to dense ids, assigned in first-seen order. The names in
+// terms_ are views into the key arena of ids_, which is never erased
+// from, so every term string is stored exactly once.
+//
+// A dictionary attached to an image serves find() and term() from its
+// sorted string table instead; the first intern() of a new term copies
+// the table into ids_ and detaches.
+class TermDictionary {
+private:
+    StringMap<uint32_t> ids_;
+    std::vector<std::string_view> terms_;
+    StringTable mapped_;
+    bool is_mapped_ = false;
+
+    void detach();
+
+public:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    explicit TermDictionary(size_t capacity = 262144) : ids_(capacity) {}
+
+    TermDictionary(const TermDictionary&) = delete;
+    TermDictionary& operator=(const TermDictionary&) = delete;
+
+    uint32_t intern(std::string_view term);
+    uint32_t find(std::string_view term) const;
+    std::string_view term(uint32_t id) const { return is_mapped_ ? mapped_.at(id) : terms_[id]; }
+    size_t size() const { return is_mapped_ ? mapped_.size() : terms_.size(); }
+
+    void reserve(size_t n) { ids_.reserve(n); terms_.reserve(n); }
+    void clear() { ids_.clear(); terms_.clear(); mapped_ = StringTable(); is_mapped_ = false; }
+
+    void write_image(ImageWriter& out, const char* tag) const;
+    bool attach_image(const MappedImage& image, const char* tag);
+};
+
+#endif
@@ -0,0 +1,161 @@
+#include "text_codec.h"
+#include <cstring>
+
+static const size_t MIN_MATCH = 4;
+// A match must start at least MATCH_GUARD bytes before the end and leave
+// the last LAST_LITERALS bytes as literals.
+static const size_t MATCH_GUARD = 12;
+static const size_t LAST_LITERALS = 5;
+static const size_t MAX_OFFSET = 65535;
+static const int HASH_BITS = 14;
+
+static uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+static uint64_t read64(const unsigned char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+
+static uint32_t hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static unsigned char* write_length(unsigned char* op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = static_cast<unsigned char>(len);
+    return op;
+}
+
+static unsigned char* write_literals(unsigned char* op, const unsigned char* lit, size_t n, unsigned char*& token) {
+    token = op++;
+    if (n >= 15) {
+        *token = 15 << 4;
+        op = write_length(op, n - 15);
+    } else {
+        *token = static_cast<unsigned char>(n << 4);
+    }
+    std::memcpy(op, lit, n);
+    return op + n;
+}
+
+size_t text_compress(const char* in, size_t n, char* out) {
+    const unsigned char* src = reinterpret_cast<const unsigned char*>(in);
+    const unsigned char* end = src + n;
+    const unsigned char* anchor = src;
+    unsigned char* op = reinterpret_cast<unsigned char*>(out);
+    unsigned char* token;
+
+    if (n > MATCH_GUARD) {
+        uint32_t table[1 << HASH_BITS];
+        std::memset(table, 0, sizeof(table));
+        const unsigned char* start_limit = end - MATCH_GUARD;
+        const unsigned char* match_limit = end - LAST_LITERALS;
+        const unsigned char* ip = src + 1;
+        while (ip < start_limit) {
+            uint32_t seq = read32(ip);
+            uint32_t h = hash4(seq);
+            const unsigned char* ref = src + table[h];
+            table[h] = static_cast<uint32_t>(ip - src);
+            if (ref >= ip || static_cast<size_t>(ip - ref) > MAX_OFFSET || read32(ref) != seq) {
+                ++ip;
+                continue;
+            }
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                --ip;
+                --ref;
+            }
+            size_t len = MIN_MATCH;
+            while (ip + len < match_limit) {
+                if (ip + len + 8 <= match_limit) {
+                    uint64_t diff = read64(ip + len) ^ read64(ref + len);
+                    if (diff) {
+                        len += __builtin_ctzll(diff) >> 3;
+                        break;
+                    }
+                    len += 8;
+                } else if (ip[len] == ref[len]) {
+                    ++len;
+                } else {
+                    break;
+                }
+            }
+            op = write_literals(op, anchor, ip - anchor, token);
+            size_t offset = ip - ref;
+            *op++ = static_cast<unsigned char>(offset);
+            *op++ = static_cast<unsigned char>(offset >> 8);
+            size_t ml = len - MIN_MATCH;
+            if (ml >= 15) {
+                *token |= 15;
+                op = write_length(op, ml - 15);
+            } else {
+                *token |= static_cast<unsigned char>(ml);
+            }
+            ip += len;
+            anchor = ip;
+            if (ip < start_limit) table[hash4(read32(ip - 2))] = static_cast<uint32_t>(ip - 2 - src);
+        }
+    }
+    op = write_literals(op, anchor, end - anchor, token);
+    return op - reinterpret_cast<unsigned char*>(out);
+}
+
+static bool read_length(const unsigned char*& ip, const unsigned char* iend, size_t& len) {
+    unsigned char b;
+    do {
+        if (ip >= iend) return false;
+        b = *ip++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+bool text_decompress(const char* in, size_t n, char* out, size_t raw_size) {
+    const unsigned char* ip = reinterpret_cast<const unsigned char*>(in);
+    const unsigned char* iend = ip + n;
+    unsigned char* dst = reinterpret_cast<unsigned char*>(out);
+    unsigned char* op = dst;
+    unsigned char* oend = dst + raw_size;
+
+    while (ip < iend) {
+        unsigned char token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15 && !read_length(ip, iend, lit)) return false;
+        if (lit > static_cast<size_t>(iend - ip) || lit > static_cast<size_t>(oend - op)) return false;
+        // Short runs are copied as one 16-byte chunk when both buffers
+        // have room for the overshoot.
+        if (lit <= 16 && iend - ip >= 16 && oend - op >= 16) std::memcpy(op, ip, 16);
+        else std::memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == iend) break;
+
+        if (iend - ip < 2) return false;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > static_cast<size_t>(op - dst)) return false;
+        size_t len = token & 15;
+        if (len == 15 && !read_length(ip, iend, len)) return false;
+        len += MIN_MATCH;
+        if (len > static_cast<size_t>(oend - op)) return false;
+        const unsigned char* ref = op - offset;
+        if (offset >= 8 && static_cast<size_t>(oend - op) >= len + 8) {
+            for (size_t i = 0; i < len; i += 8)
+                std::memcpy(op + i, ref + i, 8);
+        } else if (offset >= len) {
+            std::memcpy(op, ref, len);
+        } else {
+            for (size_t i = 0; i < len; ++i)
+                op[i] = ref[i];
+        }
+        op += len;
+    }
+    return op == oend;
+}
@@ -0,0 +1,19 @@
+#ifndef TEXT_CODEC_H
+#define TEXT_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+
+// LZ4 block format: sequences of literals followed by a match of at least
+// four bytes at a 16-bit backwards offset; the block ends with five or
+// more bare literals. The compressor is greedy with a single hash table
+// slot per 4-byte prefix, like the reference implementation's fast mode.
+
+inline size_t text_compress_bound(size_t n) { return n + n / 255 + 16; }
+
+// Writes at most text_compress_bound(n) bytes and returns how many.
+size_t text_compress(const char* in, size_t n, char* out);
+// False unless `in` decodes to exactly `raw_size` bytes.
+bool text_decompress(const char* in, size_t n, char* out, size_t raw_size);
+
+#endif
@@ -1,6 +1,10 @@
 #include "tokenizer.h"
 
-bool Tokenizer::is_cyrillic(unsigned char c1, unsigned char c2) {
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static bool is_cyrillic(unsigned char c1, unsigned char c2) {
     if (c1 == 0xD0) {
         return (c2 >= 0x90 && c2 <= 0xBF) || c2 == 0x81;
     }
@@ -10,115 +14,113 @@ bool Tokenizer::is_cyrillic(unsigned char c1, unsigned char c2) {
     return false;
 }
 
-bool Tokenizer::is_letter(unsigned char c) {
-    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+static bool is_word_ascii(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-';
 }
 
-std::string Tokenizer::to_lower(const std::string& str) {
-    std::string result;
-    result.reserve(str.size());
-    
-    for (size_t i = 0; i < str.size(); ++i) {
-        unsigned char c = str[i];
-        
-        if (c >= 'A' && c <= 'Z') {
-            result += (c + 32);
-        } else if (c == 0xD0 && i + 1 < str.size()) {
-            unsigned char c2 = str[i + 1];
-            if (c2 >= 0x90 && c2 <= 0x9F) {
-                result += static_cast<char>(0xD0);
-                result += static_cast<char>(c2 + 0x20);
-                ++i;
-            } else if (c2 >= 0xA0 && c2 <= 0xAF) {
-                result += static_cast<char>(0xD1);
-                result += static_cast<char>(c2 - 0x20);
-                ++i;
-            } else if (c2 == 0x81) {
-                result += static_cast<char>(0xD1);
-                result += static_cast<char>(0x91);
+// Returns the first position at or after i that may start a token: an
+// ASCII letter, digit or '-', or any non-ASCII byte.
+static size_t skip_separators(const char* p, size_t i, size_t n) {
+#if defined(__SSE2__)
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    const __m128i before_a = _mm_set1_epi8('a' - 1);
+    const __m128i after_z = _mm_set1_epi8('z' + 1);
+    const __m128i before_0 = _mm_set1_epi8('0' - 1);
+    const __m128i after_9 = _mm_set1_epi8('9' + 1);
+    const __m128i dash = _mm_set1_epi8('-');
+    while (i + 16 <= n) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        // Bytes >= 0x80 compare as negative, so they fail every range test
+        // below and are picked up by movemask of v itself.
+        __m128i folded = _mm_or_si128(v, case_bit);
+        __m128i word = _mm_and_si128(_mm_cmpgt_epi8(folded, before_a), _mm_cmplt_epi8(folded, after_z));
+        word = _mm_or_si128(word, _mm_and_si128(_mm_cmpgt_epi8(v, before_0), _mm_cmplt_epi8(v, after_9)));
+        word = _mm_or_si128(word, _mm_cmpeq_epi8(v, dash));
+        int mask = _mm_movemask_epi8(word) | _mm_movemask_epi8(v);
+        if (mask) return i + __builtin_ctz(mask);
+        i += 16;
+    }
+#endif
+    while (i < n) {
+        unsigned char c = p[i];
+        if ((c & 0x80) || is_word_ascii(c)) break;
+        ++i;
+    }
+    return i;
+}
+
+void Tokenizer::tokenize(std::string_view text, std::string& arena, std::vector<TokenView>& out) const {
+    out.clear();
+    size_t n = text.size();
+    if (arena.size() < n) arena.resize(n);
+
+    const char* p = text.data();
+    char* dst = &arena[0];
+    size_t used = 0;
+    size_t i = 0;
+
+    while (true) {
+        i = skip_separators(p, i, n);
+        if (i >= n) break;
+
+        size_t start = i;
+        size_t begin = used;
+        size_t chars = 0;
+        bool has_letter = false;
+
+        // Copy the token into the arena, lowercasing as we go.
+        while (i < n) {
+            unsigned char c = p[i];
+            if (c < 0x80) {
+                if (c >= 'A' && c <= 'Z') {
+                    dst[used++] = static_cast<char>(c + 32);
+                    has_letter = true;
+                } else if (is_word_ascii(c)) {
+                    dst[used++] = static_cast<char>(c);
+                    if (c >= 'a') has_letter = true;
+                } else {
+                    break;
+                }
                 ++i;
+            } else if ((c & 0xE0) == 0xC0 && i + 1 < n && is_cyrillic(c, p[i + 1])) {
+                unsigned char c2 = p[i + 1];
+                if (c == 0xD0 && c2 >= 0x90 && c2 <= 0x9F) {
+                    dst[used++] = static_cast<char>(0xD0);
+                    dst[used++] = static_cast<char>(c2 + 0x20);
+                } else if (c == 0xD0 && c2 >= 0xA0 && c2 <= 0xAF) {
+                    dst[used++] = static_cast<char>(0xD1);
+                    dst[used++] = static_cast<char>(c2 - 0x20);
+                } else if (c == 0xD0 && c2 == 0x81) {
+                    dst[used++] = static_cast<char>(0xD1);
+                    dst[used++] = static_cast<char>(0x91);
+                } else {
+                    dst[used++] = static_cast<char>(c);
+                    dst[used++] = static_cast<char>(c2);
+                }
+                has_letter = true;
+                i += 2;
             } else {
-                result += c;
+                break;
             }
-        } else {
-            result += c;
+            ++chars;
         }
-    }
-    
-    return result;
-}
 
-bool Tokenizer::is_valid_token(const std::string& token) {
-    if (token.empty()) return false;
-    
-    size_t char_count = 0;
-    bool has_letter = false;
-    
-    for (size_t i = 0; i < token.size(); ++i) {
-        unsigned char c = token[i];
-        if ((c & 0x80) == 0) {
-            ++char_count;
-            if (is_letter(c)) has_letter = true;
-        } else if ((c & 0xE0) == 0xC0) {
-            ++char_count;
-            has_letter = true;
-            ++i;
-        } else if ((c & 0xF0) == 0xE0) {
-            ++char_count;
-            i += 2;
-        } else if ((c & 0xF8) == 0xF0) {
-            ++char_count;
-            i += 3;
-        }
+        if (chars >= 2 && has_letter) out.push_back({std::string_view(dst + begin, used - begin), start});
+        else used = begin;
+
+        // A non-ASCII byte that is not a Cyrillic letter.
+        if (i == start) ++i;
     }
-    
-    return char_count >= 2 && has_letter;
 }
 
-std::vector<Token> Tokenizer::tokenize(const std::string& text) {
+std::vector<Token> Tokenizer::tokenize(const std::string& text) const {
+    std::string arena;
+    std::vector<TokenView> views;
+    tokenize(text, arena, views);
+
     std::vector<Token> tokens;
-    std::string current_token;
-    size_t token_start = 0;
-    
-    for (size_t i = 0; i < text.size(); ++i) {
-        unsigned char c = text[i];
-        
-        bool is_word_char = false;
-        size_t char_len = 1;
-        
-        if ((c & 0x80) == 0) {
-            is_word_char = is_letter(c) || (c >= '0' && c <= '9') || c == '-';
-        } else if ((c & 0xE0) == 0xC0 && i + 1 < text.size()) {
-            unsigned char c2 = text[i + 1];
-            is_word_char = is_cyrillic(c, c2);
-            char_len = 2;
-        }
-        
-        if (is_word_char) {
-            if (current_token.empty()) {
-                token_start = i;
-            }
-            for (size_t j = 0; j < char_len && i + j < text.size(); ++j) {
-                current_token += text[i + j];
-            }
-            i += char_len - 1;
-        } else {
-            if (!current_token.empty()) {
-                std::string lower_token = to_lower(current_token);
-                if (is_valid_token(lower_token)) {
-                    tokens.push_back({lower_token, token_start});
-                }
-                current_token.clear();
-            }
-        }
-    }
-    
-    if (!current_token.empty()) {
-        std::string lower_token = to_lower(current_token);
-        if (is_valid_token(lower_token)) {
-            tokens.push_back({lower_token, token_start});
-        }
-    }
-    
+    tokens.reserve(views.size());
+    for (size_t i = 0; i < views.size(); ++i)
+        tokens.push_back({std::string(views[i].text), views[i].position});
     return tokens;
 }
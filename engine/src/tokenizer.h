@@ -2,6 +2,7 @@
 #define TOKENIZER_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <cctype>
 
@@ -10,15 +11,20 @@ struct Token {
     size_t position;
 };
 
+struct TokenView {
+    std::string_view text;
+    size_t position;
+};
+
 class Tokenizer {
 public:
-    std::vector<Token> tokenize(const std::string& text);
+    std::vector<Token> tokenize(const std::string& text) const;
 
-private:
-    bool is_cyrillic(unsigned char c1, unsigned char c2);
-    bool is_letter(unsigned char c);
-    std::string to_lower(const std::string& str);
-    bool is_valid_token(const std::string& token);
+    // Zero-copy variant: the lowercased bytes of each kept token are written
+    // into arena and the views in out point there. Lowercasing never changes
+    // a token's byte length, so the arena is at most text.size() bytes; it
+    // is only grown, and views stay valid until the next call with it.
+    void tokenize(std::string_view text, std::string& arena, std::vector<TokenView>& out) const;
 };
 
 #endif
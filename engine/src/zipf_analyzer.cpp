@@ -2,24 +2,21 @@
 #include <iostream>
 #include <cmath>
 
-ZipfAnalyzer::ZipfAnalyzer() : total_terms_(0) {}
-
-void ZipfAnalyzer::add_term(const std::string& term) {
-    size_t* count = term_counts_.find(term);
-    if (count) {
-        (*count)++;
-    } else {
-        term_counts_.insert(term, 1);
-    }
-    ++total_terms_;
-}
+ZipfAnalyzer::ZipfAnalyzer(const SegmentSet& segments) : segments_(segments) {}
 
 size_t ZipfAnalyzer::unique_terms() const {
-    return term_counts_.size();
+    return segments_.vocabulary_size();
 }
 
 size_t ZipfAnalyzer::total_terms() const {
-    return total_terms_;
+    return segments_.total_terms();
+}
+
+size_t ZipfAnalyzer::term_count(const std::string& term) const {
+    size_t count = 0;
+    for (size_t s = 0; s < segments_.segments.size(); ++s)
+        count += segments_.segments[s].index->find_postings(term).total_frequency();
+    return count;
 }
 
 static void merge(std::vector<TermFrequency>& arr, std::vector<TermFrequency>& tmp, size_t left, size_t mid, size_t right) {
@@ -56,10 +53,8 @@ static void sort_terms(std::vector<TermFrequency>& terms) {
 
 std::vector<TermFrequency> ZipfAnalyzer::get_sorted_terms() const {
     std::vector<TermFrequency> terms;
-    terms.reserve(term_counts_.size());
-    
-    term_counts_.for_each([&terms](const std::string& term, size_t freq) {
-        terms.push_back(TermFrequency(term, freq));
+    segments_.for_each_term([&terms](std::string_view term, uint64_t frequency) {
+        terms.push_back(TermFrequency(std::string(term), frequency));
     });
     
     sort_terms(terms);
@@ -73,8 +68,8 @@ std::vector<TermFrequency> ZipfAnalyzer::get_sorted_terms() const {
 
 void ZipfAnalyzer::print_stats() {
     std::cout << "\n=== ZIPF ANALYSIS ===" << std::endl;
-    std::cout << "Total terms: " << total_terms_ << std::endl;
-    std::cout << "Unique terms: " << term_counts_.size() << std::endl;
+    std::cout << "Total terms: " << total_terms() << std::endl;
+    std::cout << "Unique terms: " << unique_terms() << std::endl;
     std::cout.flush();
     
     std::vector<TermFrequency> terms = get_sorted_terms();
@@ -3,7 +3,7 @@
 
 #include <string>
 #include <vector>
-#include "string_map.h"
+#include "segmented_index.h"
 
 struct TermFrequency {
     std::string term;
@@ -14,31 +14,22 @@ struct TermFrequency {
     TermFrequency(const std::string& t, size_t f) : term(t), frequency(f), rank(0) {}
 };
 
+// Term statistics over a segment set. Counts are not stored separately: a
+// term's count is the collection frequency of its posting lists.
 class ZipfAnalyzer {
 private:
-    StringMap<size_t> term_counts_;
-    size_t total_terms_;
+    const SegmentSet& segments_;
     
 public:
-    ZipfAnalyzer();
+    explicit ZipfAnalyzer(const SegmentSet& segments);
     
-    void add_term(const std::string& term);
     void print_stats();
     
     std::vector<TermFrequency> get_sorted_terms() const;
     
     size_t unique_terms() const;
     size_t total_terms() const;
-
-    void clear() { term_counts_.clear(); total_terms_ = 0; }
-    void set_total_terms(size_t n) { total_terms_ = n; }
-    void insert_term_count(const std::string& term, size_t count) { term_counts_.insert(term, count); }
-    void reserve(size_t n) { term_counts_.reserve(n); }
-
-    template<typename Func>
-    void for_each_term_count(Func func) const {
-        term_counts_.for_each(func);
-    }
+    size_t term_count(const std::string& term) const;
 };
 
 #endif
@@ -0,0 +1,186 @@
+#include "inverted_index.h"
+#include "index_image.h"
+#include "test_check.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// InvertedIndex::attach_image() on an intact image, and on copies with one
+// field of a posting list, a block or a section size pointing outside the
+// data it indexes, a doc id past the last document, or a string table
+// whose offsets or sort order are out of range, each of which it must
+// refuse.
+
+static const char* MAGIC = "IDXTEST0";
+
+// Field offsets in the image's per-term ImageEntry, in PostingBlock and
+// in a string table section.
+static const size_t ENTRY_SIZE = 64;
+static const size_t ENTRY_DOC_WORD_BEGIN = 8;
+static const size_t ENTRY_TAIL_BEGIN = 24;
+static const size_t ENTRY_BITMAP_BEGIN = 32;
+static const size_t ENTRY_BLOCK_COUNT = 48;
+static const size_t ENTRY_TAIL_COUNT = 52;
+static const size_t BLOCK_SIZE = 16;
+static const size_t BLOCK_LAST_DOC = 0;
+static const size_t BLOCK_DOC_OFFSET = 4;
+static const size_t BLOCK_FREQ_BITS = 13;
+static const size_t POSTING_SIZE = 8;
+static const size_t STRINGS_OFFSETS = 16;
+
+static std::string read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static void write_file(const std::string& path, const std::string& bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size());
+}
+
+static ImageSection* find_section(std::string& image, const char* tag) {
+    uint64_t directory = 0, count = 0;
+    std::memcpy(&directory, &image[8], 8);
+    std::memcpy(&count, &image[16], 8);
+    ImageSection* sections = reinterpret_cast<ImageSection*>(&image[directory]);
+    for (uint64_t i = 0; i < count; ++i)
+        if (std::memcmp(sections[i].tag, tag, 8) == 0) return &sections[i];
+    CHECK(false);
+    return nullptr;
+}
+
+template<typename T>
+static void patch(std::string& image, const char* tag, size_t offset, T value) {
+    ImageSection* s = find_section(image, tag);
+    CHECK(offset + sizeof(T) <= s->size);
+    std::memcpy(&image[s->offset + offset], &value, sizeof(T));
+}
+
+static bool attaches(const std::string& path, const std::string& bytes) {
+    write_file(path, bytes);
+    MappedImage image;
+    CHECK(image.open(path, MAGIC));
+    InvertedIndex index;
+    return index.attach_image(image);
+}
+
+int main() {
+    // "common" is in every document, so it has full blocks and a bitmap.
+    InvertedIndex built;
+    for (int d = 0; d < 1000; ++d) {
+        std::vector<std::string> terms = {"common", "term" + std::to_string(d % 37)};
+        if (d % 3 == 0) terms.push_back("common");
+        built.add_document("doc" + std::to_string(d), terms);
+    }
+    built.finalize();
+    uint32_t common = built.find_term("common");
+    CHECK(built.postings(common).size() == 1000);
+
+    std::string path = "index_image_test." + std::to_string(getpid()) + ".img";
+    {
+        ImageWriter out;
+        CHECK(out.open(path, MAGIC));
+        built.write_image(out);
+        CHECK(out.finish());
+    }
+    const std::string intact = read_file(path);
+
+    {
+        MappedImage image;
+        CHECK(image.open(path, MAGIC));
+        InvertedIndex mapped;
+        CHECK(mapped.attach_image(image));
+        CHECK(mapped.document_count() == built.document_count());
+        CHECK(mapped.vocabulary_size() == built.vocabulary_size());
+        PostingCursor a(built.postings(common)), b(mapped.postings(common));
+        for (; a.valid(); a.next(), b.next()) {
+            CHECK(b.valid() && a.doc() == b.doc() && a.frequency() == b.frequency());
+        }
+        CHECK(!b.valid());
+        CHECK(mapped.doc_lengths() == built.doc_lengths());
+    }
+
+    std::string bad = intact;
+    size_t entry = common * ENTRY_SIZE;
+    const char* fields = &bad[find_section(bad, "IDXPLIST")->offset + entry];
+    uint64_t block_begin = 0, tail_begin = 0, bitmap_begin = 0;
+    uint32_t block_count = 0, tail_count = 0;
+    std::memcpy(&block_begin, fields, 8);
+    std::memcpy(&tail_begin, fields + ENTRY_TAIL_BEGIN, 8);
+    std::memcpy(&bitmap_begin, fields + ENTRY_BITMAP_BEGIN, 8);
+    std::memcpy(&block_count, fields + ENTRY_BLOCK_COUNT, 4);
+    std::memcpy(&tail_count, fields + ENTRY_TAIL_COUNT, 4);
+    CHECK(block_count > 0 && tail_count > 0 && bitmap_begin != UINT64_MAX);
+    CHECK(find_section(bad, "IDXTAILS")->size / POSTING_SIZE >= tail_begin + 200);
+
+    patch<uint64_t>(bad, "IDXPLIST", entry + ENTRY_BITMAP_BEGIN, 1);
+    CHECK(!attaches(path, bad));
+
+    bad = intact;
+    patch<uint64_t>(bad, "IDXPLIST", entry + ENTRY_DOC_WORD_BEGIN, find_section(bad, "IDXDOCWD")->size / 4 + 1);
+    CHECK(!attaches(path, bad));
+
+    bad = intact;
+    patch<uint32_t>(bad, "IDXPLIST", entry + ENTRY_BLOCK_COUNT, block_count + 1000);
+    CHECK(!attaches(path, bad));
+
+    bad = intact;
+    patch<uint32_t>(bad, "IDXBLOCK", (block_begin + block_count - 1) * BLOCK_SIZE + BLOCK_DOC_OFFSET, 1u << 30);
+    CHECK(!attaches(path, bad));
+
+    bad = intact;
+    patch<uint8_t>(bad, "IDXBLOCK", block_begin * BLOCK_SIZE + BLOCK_FREQ_BITS, 40);
+    CHECK(!attaches(path, bad));
+
+    bad = intact;
+    find_section(bad, "IDXLENS0")->size -= 4;
+    CHECK(!attaches(path, bad));
+
+    // A tail holds at most CODEC_BLOCK postings, even where the section has
+    // room for more and their doc ids are in order.
+    bad = intact;
+    patch<uint32_t>(bad, "IDXPLIST", entry + ENTRY_BLOCK_COUNT, 0);
+    patch<uint32_t>(bad, "IDXPLIST", entry + ENTRY_TAIL_COUNT, 200);
+    for (uint32_t i = 0; i < 200; ++i)
+        patch<uint32_t>(bad, "IDXTAILS", (tail_begin + i) * POSTING_SIZE, i);
+    CHECK(!attaches(path, bad));
+
+    bad = intact;
+    patch<uint32_t>(bad, "IDXTAILS", (tail_begin + tail_count - 1) * POSTING_SIZE, 5000);
+    CHECK(!attaches(path, bad));
+
+    bad = intact;
+    patch<uint32_t>(bad, "IDXTAILS", tail_begin * POSTING_SIZE, 0);
+    CHECK(!attaches(path, bad));
+
+    bad = intact;
+    patch<uint32_t>(bad, "IDXBLOCK", (block_begin + block_count - 1) * BLOCK_SIZE + BLOCK_LAST_DOC, 5000);
+    CHECK(!attaches(path, bad));
+
+    // 1000 documents leave the top 24 bits of the last bitmap word unused.
+    bad = intact;
+    patch<uint64_t>(bad, "IDXBITMP", (bitmap_begin + 15) * 8, ~uint64_t(0));
+    CHECK(!attaches(path, bad));
+
+    // A string table's offsets never decrease and its sort order only
+    // names strings it holds.
+    uint64_t term_count = 0;
+    std::memcpy(&term_count, &intact[find_section(bad, "IDXTERMS")->offset], 8);
+    CHECK(term_count > 2);
+    bad = intact;
+    patch<uint64_t>(bad, "IDXTERMS", STRINGS_OFFSETS + 8, 1u << 20);
+    CHECK(!attaches(path, bad));
+
+    bad = intact;
+    patch<uint32_t>(bad, "IDXTERMS", STRINGS_OFFSETS + (term_count + 1) * 8 + 4, term_count);
+    CHECK(!attaches(path, bad));
+
+    CHECK(attaches(path, intact));
+    std::remove(path.c_str());
+    std::printf("index image checks ok\n");
+    return 0;
+}
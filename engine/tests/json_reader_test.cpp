@@ -0,0 +1,62 @@
+#include "json_reader.h"
+#include "test_check.h"
+#include <cstdio>
+#include <string>
+
+// Field extraction from NDJSON lines: escapes, \u sequences that are
+// truncated or not hex, which must not swallow the closing quote, and
+// strings long enough for the vector scanners.
+
+static Document parse(const std::string& line) {
+    Document doc;
+    NdjsonReader::parse_document(line, doc);
+    return doc;
+}
+
+int main() {
+    Document doc = parse("{\"url\":\"http://a\",\"title\":\"T\",\"text\":\"body\"}");
+    CHECK(doc.url == "http://a" && doc.title == "T" && doc.text == "body");
+
+    doc = parse("{\"text\":\"a\\nb\\tc\\\"d\\\\e\\/f\\qg\",\"url\":\"u\"}");
+    CHECK(doc.text == "a\nb\tc\"d\\e/f\\qg");
+    CHECK(doc.url == "u");
+
+    doc = parse("{\"text\":\"caf\\u00e9 \\uD83D\\uDE00!\",\"url\":\"u\"}");
+    CHECK(doc.text == "caf? ?" "?!");
+
+    // A \u cut short by the closing quote leaves the string there.
+    doc = parse("{\"title\":\"ab\\u12\",\"url\":\"http://x\",\"text\":\"t\"}");
+    CHECK(doc.title == "abu12");
+    CHECK(doc.url == "http://x");
+    CHECK(doc.text == "t");
+
+    doc = parse("{\"title\":\"\\u\",\"url\":\"http://y\",\"text\":\"t\"}");
+    CHECK(doc.title == "u");
+    CHECK(doc.url == "http://y");
+
+    doc = parse("{\"title\":\"x\\uZZZZ\",\"url\":\"http://z\",\"text\":\"t\"}");
+    CHECK(doc.title == "xuZZZZ");
+    CHECK(doc.url == "http://z");
+
+    // Truncated lines end the value at the end of the line.
+    doc = parse("{\"url\":\"u\",\"text\":\"cut\\u00");
+    CHECK(doc.text == "cutu00");
+    doc = parse("{\"url\":\"u\",\"text\":\"cut\\");
+    CHECK(doc.text == "cut\\");
+
+    // Escapes on both sides of 16, 32 and 64-byte boundaries.
+    for (size_t pad = 0; pad < 130; ++pad) {
+        std::string text(pad, 'x');
+        std::string line = "{\"text\":\"" + text + "\\\"q\\u0041" + text + "\\u12\",\"url\":\"v\"}";
+        doc = parse(line);
+        CHECK(doc.text == text + "\"q?" + text + "u12");
+        CHECK(doc.url == "v");
+    }
+
+    // Unwanted fields, nested values included, are skipped.
+    doc = parse("{\"meta\":{\"a\":[1,\"]}\\u12\"]},\"n\":42,\"url\":\"w\",\"text\":\"t\"}");
+    CHECK(doc.url == "w" && doc.text == "t");
+
+    std::printf("json reader ok\n");
+    return 0;
+}
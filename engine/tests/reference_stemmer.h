@@ -0,0 +1,264 @@
+#ifndef REFERENCE_STEMMER_H
+#define REFERENCE_STEMMER_H
+
+#include <string>
+#include <vector>
+
+// The std::string stemmer that the suffix-trie one replaced, kept as the
+// reference its output must match: each step scans its suffix list in
+// order and strips the first one that ends the word past the RV position,
+// where the word keeps more bytes than RV plus the suffix.
+class ReferenceStemmer {
+public:
+    std::string stem(const std::string& word) const {
+        if (word.size() < 4) {
+            return word;
+        }
+
+        std::string result = word;
+        size_t rv = get_rv_position(result);
+
+        step1(result, rv);
+        step2(result, rv);
+        step3(result, rv);
+        step4(result, rv);
+
+        return result;
+    }
+
+    // Every suffix a step can strip, for building test words.
+    static std::vector<std::string> suffixes() {
+        std::vector<std::string> out;
+        const char* const* lists[] = {PERFECTIVE, REFLEXIVE, ADJECTIVE, NOUN, VERB, DERIVATIONAL, SUPERLATIVE};
+        for (const char* const* list : lists) {
+            for (int i = 0; list[i]; ++i)
+                out.push_back(list[i]);
+        }
+        out.push_back(NN);
+        return out;
+    }
+
+private:
+    static constexpr const char* PERFECTIVE[] = {
+        "\xD0\xB8\xD0\xB2\xD1\x88\xD0\xB8\xD1\x81\xD1\x8C",
+        "\xD1\x8B\xD0\xB2\xD1\x88\xD0\xB8\xD1\x81\xD1\x8C",
+        "\xD0\xB2\xD1\x88\xD0\xB8\xD1\x81\xD1\x8C",
+        "\xD0\xB8\xD0\xB2\xD1\x88\xD0\xB8",
+        "\xD1\x8B\xD0\xB2\xD1\x88\xD0\xB8",
+        "\xD0\xB2\xD1\x88\xD0\xB8",
+        "\xD0\xB8\xD0\xB2",
+        "\xD1\x8B\xD0\xB2",
+        "\xD0\xB2",
+        nullptr
+    };
+
+    static constexpr const char* REFLEXIVE[] = {
+        "\xD1\x81\xD1\x8F",
+        "\xD1\x81\xD1\x8C",
+        nullptr
+    };
+
+    static constexpr const char* ADJECTIVE[] = {
+        "\xD0\xB8\xD0\xBC\xD0\xB8",
+        "\xD1\x8B\xD0\xBC\xD0\xB8",
+        "\xD0\xB5\xD0\xB3\xD0\xBE",
+        "\xD0\xBE\xD0\xB3\xD0\xBE",
+        "\xD0\xB5\xD0\xBC\xD1\x83",
+        "\xD0\xBE\xD0\xBC\xD1\x83",
+        "\xD0\xB5\xD0\xB5",
+        "\xD0\xB8\xD0\xB5",
+        "\xD1\x8B\xD0\xB5",
+        "\xD0\xBE\xD0\xB5",
+        "\xD0\xB5\xD0\xB9",
+        "\xD0\xB8\xD0\xB9",
+        "\xD1\x8B\xD0\xB9",
+        "\xD0\xBE\xD0\xB9",
+        "\xD0\xB5\xD0\xBC",
+        "\xD0\xB8\xD0\xBC",
+        "\xD1\x8B\xD0\xBC",
+        "\xD0\xBE\xD0\xBC",
+        "\xD0\xB8\xD1\x85",
+        "\xD1\x8B\xD1\x85",
+        "\xD1\x83\xD1\x8E",
+        "\xD1\x8E\xD1\x8E",
+        "\xD0\xB0\xD1\x8F",
+        "\xD1\x8F\xD1\x8F",
+        "\xD0\xBE\xD1\x8E",
+        "\xD0\xB5\xD1\x8E",
+        nullptr
+    };
+
+    static constexpr const char* NOUN[] = {
+        "\xD0\xB8\xD1\x8F\xD0\xBC\xD0\xB8",
+        "\xD1\x8F\xD0\xBC\xD0\xB8",
+        "\xD0\xB0\xD0\xBC\xD0\xB8",
+        "\xD0\xB8\xD0\xB5\xD0\xB9",
+        "\xD0\xB8\xD1\x8F\xD0\xBC",
+        "\xD0\xB8\xD0\xB5\xD0\xBC",
+        "\xD0\xB8\xD1\x8F\xD1\x85",
+        "\xD0\xBE\xD0\xB2",
+        "\xD0\xB5\xD0\xB2",
+        "\xD0\xB5\xD0\xB9",
+        "\xD0\xBE\xD0\xB9",
+        "\xD0\xB8\xD0\xB9",
+        "\xD1\x8F\xD0\xBC",
+        "\xD0\xB5\xD0\xBC",
+        "\xD0\xB0\xD0\xBC",
+        "\xD0\xBE\xD0\xBC",
+        "\xD0\xB0\xD1\x85",
+        "\xD1\x8F\xD1\x85",
+        "\xD0\xB8\xD1\x8E",
+        "\xD1\x8C\xD1\x8E",
+        "\xD1\x8C\xD1\x8F",
+        "\xD1\x8C\xD0\xB5",
+        "\xD0\xB8\xD0\xB8",
+        "\xD0\xB8",
+        "\xD1\x8B",
+        "\xD1\x83",
+        "\xD0\xBE",
+        "\xD0\xB9",
+        "\xD0\xB0",
+        "\xD0\xB5",
+        "\xD1\x8F",
+        "\xD1\x8C",
+        nullptr
+    };
+
+    static constexpr const char* VERB[] = {
+        "\xD0\xB5\xD0\xB9\xD1\x82\xD0\xB5",
+        "\xD1\x83\xD0\xB9\xD1\x82\xD0\xB5",
+        "\xD0\xB8\xD1\x82\xD0\xB5",
+        "\xD0\xB9\xD1\x82\xD0\xB5",
+        "\xD0\xB5\xD1\x88\xD1\x8C",
+        "\xD0\xB5\xD1\x82\xD0\xB5",
+        "\xD1\x83\xD1\x8E\xD1\x82",
+        "\xD1\x8E\xD1\x82",
+        "\xD0\xB0\xD1\x82",
+        "\xD1\x8F\xD1\x82",
+        "\xD0\xBD\xD1\x8B",
+        "\xD0\xB5\xD0\xBD",
+        "\xD1\x82\xD1\x8C",
+        "\xD0\xB8\xD1\x88\xD1\x8C",
+        "\xD1\x83\xD1\x8E",
+        "\xD1\x8E",
+        "\xD0\xBB\xD0\xB0",
+        "\xD0\xBD\xD0\xB0",
+        "\xD0\xBB\xD0\xB8",
+        "\xD0\xBB\xD0\xBE",
+        "\xD0\xBD\xD0\xBE",
+        "\xD0\xB5\xD1\x82",
+        "\xD0\xB9",
+        "\xD0\xBB",
+        "\xD0\xBD",
+        nullptr
+    };
+
+    static constexpr const char* DERIVATIONAL[] = {
+        "\xD0\xBE\xD1\x81\xD1\x82\xD1\x8C",
+        "\xD0\xBE\xD1\x81\xD1\x82",
+        nullptr
+    };
+
+    static constexpr const char* SUPERLATIVE[] = {
+        "\xD0\xB5\xD0\xB9\xD1\x88\xD0\xB5",
+        "\xD0\xB5\xD0\xB9\xD1\x88",
+        nullptr
+    };
+
+    static constexpr const char* NN = "\xD0\xBD\xD0\xBD";
+    static constexpr const char* SOFT = "\xD1\x8C";
+    static constexpr const char* I = "\xD0\xB8";
+
+    static bool is_vowel(const std::string& word, size_t pos) {
+        if (pos + 1 >= word.size()) return false;
+
+        unsigned char c1 = word[pos];
+        unsigned char c2 = word[pos + 1];
+
+        if (c1 == 0xD0) {
+            return c2 == 0xB0 || c2 == 0xB5 || c2 == 0xB8 || c2 == 0xBE;
+        }
+        if (c1 == 0xD1) {
+            return c2 == 0x83 || c2 == 0x8B || c2 == 0x8D ||
+                   c2 == 0x8E || c2 == 0x8F || c2 == 0x91;
+        }
+
+        return false;
+    }
+
+    static size_t get_rv_position(const std::string& word) {
+        for (size_t i = 0; i + 1 < word.size(); i += 2) {
+            if (is_vowel(word, i)) {
+                return i + 2;
+            }
+        }
+        return word.size();
+    }
+
+    static bool ends_with(const std::string& word, const std::string& suffix) {
+        if (suffix.size() > word.size()) return false;
+        return word.compare(word.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    static std::string remove_suffix(const std::string& word, size_t suffix_len) {
+        return word.substr(0, word.size() - suffix_len);
+    }
+
+    // Strips the first suffix of the list that fits; false if none does.
+    static bool strip_first(std::string& word, size_t rv, const char* const* list) {
+        for (int i = 0; list[i]; ++i) {
+            std::string suf = list[i];
+            if (word.size() > rv + suf.size() && ends_with(word, suf)) {
+                word = remove_suffix(word, suf.size());
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool step1(std::string& word, size_t rv) {
+        if (strip_first(word, rv, PERFECTIVE)) return true;
+        strip_first(word, rv, REFLEXIVE);
+        if (strip_first(word, rv, ADJECTIVE)) return true;
+        if (strip_first(word, rv, VERB)) return true;
+        return strip_first(word, rv, NOUN);
+    }
+
+    static bool step2(std::string& word, size_t rv) {
+        std::string suf = I;
+        if (word.size() > rv + suf.size() && ends_with(word, suf)) {
+            word = remove_suffix(word, suf.size());
+            return true;
+        }
+        return false;
+    }
+
+    static bool step3(std::string& word, size_t rv) {
+        return strip_first(word, rv, DERIVATIONAL);
+    }
+
+    static bool step4(std::string& word, size_t rv) {
+        std::string nn = NN;
+        if (word.size() > rv + nn.size() && ends_with(word, nn)) {
+            word = remove_suffix(word, 2);
+            return true;
+        }
+
+        if (strip_first(word, rv, SUPERLATIVE)) {
+            if (word.size() > rv + nn.size() && ends_with(word, nn)) {
+                word = remove_suffix(word, 2);
+            }
+            return true;
+        }
+
+        std::string soft = SOFT;
+        if (word.size() > rv + soft.size() && ends_with(word, soft)) {
+            word = remove_suffix(word, soft.size());
+            return true;
+        }
+
+        return false;
+    }
+};
+
+#endif
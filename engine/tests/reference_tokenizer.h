@@ -0,0 +1,108 @@
+#ifndef REFERENCE_TOKENIZER_H
+#define REFERENCE_TOKENIZER_H
+
+#include <string>
+#include <vector>
+#include "tokenizer.h"
+
+// The byte-at-a-time tokenizer that the SSE2 one replaced, kept as the
+// reference its output must match: tokens are runs of ASCII letters,
+// digits, '-' and two-byte Cyrillic letters, lowercased, and kept when
+// they are at least two characters long and contain a letter.
+class ReferenceTokenizer {
+public:
+    std::vector<Token> tokenize(const std::string& text) const {
+        std::vector<Token> tokens;
+        std::string current;
+        size_t start = 0;
+        for (size_t i = 0; i < text.size(); ++i) {
+            unsigned char c = text[i];
+            bool word_char = false;
+            size_t len = 1;
+            if ((c & 0x80) == 0) {
+                word_char = is_letter(c) || (c >= '0' && c <= '9') || c == '-';
+            } else if ((c & 0xE0) == 0xC0 && i + 1 < text.size()) {
+                word_char = is_cyrillic(c, text[i + 1]);
+                len = 2;
+            }
+            if (word_char) {
+                if (current.empty()) start = i;
+                current.append(text, i, len);
+                i += len - 1;
+            } else {
+                flush(current, start, tokens);
+            }
+        }
+        flush(current, start, tokens);
+        return tokens;
+    }
+
+private:
+    static bool is_letter(unsigned char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    static bool is_cyrillic(unsigned char c1, unsigned char c2) {
+        if (c1 == 0xD0) return (c2 >= 0x90 && c2 <= 0xBF) || c2 == 0x81;
+        if (c1 == 0xD1) return (c2 >= 0x80 && c2 <= 0x8F) || c2 == 0x91;
+        return false;
+    }
+
+    static std::string to_lower(const std::string& s) {
+        std::string out;
+        for (size_t i = 0; i < s.size(); ++i) {
+            unsigned char c = s[i];
+            unsigned char c2 = i + 1 < s.size() ? s[i + 1] : 0;
+            if (c >= 'A' && c <= 'Z') {
+                out += static_cast<char>(c + 32);
+            } else if (c == 0xD0 && c2 >= 0x90 && c2 <= 0x9F) {
+                out += static_cast<char>(0xD0);
+                out += static_cast<char>(c2 + 0x20);
+                ++i;
+            } else if (c == 0xD0 && c2 >= 0xA0 && c2 <= 0xAF) {
+                out += static_cast<char>(0xD1);
+                out += static_cast<char>(c2 - 0x20);
+                ++i;
+            } else if (c == 0xD0 && c2 == 0x81) {
+                out += static_cast<char>(0xD1);
+                out += static_cast<char>(0x91);
+                ++i;
+            } else {
+                out += static_cast<char>(c);
+            }
+        }
+        return out;
+    }
+
+    static bool is_valid(const std::string& token) {
+        size_t chars = 0;
+        bool has_letter = false;
+        for (size_t i = 0; i < token.size(); ++i) {
+            unsigned char c = token[i];
+            if ((c & 0x80) == 0) {
+                ++chars;
+                if (is_letter(c)) has_letter = true;
+            } else if ((c & 0xE0) == 0xC0) {
+                ++chars;
+                has_letter = true;
+                ++i;
+            } else if ((c & 0xF0) == 0xE0) {
+                ++chars;
+                i += 2;
+            } else if ((c & 0xF8) == 0xF0) {
+                ++chars;
+                i += 3;
+            }
+        }
+        return chars >= 2 && has_letter;
+    }
+
+    static void flush(std::string& current, size_t start, std::vector<Token>& tokens) {
+        if (current.empty()) return;
+        std::string lower = to_lower(current);
+        if (is_valid(lower)) tokens.push_back({lower, start});
+        current.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include "set_ops.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// Crossover benchmark for intersect_into(): time per intersection of each
+// method as the longer list grows, to check GALLOP_RATIO and SIMD_RATIO.
+// Usage: set_ops_bench [short list length]
+
+static std::vector<uint32_t> random_ids(std::mt19937& rng, size_t n, uint32_t universe) {
+    std::vector<uint32_t> ids;
+    ids.reserve(n);
+    for (size_t i = 0; i < n; ++i)
+        ids.push_back(rng() % universe);
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    return ids;
+}
+
+static double time_method(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b,
+                          IntersectMethod method) {
+    std::vector<uint32_t> out;
+    size_t reps = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    do {
+        intersect_into(a.data(), a.size(), b.data(), b.size(), out, method);
+        ++reps;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < 0.05);
+    return elapsed / reps * 1e6;
+}
+
+int main(int argc, char** argv) {
+    size_t small = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4096;
+    std::mt19937 rng(1);
+    static const IntersectMethod methods[] = {
+        IntersectMethod::MERGE, IntersectMethod::SIMD, IntersectMethod::GALLOP, IntersectMethod::AUTO
+    };
+    static const char* names[] = {"merge", "simd", "gallop", "auto"};
+
+    std::printf("short list %zu ids, microseconds per intersection\n", small);
+    std::printf("%6s %10s %10s %10s %10s  fastest\n", "ratio", "merge", "simd", "gallop", "auto");
+    for (size_t ratio = 1; ratio <= 256; ratio *= 2) {
+        // Both lists drawn from a universe four times the longer one, so
+        // about a quarter of the short list matches.
+        uint32_t universe = static_cast<uint32_t>(small * ratio * 4);
+        std::vector<uint32_t> a = random_ids(rng, small, universe);
+        std::vector<uint32_t> b = random_ids(rng, small * ratio, universe);
+        double us[4];
+        size_t best = 0;
+        for (size_t m = 0; m < 4; ++m) {
+            us[m] = time_method(a, b, methods[m]);
+            if (m < 3 && us[m] < us[best]) best = m;
+        }
+        std::printf("%6zu %10.1f %10.1f %10.1f %10.1f  %s\n",
+                    ratio, us[0], us[1], us[2], us[3], names[best]);
+    }
+    return 0;
+}
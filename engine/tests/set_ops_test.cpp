@@ -0,0 +1,89 @@
+#include "set_ops.h"
+#include "test_check.h"
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <random>
+#include <vector>
+
+// Every intersection method, and union and difference on both sides of
+// the galloping threshold, against the scalar merges of <algorithm>.
+
+static std::vector<uint32_t> random_ids(std::mt19937& rng, size_t n, uint32_t universe) {
+    std::vector<uint32_t> ids;
+    ids.reserve(n);
+    for (size_t i = 0; i < n; ++i)
+        ids.push_back(rng() % universe);
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    return ids;
+}
+
+static void check_pair(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+    static const IntersectMethod methods[] = {
+        IntersectMethod::AUTO, IntersectMethod::MERGE, IntersectMethod::SIMD, IntersectMethod::GALLOP
+    };
+    std::vector<uint32_t> expect, out;
+
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expect));
+    for (IntersectMethod method : methods) {
+        intersect_into(a.data(), a.size(), b.data(), b.size(), out, method);
+        CHECK(out == expect);
+        intersect_into(b.data(), b.size(), a.data(), a.size(), out, method);
+        CHECK(out == expect);
+    }
+
+    expect.clear();
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expect));
+    unite_into(a.data(), a.size(), b.data(), b.size(), out);
+    CHECK(out == expect);
+
+    expect.clear();
+    std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expect));
+    subtract_into(a.data(), a.size(), b.data(), b.size(), out);
+    CHECK(out == expect);
+
+    expect.clear();
+    std::set_difference(b.begin(), b.end(), a.begin(), a.end(), std::back_inserter(expect));
+    subtract_into(b.data(), b.size(), a.data(), a.size(), out);
+    CHECK(out == expect);
+}
+
+int main() {
+    std::mt19937 rng(7);
+    size_t pairs = 0;
+
+    // Short lists hit every SIMD block tail and the empty cases.
+    for (size_t na = 0; na <= 12; ++na) {
+        for (size_t nb = 0; nb <= 12; ++nb) {
+            for (int round = 0; round < 20; ++round) {
+                check_pair(random_ids(rng, na, 24), random_ids(rng, nb, 24));
+                ++pairs;
+            }
+        }
+    }
+
+    // Length ratios on both sides of SIMD_RATIO and GALLOP_RATIO, sparse
+    // and dense overlaps.
+    static const size_t ratios[] = {1, 2, 3, 4, 5, 8, 15, 16, 17, 32, 100, 1000};
+    for (size_t ratio : ratios) {
+        for (uint32_t universe : {2000u, 200000u, 0xFFFFFFFFu}) {
+            for (int round = 0; round < 10; ++round) {
+                size_t small = 1 + rng() % 200;
+                check_pair(random_ids(rng, small, universe), random_ids(rng, small * ratio, universe));
+                ++pairs;
+            }
+        }
+    }
+
+    // Ids at the top of the range.
+    std::vector<uint32_t> high = {0xFFFFFFF0u, 0xFFFFFFF8u, 0xFFFFFFFEu, 0xFFFFFFFFu};
+    std::vector<uint32_t> all;
+    for (uint32_t id = 0xFFFFFF00u; id != 0; ++id)
+        all.push_back(id);
+    check_pair(high, all);
+    ++pairs;
+
+    std::printf("%zu pairs checked\n", pairs);
+    return 0;
+}
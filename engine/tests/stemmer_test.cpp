@@ -0,0 +1,66 @@
+#include "stemmer.h"
+#include "reference_stemmer.h"
+#include "test_check.h"
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+// PorterStemmer against the reference stemmer on words built from a short
+// stem followed by a chain of the suffixes the steps strip, so that one
+// step's leftovers line up with the next step's suffixes, plus stems with
+// no vowel, Latin letters and stray UTF-8 bytes around the RV position.
+
+static void check_word(const PorterStemmer& stemmer, const std::string& word) {
+    static const ReferenceStemmer reference;
+    std::string expect = reference.stem(word);
+    CHECK(stemmer.stem(word) == expect);
+    CHECK(stemmer.stem_length(word) == expect.size());
+}
+
+int main() {
+    PorterStemmer stemmer;
+    std::vector<std::string> suffixes = ReferenceStemmer::suffixes();
+
+    static const char* letters[] = {
+        "\xD0\xB0", "\xD0\xB1", "\xD0\xB2", "\xD0\xB3", "\xD0\xB4", "\xD0\xB5", "\xD0\xB6",
+        "\xD0\xB7", "\xD0\xB8", "\xD0\xB9", "\xD0\xBA", "\xD0\xBB", "\xD0\xBC", "\xD0\xBD",
+        "\xD0\xBE", "\xD0\xBF", "\xD1\x80", "\xD1\x81", "\xD1\x82", "\xD1\x83", "\xD1\x84",
+        "\xD1\x85", "\xD1\x86", "\xD1\x87", "\xD1\x88", "\xD1\x89", "\xD1\x8A", "\xD1\x8B",
+        "\xD1\x8C", "\xD1\x8D", "\xD1\x8E", "\xD1\x8F", "\xD1\x91",
+        "a", "z", "9", "-", "\xD0", "\xD1", "\xC3\xA9",
+    };
+    const size_t letter_count = sizeof(letters) / sizeof(letters[0]);
+
+    // Every suffix and pair of suffixes after a few fixed stems.
+    static const char* stems[] = {
+        "", "\xD0\xBA", "\xD0\xB1\xD1\x80", "\xD0\xBA\xD0\xBE", "\xD1\x81\xD1\x82\xD0\xBE\xD0\xBB",
+        "\xD0\xBC\xD0\xB8\xD1\x80", "ab", "\xD0\xB0",
+    };
+    size_t words = 0;
+    for (const char* stem : stems) {
+        for (const std::string& a : suffixes) {
+            check_word(stemmer, stem + a);
+            for (const std::string& b : suffixes) {
+                check_word(stemmer, stem + a + b);
+                words += 2;
+            }
+        }
+    }
+
+    std::mt19937 rng(23);
+    for (int round = 0; round < 300000; ++round) {
+        std::string word;
+        size_t n = rng() % 5;
+        for (size_t i = 0; i < n; ++i)
+            word += letters[rng() % (round % 4 == 0 ? letter_count : 33)];
+        size_t chain = rng() % 5;
+        for (size_t i = 0; i < chain; ++i)
+            word += suffixes[rng() % suffixes.size()];
+        check_word(stemmer, word);
+        ++words;
+    }
+
+    std::printf("%zu words stemmed alike\n", words);
+    return 0;
+}
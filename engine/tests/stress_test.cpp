@@ -0,0 +1,131 @@
+#include "boolean_search.h"
+#include "test_check.h"
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Searches run on snapshots while a writer adds, re-crawls and removes
+// documents, the merger rewrites segments behind them, and reset() swaps
+// in a whole new index the way a reload does. Every document has the term
+// "every" and exactly one of "left" and "right", so each snapshot's hit
+// counts are known from its live document count.
+
+static const size_t URL_POOL = 600;
+static const int ROUNDS = 400;
+static const size_t READERS = 3;
+
+static std::vector<std::string> document_terms(std::mt19937& rng, const PorterStemmer& stemmer) {
+    static const char* filler[] = {"search", "engine", "index", "segment", "merge", "query", "ranking"};
+    std::vector<std::string> terms;
+    terms.push_back(stemmer.stem("every"));
+    terms.push_back(stemmer.stem(rng() % 2 ? "left" : "right"));
+    size_t extra = rng() % 6;
+    for (size_t i = 0; i < extra; ++i)
+        terms.push_back(stemmer.stem(filler[rng() % 7]));
+    return terms;
+}
+
+static size_t hits_of(const BooleanSearch& search, const std::string& query) {
+    size_t hits = 0;
+    search.rank(query, 10, &hits, Ranking::BM25);
+    return hits;
+}
+
+static void check_snapshot(const SegmentSet& set) {
+    BooleanSearch search(set);
+    size_t live = set.live_document_count();
+
+    size_t hits = 0;
+    std::vector<ScoredDoc> top = search.rank("every", 20, &hits, Ranking::BM25);
+    CHECK(hits == live);
+    CHECK(top.size() == (live < 20 ? live : 20));
+    for (size_t i = 0; i < top.size(); ++i) {
+        CHECK(top[i].doc_id < set.document_count());
+        size_t local = 0;
+        const Segment& seg = set.segment_of(top[i].doc_id, local);
+        CHECK(!seg.is_deleted(local));
+        CHECK(set.get_doc_id(top[i].doc_id).substr(0, 4) == "doc-");
+        if (i > 0) CHECK(top[i].score <= top[i - 1].score);
+    }
+
+    CHECK(hits_of(search, "left OR right") == live);
+    CHECK(hits_of(search, "left AND right") == 0);
+    CHECK(hits_of(search, "left") + hits_of(search, "right") == live);
+    CHECK(hits_of(search, "every AND NOT left") == hits_of(search, "right"));
+
+    // A prepared query ranks exactly like the query string.
+    BooleanSearch::PreparedQuery prepared = search.prepare_query("right OR every", Ranking::BM25);
+    CHECK(prepared.key == search.canonical_query("every OR right", Ranking::BM25));
+    size_t prepared_hits = 0;
+    std::vector<ScoredDoc> from_plan = search.rank(prepared, 20, &prepared_hits);
+    std::vector<ScoredDoc> from_query = search.rank("right OR every", 20, &hits, Ranking::BM25);
+    CHECK(prepared_hits == hits);
+    CHECK(from_plan.size() == from_query.size());
+    for (size_t i = 0; i < from_plan.size(); ++i)
+        CHECK(from_plan[i].doc_id == from_query[i].doc_id && from_plan[i].score == from_query[i].score);
+}
+
+int main() {
+    SegmentedIndex index;
+    std::atomic<bool> done(false);
+    std::atomic<size_t> queries(0);
+
+    std::vector<std::thread> readers;
+    for (size_t r = 0; r < READERS; ++r) {
+        readers.emplace_back([&index, &done, &queries] {
+            while (!done) {
+                std::shared_ptr<const SegmentSet> set = index.snapshot();
+                check_snapshot(*set);
+                ++queries;
+            }
+        });
+    }
+
+    std::mt19937 rng(12345);
+    PorterStemmer stemmer;
+    std::set<std::string> live;
+    uint32_t record = 0;
+    for (int round = 0; round < ROUNDS; ++round) {
+        if (round % 100 == 50) {
+            // A reload: one finalized index replaces all segments.
+            std::shared_ptr<InvertedIndex> fresh = std::make_shared<InvertedIndex>(1024, 1024);
+            std::vector<uint32_t> records;
+            live.clear();
+            for (size_t i = 0; i < URL_POOL / 3; ++i) {
+                std::string url = "doc-" + std::to_string(rng() % URL_POOL);
+                if (!live.insert(url).second) continue;
+                fresh->add_document(url, document_terms(rng, stemmer));
+                records.push_back(record++);
+            }
+            fresh->finalize();
+            index.reset(fresh, std::move(records));
+            continue;
+        }
+        for (int i = 0; i < 20; ++i) {
+            std::string url = "doc-" + std::to_string(rng() % URL_POOL);
+            index.add_document(url, record++, document_terms(rng, stemmer));
+            live.insert(url);
+        }
+        index.refresh();
+        std::string gone = "doc-" + std::to_string(rng() % URL_POOL);
+        CHECK(index.remove(gone) == (live.erase(gone) == 1));
+        if (round % 100 == 90) index.force_merge();
+    }
+
+    done = true;
+    for (size_t r = 0; r < readers.size(); ++r)
+        readers[r].join();
+
+    std::shared_ptr<const SegmentSet> last = index.snapshot();
+    check_snapshot(*last);
+    CHECK(last->live_document_count() == live.size());
+    CHECK(index.merge_count() > 0);
+    CHECK(queries > 0);
+    std::printf("%zu snapshots checked, %zu merges\n", static_cast<size_t>(queries), index.merge_count());
+    return 0;
+}
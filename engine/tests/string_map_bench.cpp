@@ -0,0 +1,82 @@
+#include "string_map.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// StringMap against std::unordered_map: inserts into a map grown from the
+// smallest table, with the slowest single insert to show the incremental
+// rehash at work, then lookups of present and absent keys and erases.
+// Usage: string_map_bench [key count]
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double>(to - from).count();
+}
+
+template<typename Map, typename Insert, typename Find, typename Erase>
+static void run(const char* name, Map& map, const std::vector<std::string>& keys,
+                const std::vector<std::string>& misses, Insert insert, Find find, Erase erase) {
+    double worst = 0;
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        Clock::time_point before = Clock::now();
+        insert(map, keys[i], static_cast<uint32_t>(i));
+        worst = std::max(worst, seconds(before, Clock::now()));
+    }
+    double insert_time = seconds(start, Clock::now());
+
+    size_t found = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < keys.size(); ++i)
+        found += find(map, keys[i]);
+    double hit_time = seconds(start, Clock::now());
+    start = Clock::now();
+    for (size_t i = 0; i < misses.size(); ++i)
+        found += find(map, misses[i]);
+    double miss_time = seconds(start, Clock::now());
+    start = Clock::now();
+    for (size_t i = 0; i < keys.size(); i += 2)
+        erase(map, keys[i]);
+    double erase_time = seconds(start, Clock::now());
+
+    double n = static_cast<double>(keys.size());
+    std::printf("%-14s %9.1f %9.1f %9.1f %9.1f %12.0f  (%zu)\n", name,
+                insert_time / n * 1e9, hit_time / n * 1e9, miss_time / misses.size() * 1e9,
+                erase_time / (n / 2) * 1e9, worst * 1e6, found);
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000000;
+    std::mt19937_64 rng(3);
+    std::vector<std::string> keys, misses;
+    for (size_t i = 0; i < count; ++i) {
+        std::string key = "term" + std::to_string(rng() % 1000000000) + "_" + std::to_string(i);
+        keys.push_back(key);
+        misses.push_back(key + "#");
+    }
+    std::shuffle(misses.begin(), misses.end(), rng);
+
+    std::printf("%zu keys, nanoseconds per operation\n", count);
+    std::printf("%-14s %9s %9s %9s %9s %12s\n", "", "insert", "hit", "miss", "erase", "worst ins us");
+    {
+        StringMap<uint32_t> map(16);
+        run("StringMap", map, keys, misses,
+            [](StringMap<uint32_t>& m, const std::string& k, uint32_t v) { m.insert(k, v); },
+            [](StringMap<uint32_t>& m, const std::string& k) { return m.find(k) != nullptr; },
+            [](StringMap<uint32_t>& m, const std::string& k) { m.erase(k); });
+    }
+    {
+        std::unordered_map<std::string, uint32_t> map;
+        run("unordered_map", map, keys, misses,
+            [](std::unordered_map<std::string, uint32_t>& m, const std::string& k, uint32_t v) { m[k] = v; },
+            [](std::unordered_map<std::string, uint32_t>& m, const std::string& k) { return m.count(k) != 0; },
+            [](std::unordered_map<std::string, uint32_t>& m, const std::string& k) { m.erase(k); });
+    }
+    return 0;
+}
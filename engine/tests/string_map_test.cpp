@@ -0,0 +1,169 @@
+#include "string_map.h"
+#include "test_check.h"
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// StringMap against std::unordered_map through random inserts, erases
+// and lookups, with extra operations right after each resize while old_
+// is still being drained MIGRATE_STEP slots at a time, and with erase-heavy
+// phases that make the map rebuild at the same size to clear tombstones.
+
+// Counts live instances, so a value leaked or destroyed twice by a
+// migration shows up as a nonzero count once the map is gone.
+struct Counted {
+    static long live;
+    std::unique_ptr<int> value;
+
+    Counted() { ++live; }
+    explicit Counted(int v) : value(new int(v)) { ++live; }
+    Counted(Counted&& other) : value(std::move(other.value)) { ++live; }
+    Counted& operator=(Counted&& other) { value = std::move(other.value); return *this; }
+    ~Counted() { --live; }
+};
+
+long Counted::live = 0;
+
+typedef StringMap<Counted> Map;
+typedef std::unordered_map<std::string, int> Reference;
+
+static void check_all(const Map& map, const Reference& ref) {
+    CHECK(map.size() == ref.size());
+    size_t seen = 0;
+    map.for_each([&ref, &seen](std::string_view key, const Counted& v) {
+        Reference::const_iterator it = ref.find(std::string(key));
+        CHECK(it != ref.end());
+        CHECK(v.value && *v.value == it->second);
+        ++seen;
+    });
+    CHECK(seen == ref.size());
+    for (Reference::const_iterator it = ref.begin(); it != ref.end(); ++it) {
+        const Counted* v = map.find(it->first);
+        CHECK(v && v->value && *v->value == it->second);
+    }
+}
+
+static void random_op(Map& map, Reference& ref, std::mt19937& rng, size_t keyspace, int erase_weight) {
+    std::string key = "key" + std::to_string(rng() % keyspace);
+    int r = rng() % 10;
+    if (r < erase_weight) {
+        CHECK(map.erase(key) == (ref.erase(key) == 1));
+    } else if (r < 6) {
+        int v = static_cast<int>(rng() % 1000000);
+        map.insert(key, Counted(v));
+        ref[key] = v;
+    } else if (r < 8) {
+        Counted& c = map.get_or_create(key);
+        Reference::iterator it = ref.find(key);
+        if (it == ref.end()) {
+            CHECK(!c.value);
+            c.value.reset(new int(-1));
+            ref[key] = -1;
+        } else {
+            CHECK(c.value && *c.value == it->second);
+        }
+    } else {
+        const Counted* c = map.find(key);
+        Reference::iterator it = ref.find(key);
+        CHECK((c != nullptr) == (it != ref.end()));
+        if (c) CHECK(c->value && *c->value == it->second);
+    }
+    CHECK(map.size() == ref.size());
+}
+
+// Grows a map from the smallest table, and after every resize erases,
+// re-inserts and looks up keys while most of them are still in old_.
+static void test_migration() {
+    Map map(16);
+    Reference ref;
+    std::mt19937 rng(5);
+    size_t capacity = map.capacity();
+    int next = 0;
+    size_t resizes = 0;
+    while (map.capacity() < 65536) {
+        std::string key = "grow" + std::to_string(next);
+        map.insert(key, Counted(next));
+        ref[key] = next++;
+        if (map.capacity() == capacity) continue;
+        capacity = map.capacity();
+        ++resizes;
+
+        std::vector<std::string> erased;
+        for (int i = 0; i < 64; ++i) {
+            std::string victim = "grow" + std::to_string(rng() % next);
+            CHECK(map.erase(victim) == (ref.erase(victim) == 1));
+            erased.push_back(victim);
+        }
+        for (size_t i = 0; i < erased.size(); i += 2) {
+            map.insert(erased[i], Counted(-2));
+            ref[erased[i]] = -2;
+        }
+        check_all(map, ref);
+    }
+    CHECK(resizes >= 12);
+
+    // Erase nearly everything, then refill: tombstones outnumber live
+    // slots and the table is rebuilt without growing.
+    for (int i = 0; i < next; ++i) {
+        if (i % 16 == 0) continue;
+        std::string key = "grow" + std::to_string(i);
+        CHECK(map.erase(key) == (ref.erase(key) == 1));
+    }
+    check_all(map, ref);
+    size_t before = map.capacity();
+    for (int i = 0; i < next; ++i) {
+        std::string key = "refill" + std::to_string(i);
+        map.insert(key, Counted(i));
+        ref[key] = i;
+        if (i % 4096 == 0) check_all(map, ref);
+    }
+    check_all(map, ref);
+    CHECK(map.capacity() <= before * 2);
+}
+
+static void test_random() {
+    std::mt19937 rng(11);
+    static const size_t keyspaces[] = {40, 3000, 60000};
+    for (size_t keyspace : keyspaces) {
+        for (int erase_weight = 2; erase_weight <= 4; erase_weight += 2) {
+            Map map(16);
+            Reference ref;
+            for (int op = 0; op < 200000; ++op) {
+                random_op(map, ref, rng, keyspace, erase_weight);
+                if (op % 20000 == 0) check_all(map, ref);
+            }
+            check_all(map, ref);
+            map.clear();
+            ref.clear();
+            check_all(map, ref);
+            for (int op = 0; op < 5000; ++op)
+                random_op(map, ref, rng, keyspace, erase_weight);
+            check_all(map, ref);
+        }
+    }
+}
+
+// Stored keys of a map that is never erased from stay put across resizes.
+static void test_stored_keys() {
+    StringMap<int> map(16);
+    std::vector<std::string_view> stored;
+    for (int i = 0; i < 20000; ++i) {
+        std::string_view view;
+        map.get_or_create("stored" + std::to_string(i), view) = i;
+        stored.push_back(view);
+    }
+    for (int i = 0; i < 20000; ++i)
+        CHECK(stored[i] == "stored" + std::to_string(i));
+}
+
+int main() {
+    test_migration();
+    test_random();
+    test_stored_keys();
+    CHECK(Counted::live == 0);
+    std::printf("string map ok\n");
+    return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+#include <cstdio>
+#include <cstdlib>
+
+// Tests are plain executables run by ctest. A failed CHECK reports where it
+// failed and ends the process at once, so it is safe on any thread.
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if (!(cond)) {                                                           \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, \
+                         #cond);                                                 \
+            std::fflush(stderr);                                                 \
+            std::_Exit(1);                                                       \
+        }                                                                        \
+    } while (0)
+
+#endif
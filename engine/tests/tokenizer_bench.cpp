@@ -0,0 +1,86 @@
+#include "tokenizer.h"
+#include "reference_tokenizer.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Tokenizer throughput in MB/s: the reference tokenizer, the owning
+// tokenize() and the zero-copy one. Reads the files given as arguments,
+// one document per line, or generates mixed English and Russian text.
+// Usage: tokenizer_bench [file...]
+
+static std::vector<std::string> generate(size_t bytes) {
+    static const char* words[] = {
+        "search", "Engine", "index", "query", "posting", "the", "of", "2024", "x-ray",
+        "\xD0\xBF\xD0\xBE\xD0\xB8\xD1\x81\xD0\xBA", "\xD0\x98\xD0\xBD\xD0\xB4\xD0\xB5\xD0\xBA\xD1\x81",
+        "\xD0\xB7\xD0\xB0\xD0\xBF\xD1\x80\xD0\xBE\xD1\x81", "\xD0\xB8",
+    };
+    static const char* separators[] = {" ", " ", " ", ", ", ". ", " \xE2\x80\x94 ", "\n"};
+    std::mt19937 rng(3);
+    std::vector<std::string> docs;
+    size_t total = 0;
+    while (total < bytes) {
+        std::string doc;
+        size_t n = 50 + rng() % 500;
+        for (size_t i = 0; i < n; ++i) {
+            doc += words[rng() % 13];
+            doc += separators[rng() % 7];
+        }
+        total += doc.size();
+        docs.push_back(doc);
+    }
+    return docs;
+}
+
+template<typename Func>
+static double megabytes_per_second(const std::vector<std::string>& docs, size_t bytes, Func func) {
+    size_t rounds = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    do {
+        for (size_t i = 0; i < docs.size(); ++i)
+            func(docs[i]);
+        ++rounds;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < 1.0);
+    return bytes * rounds / 1e6 / elapsed;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> docs;
+    for (int a = 1; a < argc; ++a) {
+        std::ifstream in(argv[a]);
+        std::string line;
+        while (std::getline(in, line))
+            docs.push_back(line);
+    }
+    if (docs.empty()) docs = generate(16 << 20);
+    size_t bytes = 0;
+    for (size_t i = 0; i < docs.size(); ++i)
+        bytes += docs[i].size();
+
+    ReferenceTokenizer reference;
+    Tokenizer tokenizer;
+    std::string arena;
+    std::vector<TokenView> views;
+    size_t sink = 0;
+    double old_rate = megabytes_per_second(docs, bytes, [&](const std::string& d) {
+        sink += reference.tokenize(d).size();
+    });
+    double owned_rate = megabytes_per_second(docs, bytes, [&](const std::string& d) {
+        sink += tokenizer.tokenize(d).size();
+    });
+    double view_rate = megabytes_per_second(docs, bytes, [&](const std::string& d) {
+        tokenizer.tokenize(d, arena, views);
+        sink += views.size();
+    });
+
+    std::printf("%zu documents, %.1f MB\n", docs.size(), bytes / 1e6);
+    std::printf("reference  %8.1f MB/s\n", old_rate);
+    std::printf("owning     %8.1f MB/s\n", owned_rate);
+    std::printf("zero-copy  %8.1f MB/s\n", view_rate);
+    return sink == 0;
+}
@@ -0,0 +1,67 @@
+#include "tokenizer.h"
+#include "reference_tokenizer.h"
+#include "test_check.h"
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+// Both Tokenizer variants against the reference tokenizer on mixed
+// ASCII, Cyrillic, other UTF-8 and truncated multibyte input, long enough
+// that tokens and separators straddle the 16-byte SSE2 blocks.
+
+static void check_text(const Tokenizer& tokenizer, const std::string& text,
+                       std::string& arena, std::vector<TokenView>& views) {
+    static const ReferenceTokenizer reference;
+    std::vector<Token> expect = reference.tokenize(text);
+    std::vector<Token> owned = tokenizer.tokenize(text);
+    tokenizer.tokenize(text, arena, views);
+    CHECK(owned.size() == expect.size());
+    CHECK(views.size() == expect.size());
+    for (size_t i = 0; i < expect.size(); ++i) {
+        CHECK(owned[i].text == expect[i].text);
+        CHECK(owned[i].position == expect[i].position);
+        CHECK(views[i].text == expect[i].text);
+        CHECK(views[i].position == expect[i].position);
+    }
+}
+
+int main() {
+    Tokenizer tokenizer;
+    std::string arena;
+    std::vector<TokenView> views;
+
+    static const char* samples[] = {
+        "",
+        "a",
+        "Hello, World! 42 x-ray --- 3d a1 12",
+        "\xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82, \xD0\x9C\xD0\xB8\xD1\x80! \xD0\x81\xD0\xBB\xD0\xBA\xD0\xB0",
+        "caf\xC3\xA9 na\xC3\xAFve \xE2\x80\x94 emoji\xF0\x9F\x98\x80smile \xD0\x90\xD0\xAF\xD0\xB0\xD1\x8F",
+        "trailing lead byte \xD0",
+        "\xD1\x91\xD0\x81 mixed\xD0\x9A\xD0\xB8\xD1\x80" "ASCII\xD0\xB8\xD1\x86\xD0\xB0 0123456789abcdefXYZ",
+        "                                        padded                                        ",
+    };
+    for (const char* sample : samples)
+        check_text(tokenizer, sample, arena, views);
+
+    static const char* pieces[] = {
+        "a", "Z", "9", "-", " ", ".", ",", "_", "\n", "word", "MiXeD",
+        "\xD0", "\xD1", "\x81", "\x91", "\x90", "\xAF", "\xBF", "\x80",
+        "\xD0\x81", "\xD0\x9F", "\xD0\xA5", "\xD1\x8F", "\xD1\x91", "\xC3\xA9",
+        "\xE2\x80\x94", "\xF0\x9F\x98\x80",
+    };
+    const size_t piece_count = sizeof(pieces) / sizeof(pieces[0]);
+    std::mt19937 rng(17);
+    size_t bytes = 0;
+    for (int round = 0; round < 50000; ++round) {
+        std::string text;
+        size_t n = rng() % (round % 10 == 0 ? 400 : 40);
+        for (size_t i = 0; i < n; ++i)
+            text += pieces[rng() % piece_count];
+        check_text(tokenizer, text, arena, views);
+        bytes += text.size();
+    }
+
+    std::printf("%zu bytes of random text checked\n", bytes);
+    return 0;
+}